@@ -0,0 +1,583 @@
+#include "bits.hpp"
+#include "chip8.hpp"
+#include "quirks.hpp"
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Ahead-of-time compiler: turns ROMs into C++ that Chip8::setNativeProgram
+// runs in place of the interpreter.
+//
+// Starting at 0x200, it follows every jump, call, return site and both sides
+// of every skip to find the ROM's basic blocks, and writes each one out as a
+// function working directly on the State, with operands and the ROM's quirks
+// folded in. Drawing, memory writes and anything else with effects beyond
+// the registers is handed to the interpreter from inside the block. Code it
+// cannot see statically (BNNN targets, code the ROM writes at run time) is
+// simply left out and interpreted when reached.
+//
+// Writes native_<name>.cpp for each ROM and native_programs.cpp, which maps
+// ROM hashes to the compiled programs, into the output directory.
+//
+// Usage: chip8_aot <output directory> <rom>...
+
+namespace {
+
+constexpr unsigned short ROM_START = 0x200;
+// Same cap as the block translator, so a compiled block always fits in one
+// frame's budget of instructions at the default pace and then some.
+constexpr unsigned int MAX_BLOCK_LENGTH = 64;
+
+struct Rom {
+  std::string file;
+  std::string name; // C identifier derived from the file name
+  std::vector<unsigned char> bytes;
+  std::uint64_t hash;
+  Variant variant;
+};
+
+struct Block {
+  unsigned short start;
+  unsigned short end;
+  std::vector<unsigned short> opcodes;
+  bool idleLoop;
+};
+
+// The file name up to its first dot, made into a C identifier the same way as
+// CMake's get_filename_component(NAME_WE) and string(MAKE_C_IDENTIFIER), so
+// the build knows the output names.
+std::string identifier(const std::string& file) {
+  std::string name = std::filesystem::path(file).filename().string();
+  name = name.substr(0, name.find('.'));
+  for (char& c : name) {
+    if (!std::isalnum(static_cast<unsigned char>(c))) {
+      c = '_';
+    }
+  }
+  if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0]))) {
+    name = "_" + name;
+  }
+  return name;
+}
+
+bool loadRom(const char* file, Rom& rom) {
+  std::ifstream in{ file, std::ios::binary };
+  if (!in) {
+    std::cerr << "Could not open ROM: " << file << std::endl;
+    return false;
+  }
+  rom.bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  if (rom.bytes.empty() || rom.bytes.size() > 4096 - ROM_START) {
+    std::cerr << "Not a ROM: " << file << std::endl;
+    return false;
+  }
+  rom.file = std::filesystem::path(file).filename().string();
+  rom.name = identifier(file);
+  rom.hash = fnv1a(rom.bytes.data(), rom.bytes.size());
+  rom.variant = variantFor(rom.hash);
+  return true;
+}
+
+// The opcode at address, or 0 (never valid) if it is not wholly inside the
+// ROM: compiled code may only come from bytes the program can check.
+unsigned short opcodeAt(const Rom& rom, unsigned int address) {
+  if (address < ROM_START || address + 2 > ROM_START + rom.bytes.size()) {
+    return 0;
+  }
+  const unsigned char* bytes = &rom.bytes[address - ROM_START];
+  return static_cast<unsigned short>(bytes[0] << 8 | bytes[1]);
+}
+
+bool isSkip(unsigned short opcode) {
+  switch (opcode & 0xF000) {
+    case 0x3000:
+    case 0x4000:
+    case 0x5000:
+    case 0x9000:
+      return true;
+    case 0xE000:
+      return true; // EX9E and EXA1, the only valid ones
+  }
+  return false;
+}
+
+// Instructions that may leave pc where it is; like the translator, they get a
+// block of their own.
+bool needsOwnBlock(unsigned short opcode) {
+  return (opcode & 0xF0FF) == 0xF00A || opcode == 0x00FD;
+}
+
+// Memory writes end a block, as the write may be to the code right after it.
+bool writesMemory(unsigned short opcode) {
+  return (opcode & 0xF0FF) == 0xF033 || (opcode & 0xF0FF) == 0xF055;
+}
+
+// Reads the block starting at start and adds the addresses control can go to
+// from it to next.
+Block readBlock(const Rom& rom, unsigned short start, std::vector<unsigned short>& next) {
+  Block block = { start, start, {}, false };
+
+  // FX07; 3X00; 1NNN back to the FX07: compiled whole so runCycles can skip it.
+  const unsigned short read = opcodeAt(rom, start);
+  const unsigned short poll = opcodeAt(rom, start + 2);
+  const unsigned short jump = opcodeAt(rom, start + 4);
+  if ((read & 0xF0FF) == 0xF007 && poll == (0x3000 | (read & 0x0F00)) && jump == (0x1000 | start)) {
+    block.opcodes = { read, poll, jump };
+    block.end = start + 6;
+    block.idleLoop = true;
+    next.push_back(block.end);
+    return block;
+  }
+
+  unsigned short address = start;
+  bool ended = false; // by an instruction that decides where to go next
+  while (!ended && block.opcodes.size() < MAX_BLOCK_LENGTH) {
+    const unsigned short opcode = opcodeAt(rom, address);
+    if (!Chip8::isValidOpcode(opcode, rom.variant) || (needsOwnBlock(opcode) && !block.opcodes.empty())) {
+      break;
+    }
+    block.opcodes.push_back(opcode);
+    address += 2;
+
+    const unsigned short nnn = opcode & 0x0FFF;
+    ended = true;
+    if ((opcode & 0xF000) == 0x1000) {
+      next.push_back(nnn);
+    } else if ((opcode & 0xF000) == 0x2000) {
+      next.push_back(nnn);
+      next.push_back(address); // where the call returns to
+    } else if (isSkip(opcode)) {
+      next.push_back(address);
+      next.push_back(address + 2);
+    } else if (opcode == 0x00EE || (opcode & 0xF000) == 0xB000 || opcode == 0x00FD) {
+      // Nowhere known: the stack, a computed address or nowhere at all.
+    } else if (needsOwnBlock(opcode) || writesMemory(opcode)) {
+      next.push_back(address);
+    } else {
+      ended = false;
+    }
+  }
+  if (!ended) {
+    // Falls through into code compiled separately, or not at all.
+    next.push_back(address);
+  }
+  block.end = address;
+  return block;
+}
+
+std::map<unsigned short, Block> findBlocks(const Rom& rom) {
+  std::map<unsigned short, Block> blocks;
+  std::vector<unsigned short> pending = { ROM_START };
+  while (!pending.empty()) {
+    const unsigned short start = pending.back();
+    pending.pop_back();
+    if (blocks.count(start) || !Chip8::isValidOpcode(opcodeAt(rom, start), rom.variant)) {
+      continue;
+    }
+    blocks[start] = readBlock(rom, start, pending);
+  }
+  return blocks;
+}
+
+// Writes the C++ for one block. Within a block pc is only brought up to date
+// where something reads it: before handing an instruction to the
+// interpreter, and at the end.
+class BlockWriter {
+public:
+  BlockWriter(std::ostream& out, const Quirks& quirks) : out(out), quirks(quirks) {}
+
+  void write(const Block& block) {
+    body.str("");
+    writeBody(block);
+    // Blocks that only hand over to the interpreter never touch the State,
+    // and blocks that never do never touch the machine; leave whichever is
+    // unused unnamed so the output compiles without warnings.
+    const std::string text = body.str();
+    const bool usesState = text.find("s.") != std::string::npos;
+    const bool usesMachine = text.find("(c)") != std::string::npos;
+    out << "// " << hex(block.start, 3) << "-" << hex(block.end - 1, 3) << "\n";
+    out << "unsigned int block_" << hex(block.start, 3).substr(2) << "(State&" << (usesState ? " s" : "")
+        << ", Chip8&" << (usesMachine ? " c" : "") << ") {\n" << text << "}\n\n";
+  }
+
+private:
+  std::ostream& out;
+  std::ostringstream body;
+  Quirks quirks;
+  unsigned int offset; // bytes pc is behind the instruction being written
+
+  void writeBody(const Block& block) {
+    if (block.idleLoop) {
+      const unsigned int x = (block.opcodes[0] & 0x0F00) >> 8;
+      line("s.V[" + std::to_string(x) + "] = s.delay_timer;");
+      line("if (s.V[" + std::to_string(x) + "] == 0) {");
+      line("  s.pc += 6;");
+      line("  return 2;");
+      line("}");
+      line("s.pc = " + hex(block.start, 3) + ";");
+      line("return 3;");
+      return;
+    }
+
+    offset = 0;
+    bool returned = false;
+    unsigned short address = block.start;
+    for (std::size_t i = 0; i < block.opcodes.size(); i++, address += 2) {
+      body << "  // " << hex(address, 3) << ": " << hex(block.opcodes[i], 4).substr(2) << "\n";
+      returned = instruction(block.opcodes[i], static_cast<unsigned int>(i));
+    }
+    if (!returned) {
+      flushPc();
+      line("return " + std::to_string(block.opcodes.size()) + ";");
+    }
+  }
+
+  static std::string hex(unsigned int value, int digits) {
+    char text[16];
+    std::snprintf(text, sizeof(text), "0x%0*X", digits, value);
+    return text;
+  }
+
+  void line(const std::string& text) { body << "  " << text << "\n"; }
+
+  void flushPc() {
+    if (offset) {
+      line("s.pc += " + std::to_string(offset) + ";");
+      offset = 0;
+    }
+  }
+
+  void interpret() {
+    flushPc();
+    line("Native::interpret(c);");
+  }
+
+  // Writes one instruction, retired being how many came before it in the
+  // block. Returns true if it ended the function.
+  bool instruction(unsigned short opcode, unsigned int retired) {
+    const std::string x = std::to_string((opcode & 0x0F00) >> 8);
+    const std::string y = std::to_string((opcode & 0x00F0) >> 4);
+    const std::string nn = hex(opcode & 0x00FF, 2);
+    const std::string nnn = hex(opcode & 0x0FFF, 3);
+    const std::string vx = "s.V[" + x + "]";
+    const std::string vy = "s.V[" + y + "]";
+    const std::string done = "return " + std::to_string(retired + 1) + ";";
+    const std::string fault = "return " + std::to_string(retired) + ";";
+
+    switch (opcode & 0xF000) {
+      case 0x0000:
+        if (opcode == 0x00EE) {
+          flushPc();
+          line("if (s.sp == 0) {");
+          line("  Native::interpret(c);");
+          line("  " + fault);
+          line("}");
+          line("s.sp--;");
+          line("s.pc = s.stack[s.sp];");
+          line("s.pc += 2;");
+          line(done);
+          return true;
+        }
+        if (needsOwnBlock(opcode)) {
+          interpret();
+          line("return Native::stopped(c) ? " + std::to_string(retired) + " : " + std::to_string(retired + 1) + ";");
+          return true;
+        }
+        interpret(); // 00E0 and the SUPER-CHIP screen instructions
+        return false;
+      case 0x1000:
+        line("s.pc = " + nnn + ";");
+        line(done);
+        return true;
+      case 0x2000:
+        flushPc();
+        line("if (s.sp >= 16) {");
+        line("  Native::interpret(c);");
+        line("  " + fault);
+        line("}");
+        line("s.stack[s.sp] = s.pc;");
+        line("s.sp++;");
+        line("s.pc = " + nnn + ";");
+        line(done);
+        return true;
+      case 0x3000:
+        return skip(vx + " == " + nn, done);
+      case 0x4000:
+        return skip(vx + " != " + nn, done);
+      case 0x5000:
+        return skip(vx + " == " + vy, done);
+      case 0x6000:
+        line(vx + " = " + nn + ";");
+        break;
+      case 0x7000:
+        line(vx + " += " + nn + ";");
+        break;
+      case 0x8000:
+        alu(opcode, vx, vy);
+        break;
+      case 0x9000:
+        return skip(vx + " != " + vy, done);
+      case 0xA000:
+        line("s.I = " + nnn + ";");
+        break;
+      case 0xB000:
+        line("s.pc = " + nnn + " + " + (quirks.jumpUsesVX ? vx : "s.V[0]") + ";");
+        line(done);
+        return true;
+      case 0xC000:
+        line(vx + " = (nextRandom(s.rng) >> 24) & " + nn + ";");
+        break;
+      case 0xD000:
+        interpret();
+        return false;
+      case 0xE000:
+        return skip(std::string((opcode & 0x00FF) == 0x009E ? "" : "!") + "s.key[" + vx + " & 0xF]", done);
+      case 0xF000:
+        return misc(opcode, vx, retired, done);
+    }
+    offset += 2;
+    return false;
+  }
+
+  bool skip(const std::string& condition, const std::string& done) {
+    flushPc();
+    line("s.pc += (" + condition + ") ? 4 : 2;");
+    line(done);
+    return true;
+  }
+
+  // 8XYN, mirroring the handlers down to the order registers are written in,
+  // which matters when X or Y is F.
+  void alu(unsigned short opcode, const std::string& vx, const std::string& vy) {
+    const bool resetVF = quirks.logicResetsVF;
+    switch (opcode & 0x000F) {
+      case 0x0: line(vx + " = " + vy + ";"); break;
+      case 0x1: line(vx + " |= " + vy + ";"); break;
+      case 0x2: line(vx + " &= " + vy + ";"); break;
+      case 0x3: line(vx + " ^= " + vy + ";"); break;
+      case 0x4:
+        line("{");
+        line("  unsigned char vx = " + vx + ";");
+        line("  unsigned char vy = " + vy + ";");
+        line("  " + vx + " += vy;");
+        line("  s.V[0xF] = (vx + vy > 255) ? 1 : 0;");
+        line("}");
+        break;
+      case 0x5:
+        line("{");
+        line("  unsigned char vx = " + vx + ";");
+        line("  unsigned char vy = " + vy + ";");
+        line("  s.V[0xF] = (vx > vy) ? 1 : 0;");
+        line("  " + vx + " -= vy;");
+        line("}");
+        break;
+      case 0x6:
+        if (quirks.shiftUsesVY) {
+          line("{");
+          line("  unsigned char vy = " + vy + ";");
+          line("  " + vx + " = vy >> 1;");
+          line("  s.V[0xF] = vy & 0x1;");
+          line("}");
+        } else {
+          line("s.V[0xF] = " + vx + " & 0x1;");
+          line(vx + " >>= 1;");
+        }
+        break;
+      case 0x7:
+        line("{");
+        line("  unsigned char vx = " + vx + ";");
+        line("  unsigned char vy = " + vy + ";");
+        line("  s.V[0xF] = (vy > vx) ? 1 : 0;");
+        line("  " + vx + " = vy - vx;");
+        line("}");
+        break;
+      case 0xE:
+        if (quirks.shiftUsesVY) {
+          line("{");
+          line("  unsigned char vy = " + vy + ";");
+          line("  " + vx + " = vy << 1;");
+          line("  s.V[0xF] = (vy & 0x80) >> 7;");
+          line("}");
+        } else {
+          line("s.V[0xF] = (" + vx + " & 0x80) >> 7;");
+          line(vx + " <<= 1;");
+        }
+        break;
+    }
+    const unsigned int n = opcode & 0x000F;
+    if (resetVF && n >= 0x1 && n <= 0x3) {
+      line("s.V[0xF] = 0;");
+    }
+  }
+
+  bool misc(unsigned short opcode, const std::string& vx, unsigned int retired, const std::string& done) {
+    const unsigned int x = (opcode & 0x0F00) >> 8;
+    switch (opcode & 0x00FF) {
+      case 0x07: line(vx + " = s.delay_timer;"); break;
+      case 0x15: line("s.delay_timer = " + vx + ";"); break;
+      case 0x18: line("s.sound_timer = " + vx + ";"); break;
+      case 0x1E: line("s.I += " + vx + ";"); break;
+      case 0x29: line("s.I = " + vx + " * 0x5;"); break;
+      case 0x3A: line("s.pitch = " + vx + ";"); break;
+      case 0x65:
+        for (unsigned int i = 0; i <= x; i++) {
+          line("s.V[" + std::to_string(i) + "] = s.memory[(s.I + " + std::to_string(i) + ") & 0x0FFF];");
+        }
+        if (quirks.loadStoreMovesI) {
+          line("s.I += " + std::to_string(x + 1) + ";");
+        }
+        break;
+      case 0x0A:
+        interpret();
+        line("return Native::stopped(c) ? " + std::to_string(retired) + " : " + std::to_string(retired + 1) + ";");
+        return true;
+      case 0x33:
+      case 0x55:
+        interpret();
+        line(done);
+        return true;
+      default:
+        interpret(); // F002, FX30, FX75, FX85
+        return false;
+    }
+    offset += 2;
+    return false;
+  }
+};
+
+bool writeProgram(const Rom& rom, const std::filesystem::path& directory) {
+  const std::map<unsigned short, Block> blocks = findBlocks(rom);
+  const std::filesystem::path path = directory / ("native_" + rom.name + ".cpp");
+  std::ofstream out{ path, std::ios::trunc };
+  if (!out) {
+    std::cerr << "Could not write " << path.string() << std::endl;
+    return false;
+  }
+
+  unsigned int instructions = 0;
+  for (const auto& entry : blocks) {
+    instructions += static_cast<unsigned int>(entry.second.opcodes.size());
+  }
+
+  char hash[32];
+  std::snprintf(hash, sizeof(hash), "0x%016llxull", static_cast<unsigned long long>(rom.hash));
+  out << "// Generated by chip8_aot from " << rom.file << " (" << variantName(rom.variant) << " quirks): "
+      << blocks.size() << " blocks, " << instructions << " instructions. Do not edit.\n";
+  out << "#include \"native.hpp\"\n\nnamespace {\n\n";
+  out << "using State = Chip8::State;\nusing Native = Chip8::NativeProgram;\n\n";
+
+  BlockWriter writer{ out, quirksOf(rom.variant) };
+  for (const auto& entry : blocks) {
+    writer.write(entry.second);
+  }
+
+  out << "const unsigned char ROM[] = {";
+  for (std::size_t i = 0; i < rom.bytes.size(); i++) {
+    char byte[8];
+    std::snprintf(byte, sizeof(byte), "0x%02X,", rom.bytes[i]);
+    out << (i % 16 ? " " : "\n  ") << byte;
+  }
+  out << "\n};\n\n";
+
+  out << "const Chip8::NativeBlock BLOCKS[] = {\n";
+  for (const auto& entry : blocks) {
+    const Block& block = entry.second;
+    char start[8];
+    char end[8];
+    std::snprintf(start, sizeof(start), "0x%03X", block.start);
+    std::snprintf(end, sizeof(end), "0x%03X", block.end);
+    const int idle = block.idleLoop ? (block.opcodes[0] & 0x0F00) >> 8 : -1;
+    out << "  { " << start << ", " << end << ", " << block.opcodes.size() << ", " << idle << ", block_"
+        << std::string(start).substr(2) << " },\n";
+  }
+  out << "};\n\n} // namespace\n\n";
+
+  out << "extern const Chip8::NativeProgram native_" << rom.name << " = {\n  " << hash << ", Variant::"
+      << (rom.variant == Variant::Cosmac      ? "Cosmac"
+          : rom.variant == Variant::SuperChip ? "SuperChip"
+          : rom.variant == Variant::XoChip    ? "XoChip"
+                                              : "Chip8")
+      << ", ROM, sizeof(ROM), BLOCKS, sizeof(BLOCKS) / sizeof(BLOCKS[0]),\n};\n";
+
+  if (!out) {
+    std::cerr << "Write error: " << path.string() << std::endl;
+    return false;
+  }
+  std::cout << rom.file << ": " << blocks.size() << " blocks, " << instructions << " instructions" << std::endl;
+  return true;
+}
+
+bool writeIndex(const std::vector<Rom>& roms, const std::filesystem::path& directory) {
+  const std::filesystem::path path = directory / "native_programs.cpp";
+  std::ofstream out{ path, std::ios::trunc };
+  if (!out) {
+    std::cerr << "Could not write " << path.string() << std::endl;
+    return false;
+  }
+
+  out << "// Generated by chip8_aot. Do not edit.\n#include \"native.hpp\"\n\n";
+  for (const Rom& rom : roms) {
+    out << "extern const Chip8::NativeProgram native_" << rom.name << ";\n";
+  }
+  out << "\nconst Chip8::NativeProgram* nativeProgramFor(std::uint64_t romHash) {\n";
+  out << "  static const Chip8::NativeProgram* const PROGRAMS[] = {\n";
+  for (const Rom& rom : roms) {
+    out << "    &native_" << rom.name << ",\n";
+  }
+  out << "    nullptr,\n  };\n";
+  out << "  for (const Chip8::NativeProgram* const* program = PROGRAMS; *program; program++) {\n";
+  out << "    if ((*program)->romHash == romHash) {\n      return *program;\n    }\n  }\n";
+  out << "  return nullptr;\n}\n";
+
+  if (!out) {
+    std::cerr << "Write error: " << path.string() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <output directory> <rom>...\n";
+    return 1;
+  }
+
+  const std::filesystem::path directory = argv[1];
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  if (error) {
+    std::cerr << "Could not create " << directory.string() << ": " << error.message() << std::endl;
+    return 1;
+  }
+
+  std::vector<Rom> roms;
+  for (int i = 2; i < argc; i++) {
+    Rom rom;
+    if (!loadRom(argv[i], rom)) {
+      return 1;
+    }
+    for (const Rom& other : roms) {
+      if (other.name == rom.name) {
+        std::cerr << "Two ROMs would both be named " << rom.name << std::endl;
+        return 1;
+      }
+    }
+    roms.push_back(rom);
+  }
+
+  for (const Rom& rom : roms) {
+    if (!writeProgram(rom, directory)) {
+      return 1;
+    }
+  }
+  return writeIndex(roms, directory) ? 0 : 1;
+}
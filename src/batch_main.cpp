@@ -0,0 +1,393 @@
+#include "capture.hpp"
+#include "chip8.hpp"
+#include "lockstep.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Runs ROMs headless on every core: each ROM (or every ROM in a directory) is
+// run once per seed for a fixed number of cycles or 60 Hz frames, with no
+// input, and the final state is printed as one line per run so two builds can
+// be diffed.
+//
+// With --lockstep, the seeds of each ROM run as lanes of LockstepBatch, up to
+// --lanes of them per batch, instead of as separate Chip8 objects; --verify
+// runs every seed on Chip8 as well and checks the two end up identical. ROMs
+// LockstepBatch does not support run as separate Chip8 objects regardless.
+//
+// With --capture, every run records its frames into a capture file in the
+// given directory, named after the ROM and seed; chip8_capture turns them
+// into PNGs. Captures need the Chip8 runs, so it cannot be combined with
+// --lockstep.
+//
+// Usage: chip8_batch [--cycles N | --frames N] [--seeds N] [--seed S]
+//                    [--threads N] [--lockstep [--lanes N] [--verify]]
+//                    [--capture DIR] <rom or directory>...
+
+namespace {
+
+// Same pacing as the core's runFrame: ~700 instructions per second.
+constexpr unsigned int CYCLES_PER_FRAME = 700 / 60;
+
+struct Job {
+  std::string rom;
+  std::uint32_t seed;
+
+  // Filled in by the worker
+  Chip8::StopReason reason;
+  Chip8::State state;
+  double seconds; // for lockstep, the batch's time split evenly over its lanes
+  bool lockstep;  // ran as a lane of a LockstepBatch
+};
+
+// Hashes the rows of the current resolution only.
+std::uint64_t hashFramebuffer(const Chip8::State& state) {
+  const std::size_t words = state.hires ? state.gfx.size() : Chip8::HEIGHT;
+  std::uint64_t hash = 14695981039346656037ull;
+  for (std::size_t i = 0; i < words; i++) {
+    hash ^= state.gfx[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+const char* describe(Chip8::StopReason reason) {
+  switch (reason) {
+    case Chip8::StopReason::CyclesDone:
+    case Chip8::StopReason::FrameComplete:
+      return "ok";
+    case Chip8::StopReason::WaitingForKey:
+      return "waiting-for-key";
+    case Chip8::StopReason::IllegalOpcode:
+      return "illegal-opcode";
+    case Chip8::StopReason::StackOverflow:
+      return "stack-overflow";
+    case Chip8::StopReason::StackUnderflow:
+      return "stack-underflow";
+    case Chip8::StopReason::Exited:
+      return "exited";
+    default:
+      return "stopped";
+  }
+}
+
+bool isFault(Chip8::StopReason reason) {
+  return reason == Chip8::StopReason::IllegalOpcode ||
+         reason == Chip8::StopReason::StackOverflow ||
+         reason == Chip8::StopReason::StackUnderflow;
+}
+
+// Runs a fixed number of instructions, ticking the timers after every frame's
+// worth. With no input a ROM blocked on FX0A would never get there, so that
+// ends the run too. Frames go to recorder, if there is one.
+Chip8::StopReason runForCycles(Chip8& chip8, std::uint64_t cycles, FrameRecorder* recorder) {
+  while (chip8.getCycles() < cycles) {
+    std::uint64_t left = cycles - chip8.getCycles();
+    unsigned int count = left < CYCLES_PER_FRAME ? static_cast<unsigned int>(left) : CYCLES_PER_FRAME;
+    Chip8::RunResult result = chip8.runCycles(count);
+    if (result.reason != Chip8::StopReason::CyclesDone) {
+      return result.reason;
+    }
+    if (count == CYCLES_PER_FRAME) {
+      chip8.tickTimers();
+    }
+    if (recorder) {
+      recorder->record(chip8);
+    }
+  }
+  return Chip8::StopReason::CyclesDone;
+}
+
+// Runs a fixed number of 60 Hz frames. A ROM waiting on FX0A just idles
+// through the rest of them, as it would with nobody at the keyboard.
+Chip8::StopReason runForFrames(Chip8& chip8, std::uint64_t frames, FrameRecorder* recorder) {
+  Chip8::StopReason reason = Chip8::StopReason::FrameComplete;
+  while (frames > 0) {
+    Chip8::RunResult result = chip8.runFrame();
+    if (isFault(result.reason)) {
+      return result.reason;
+    }
+    if (result.reason == Chip8::StopReason::FrameComplete ||
+        result.reason == Chip8::StopReason::WaitingForKey) {
+      reason = result.reason;
+      frames--;
+      if (recorder) {
+        recorder->record(chip8);
+      }
+    }
+  }
+  return reason;
+}
+
+// runForCycles for every lane of a batch. A lane that stops is frozen where
+// it stopped, as the Chip8 run would have returned there.
+void runLockstepCycles(LockstepBatch& batch, std::uint64_t cycles, Job* jobs) {
+  std::vector<bool> stopped(batch.size(), false);
+  std::size_t running = batch.size();
+
+  for (std::uint64_t done = 0; done < cycles && running > 0;) {
+    std::uint64_t left = cycles - done;
+    unsigned int count = left < CYCLES_PER_FRAME ? static_cast<unsigned int>(left) : CYCLES_PER_FRAME;
+    batch.runCycles(count);
+    for (std::size_t lane = 0; lane < batch.size(); lane++) {
+      Chip8::StopReason reason = batch.result(lane).reason;
+      if (!stopped[lane] && reason != Chip8::StopReason::CyclesDone) {
+        jobs[lane].reason = reason;
+        stopped[lane] = true;
+        batch.freeze(lane);
+        running--;
+      }
+    }
+    if (count == CYCLES_PER_FRAME) {
+      batch.tickTimers();
+    }
+    done += count;
+  }
+}
+
+// runForFrames for every lane of a batch.
+void runLockstepFrames(LockstepBatch& batch, std::uint64_t frames, Job* jobs) {
+  std::vector<bool> faulted(batch.size(), false);
+
+  for (std::uint64_t frame = 0; frame < frames; frame++) {
+    batch.runCycles(CYCLES_PER_FRAME);
+    for (std::size_t lane = 0; lane < batch.size(); lane++) {
+      if (faulted[lane]) {
+        continue;
+      }
+      Chip8::StopReason reason = batch.result(lane).reason;
+      if (isFault(reason)) {
+        faulted[lane] = true;
+        batch.freeze(lane);
+      }
+      jobs[lane].reason = reason == Chip8::StopReason::CyclesDone ? Chip8::StopReason::FrameComplete : reason;
+    }
+    batch.tickTimers();
+  }
+}
+
+// Compares field by field: the padding inside State is not part of it.
+bool sameState(const Chip8::State& a, const Chip8::State& b) {
+  return std::memcmp(a.memory, b.memory, sizeof(a.memory)) == 0 &&
+         std::memcmp(a.V, b.V, sizeof(a.V)) == 0 &&
+         a.I == b.I && a.pc == b.pc && a.gfx == b.gfx &&
+         a.delay_timer == b.delay_timer && a.sound_timer == b.sound_timer &&
+         std::memcmp(a.stack, b.stack, sizeof(a.stack)) == 0 && a.sp == b.sp &&
+         std::memcmp(a.key, b.key, sizeof(a.key)) == 0 &&
+         a.rng == b.rng && a.cycles == b.cycles && a.hires == b.hires &&
+         std::memcmp(a.flags, b.flags, sizeof(a.flags)) == 0 && a.variant == b.variant &&
+         std::memcmp(a.audioPattern, b.audioPattern, sizeof(a.audioPattern)) == 0 && a.pitch == b.pitch;
+}
+
+void usage(const char* program) {
+  std::cerr << "Usage: " << program
+            << " [--cycles N | --frames N] [--seeds N] [--seed S] [--threads N]"
+               " [--lockstep [--lanes N] [--verify]] [--capture DIR] <rom or directory>...\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::uint64_t cycles = 0;
+  std::uint64_t frames = 0;
+  unsigned int seeds = 1;
+  std::uint32_t firstSeed = 1;
+  unsigned int threads = 0;
+  bool lockstep = false;
+  std::size_t lanes = 256;
+  bool verify = false;
+  const char* captureDirectory = nullptr;
+  std::vector<std::string> roms;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (std::strcmp(arg, "--cycles") == 0 && hasValue) {
+      cycles = std::strtoull(argv[++i], nullptr, 10);
+    } else if (std::strcmp(arg, "--frames") == 0 && hasValue) {
+      frames = std::strtoull(argv[++i], nullptr, 10);
+    } else if (std::strcmp(arg, "--seeds") == 0 && hasValue) {
+      seeds = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(arg, "--seed") == 0 && hasValue) {
+      firstSeed = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(arg, "--threads") == 0 && hasValue) {
+      threads = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(arg, "--lockstep") == 0) {
+      lockstep = true;
+    } else if (std::strcmp(arg, "--lanes") == 0 && hasValue) {
+      lanes = std::strtoul(argv[++i], nullptr, 10);
+    } else if (std::strcmp(arg, "--verify") == 0) {
+      verify = true;
+    } else if (std::strcmp(arg, "--capture") == 0 && hasValue) {
+      captureDirectory = argv[++i];
+    } else if (arg[0] == '-') {
+      usage(argv[0]);
+      return 1;
+    } else if (std::filesystem::is_directory(arg)) {
+      std::vector<std::string> found;
+      for (const auto& entry : std::filesystem::directory_iterator(arg)) {
+        if (entry.is_regular_file()) {
+          found.push_back(entry.path().string());
+        }
+      }
+      std::sort(found.begin(), found.end());
+      roms.insert(roms.end(), found.begin(), found.end());
+    } else if (std::filesystem::is_regular_file(arg)) {
+      roms.push_back(arg);
+    } else {
+      std::cerr << "No such ROM or directory: " << arg << std::endl;
+      return 1;
+    }
+  }
+
+  if (roms.empty() || seeds == 0 || lanes == 0 || (cycles > 0 && frames > 0) ||
+      (verify && !lockstep) || (captureDirectory && lockstep)) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (captureDirectory) {
+    std::error_code error;
+    std::filesystem::create_directories(captureDirectory, error);
+    if (error) {
+      std::cerr << "Could not create " << captureDirectory << ": " << error.message() << std::endl;
+      return 1;
+    }
+  }
+  if (cycles == 0 && frames == 0) {
+    frames = 60 * 60; // one minute of play
+  }
+
+  std::vector<Job> jobs;
+  for (const std::string& rom : roms) {
+    for (unsigned int i = 0; i < seeds; i++) {
+      jobs.push_back({ rom, firstSeed + i, Chip8::StopReason::CyclesDone, {}, 0, false });
+    }
+  }
+
+  std::vector<Chip8::State> expected(verify ? jobs.size() : 0);
+
+  auto start = std::chrono::steady_clock::now();
+  {
+    ThreadPool pool{ threads };
+    if (lockstep) {
+      // Jobs are grouped by ROM, so each batch is a run of consecutive jobs.
+      for (std::size_t first = 0; first < jobs.size();) {
+        std::size_t count = 1;
+        while (first + count < jobs.size() && count < lanes && jobs[first + count].rom == jobs[first].rom) {
+          count++;
+        }
+        Job* batchJobs = &jobs[first];
+        if (!LockstepBatch::supports(batchJobs[0].rom.c_str())) {
+          first += count;
+          continue;
+        }
+        for (std::size_t lane = 0; lane < count; lane++) {
+          batchJobs[lane].lockstep = true;
+        }
+        pool.submit([batchJobs, count, cycles, frames] {
+          LockstepBatch batch{ batchJobs[0].rom.c_str(), count };
+          for (std::size_t lane = 0; lane < count; lane++) {
+            batch.seed(lane, batchJobs[lane].seed);
+            batchJobs[lane].reason = Chip8::StopReason::CyclesDone;
+          }
+
+          auto begin = std::chrono::steady_clock::now();
+          if (frames > 0) {
+            runLockstepFrames(batch, frames, batchJobs);
+          } else {
+            runLockstepCycles(batch, cycles, batchJobs);
+          }
+          double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+          for (std::size_t lane = 0; lane < count; lane++) {
+            batch.saveState(lane, batchJobs[lane].state);
+            batchJobs[lane].seconds = seconds / count;
+          }
+        });
+        first += count;
+      }
+    }
+
+    for (std::size_t i = 0; i < jobs.size(); i++) {
+      Job* job = &jobs[i];
+      if (job->lockstep && !verify) {
+        continue;
+      }
+      const bool lockstep = job->lockstep;
+      Chip8::State* result = lockstep ? &expected[i] : &job->state;
+      pool.submit([job, result, lockstep, cycles, frames, captureDirectory] {
+        Chip8 chip8{ job->rom.c_str() };
+        chip8.seed(job->seed);
+
+        std::unique_ptr<FrameRecorder> recorder;
+        if (captureDirectory) {
+          const std::string name = std::filesystem::path(job->rom).stem().string() + "-" +
+            std::to_string(job->seed) + ".c8cap";
+          // Flat out, so every frame is waited for rather than dropped.
+          recorder = std::make_unique<FrameRecorder>(
+            (std::filesystem::path(captureDirectory) / name).string().c_str(), false);
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        Chip8::StopReason reason = frames > 0 ? runForFrames(chip8, frames, recorder.get())
+                                              : runForCycles(chip8, cycles, recorder.get());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        chip8.saveState(*result);
+        if (!lockstep) {
+          job->reason = reason;
+          job->seconds = seconds;
+        }
+      });
+    }
+    pool.wait();
+    threads = pool.size();
+  }
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::uint64_t total = 0;
+  int faults = 0;
+  for (const Job& job : jobs) {
+    const Chip8::State& s = job.state;
+    std::printf("%s seed=%u %s cycles=%llu fb=%016llx pc=%03X I=%03X V=",
+      job.rom.c_str(), job.seed, describe(job.reason),
+      static_cast<unsigned long long>(s.cycles),
+      static_cast<unsigned long long>(hashFramebuffer(s)), s.pc, s.I);
+    for (unsigned char v : s.V) {
+      std::printf("%02X", v);
+    }
+    std::printf(" ips=%.0f\n", job.seconds > 0 ? s.cycles / job.seconds : 0.0);
+
+    total += s.cycles;
+    faults += isFault(job.reason);
+  }
+
+  int mismatches = 0;
+  std::size_t verified = 0;
+  for (std::size_t i = 0; i < expected.size(); i++) {
+    if (!jobs[i].lockstep) {
+      continue;
+    }
+    verified++;
+    if (!sameState(jobs[i].state, expected[i])) {
+      std::fprintf(stderr, "MISMATCH %s seed=%u: lockstep and Chip8 disagree\n",
+        jobs[i].rom.c_str(), jobs[i].seed);
+      mismatches++;
+    }
+  }
+  if (verify) {
+    std::fprintf(stderr, "verified %zu lockstep runs against Chip8, %d mismatched\n",
+      verified, mismatches);
+  }
+
+  std::fprintf(stderr, "%zu runs on %u threads in %.3f s, %.1f MIPS aggregate, %d faulted\n",
+    jobs.size(), threads, wall, wall > 0 ? total / wall / 1e6 : 0.0, faults);
+  return faults > 0 || mismatches > 0 ? 1 : 0;
+}
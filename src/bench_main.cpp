@@ -0,0 +1,412 @@
+#include "chip8.hpp"
+#include "native.hpp"
+#include "rom_cache.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Performance suite: runs every ROM headless through the same scripted input
+// and times each 60 Hz frame, emulation plus turning the framebuffer into
+// pixels the way the SDL front end does. Then times small synthetic loops of
+// each class of instruction, on the interpreter (emulateCycle) and on the
+// block translator (runCycles), and DXYN by sprite height. ROMs built into
+// chip8_native are also timed on their compiled code.
+//
+// Every measurement is the best of --repeat runs. The report goes to stdout,
+// and with --json to a file that can be diffed against the one from another
+// commit.
+//
+// Usage: chip8_bench [--frames N] [--cycles-per-frame N] [--repeat N]
+//                    [--json FILE] [<rom or directory>...]
+// With no ROMs it runs everything in ./games. A higher --cycles-per-frame
+// than the default 11 puts more weight on the instruction hot path.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Scripted input, the same on every run: every 20 frames the next key of the
+// list goes down for 12 frames. The keys are the ones the bundled games use
+// for moving, turning and firing.
+constexpr unsigned char SCRIPT_KEYS[] = { 0x5, 0x4, 0x6, 0x1, 0xC, 0x7, 0x4, 0x6, 0xD, 0x8, 0x0, 0xA };
+constexpr unsigned int SCRIPT_PERIOD = 20;
+constexpr unsigned int SCRIPT_HOLD = 12;
+constexpr std::uint32_t SCRIPT_SEED = 1;
+
+// Instructions per synthetic kernel measurement.
+constexpr std::uint64_t KERNEL_CYCLES = 2000000;
+constexpr unsigned int KERNEL_CHUNK = 100000;
+// Times the kernel body is repeated before jumping back.
+constexpr int KERNEL_UNROLL = 16;
+
+// Same fade as the front end's PHOSPHOR_PERSISTENCE.
+constexpr unsigned int PERSISTENCE = 160;
+
+// Somewhere for rendered pixels to go, so the rendering is not optimised out.
+volatile std::uint32_t rendered;
+
+std::uint16_t scriptKeys(unsigned int frame) {
+  if (frame % SCRIPT_PERIOD >= SCRIPT_HOLD) {
+    return 0;
+  }
+  const unsigned int step = frame / SCRIPT_PERIOD % sizeof(SCRIPT_KEYS);
+  return static_cast<std::uint16_t>(1u << SCRIPT_KEYS[step]);
+}
+
+// The front end's upload_rows without SDL: expand changed rows into 32-bit
+// pixels of a 128x64 texture, fading pixels that were just turned off.
+class Screen {
+public:
+  std::uint32_t render(const Chip8::Framebuffer& framebuffer, bool hires, std::uint64_t rows) {
+    if (!hires) {
+      std::uint64_t doubled = 0;
+      for (unsigned int row = 0; row < Chip8::HEIGHT; row++) {
+        if (rows & (std::uint64_t{ 1 } << row)) {
+          doubled |= std::uint64_t{ 3 } << (2 * row);
+        }
+      }
+      rows = doubled;
+    }
+    rows |= fadingRows;
+    fadingRows = 0;
+    for (unsigned int row = 0; row < Chip8::HIRES_HEIGHT; row++) {
+      if (!(rows & (std::uint64_t{ 1 } << row))) {
+        continue;
+      }
+      bool fading = false;
+      for (unsigned int column = 0; column < Chip8::HIRES_WIDTH; column++) {
+        const bool lit = hires
+          ? (framebuffer[2 * row + column / 64] >> (63 - column % 64)) & 1
+          : (framebuffer[row / 2] >> (63 - column / 2)) & 1;
+        unsigned int level = 255;
+        if (!lit) {
+          level = brightness[row][column] * PERSISTENCE / 256;
+          fading |= level != 0;
+        }
+        brightness[row][column] = static_cast<unsigned char>(level);
+        pixels[row][column] = 0xFF000000 | level << 16 | level << 8 | level;
+      }
+      if (fading) {
+        fadingRows |= std::uint64_t{ 1 } << row;
+      }
+    }
+    return pixels[0][0];
+  }
+
+private:
+  std::uint32_t pixels[Chip8::HIRES_HEIGHT][Chip8::HIRES_WIDTH] = {};
+  unsigned char brightness[Chip8::HIRES_HEIGHT][Chip8::HIRES_WIDTH] = {};
+  std::uint64_t fadingRows = 0;
+};
+
+struct RomResult {
+  std::string name;
+  std::uint64_t instructions;
+  double seconds;            // the whole script, emulation only
+  double nativeSeconds;      // the same on compiled code; 0 without any
+  double p50, p90, p99, max; // per-frame time with rendering, ns
+};
+
+// Two passes over the script: one timed as a whole for throughput, one timed
+// frame by frame with rendering, as the front end would spend each frame.
+RomResult benchRom(const std::string& rom, unsigned int frames, unsigned int cyclesPerFrame) {
+  RomResult result;
+  result.name = std::filesystem::path(rom).filename().string();
+
+  {
+    Chip8 chip8{ rom.c_str() };
+    chip8.seed(SCRIPT_SEED);
+    chip8.setCyclesPerFrame(cyclesPerFrame);
+    const Clock::time_point start = Clock::now();
+    for (unsigned int frame = 0; frame < frames; frame++) {
+      chip8.setKeys(scriptKeys(frame));
+      chip8.runFrame();
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result.instructions = chip8.getCycles();
+  }
+
+  result.nativeSeconds = 0;
+  const std::shared_ptr<const RomImage> image = RomCache::shared().load(rom.c_str());
+  if (const Chip8::NativeProgram* program = image ? nativeProgramFor(image->hash) : nullptr) {
+    Chip8 chip8{ rom.c_str() };
+    chip8.seed(SCRIPT_SEED);
+    chip8.setCyclesPerFrame(cyclesPerFrame);
+    chip8.setNativeProgram(program);
+    const Clock::time_point start = Clock::now();
+    for (unsigned int frame = 0; frame < frames; frame++) {
+      chip8.setKeys(scriptKeys(frame));
+      chip8.runFrame();
+    }
+    result.nativeSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  Chip8 chip8{ rom.c_str() };
+  chip8.seed(SCRIPT_SEED);
+  chip8.setCyclesPerFrame(cyclesPerFrame);
+  Screen screen;
+  std::vector<double> frameNs(frames);
+  for (unsigned int frame = 0; frame < frames; frame++) {
+    chip8.setKeys(scriptKeys(frame));
+    const Clock::time_point start = Clock::now();
+    chip8.runFrame();
+    rendered = screen.render(chip8.getFramebuffer(), chip8.isHires(), chip8.getDrawFlag());
+    frameNs[frame] = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  }
+
+  std::sort(frameNs.begin(), frameNs.end());
+  auto percentile = [&](double p) {
+    return frameNs[static_cast<std::size_t>(p * (frameNs.size() - 1))];
+  };
+  result.p50 = percentile(0.50);
+  result.p90 = percentile(0.90);
+  result.p99 = percentile(0.99);
+  result.max = percentile(1.0);
+  return result;
+}
+
+// A loop of one class of instruction: setup runs once from 0x200, then body is
+// repeated KERNEL_UNROLL times followed by a jump back to its first copy.
+struct Kernel {
+  std::string name;
+  std::vector<std::uint16_t> setup;
+  std::vector<std::uint16_t> body;
+};
+
+std::vector<Kernel> kernels() {
+  // Registers used by the bodies: VA = 1, VB = 2, I = 0 (the font).
+  const std::vector<std::uint16_t> setup = { 0x6A01, 0x6B02, 0xA000 };
+  std::vector<Kernel> list = {
+    { "load", setup, { 0x6C12, 0x7C01 } },
+    { "alu", setup, { 0x8CA0, 0x8CB4, 0x8CB5, 0x8CA1, 0x8CB2, 0x8CA3, 0x8C06, 0x8C0E } },
+    { "skip", setup, { 0x3A00, 0x4A01, 0x5AB0, 0x9AA0 } },
+    { "jump", setup, {} },
+    { "call", setup, { 0x2F00 } },
+    { "index", setup, { 0xA400, 0xFA1E, 0xFA29 } },
+    { "memory", setup, { 0xA800, 0xFA33, 0xFA55, 0xFA65 } },
+    { "timer", setup, { 0xFA15, 0xFA07, 0xFA18 } },
+    { "random", setup, { 0xCCFF } },
+  };
+  for (unsigned int rows : { 1u, 5u, 8u, 15u }) {
+    list.push_back({ "dxyn-" + std::to_string(rows), setup, { static_cast<std::uint16_t>(0xDAB0 | rows) } });
+  }
+  // Sprites that wrap around the right edge of the screen.
+  list.push_back({ "dxyn-5-wrap", { 0x6A3C, 0x6B02, 0xA000 }, { 0xDAB5 } });
+  return list;
+}
+
+Chip8::State buildKernel(const Kernel& kernel) {
+  std::vector<unsigned char> rom;
+  auto emit = [&rom](std::uint16_t opcode) {
+    rom.push_back(static_cast<unsigned char>(opcode >> 8));
+    rom.push_back(static_cast<unsigned char>(opcode));
+  };
+
+  for (std::uint16_t opcode : kernel.setup) {
+    emit(opcode);
+  }
+  const std::uint16_t loop = static_cast<std::uint16_t>(0x200 + rom.size());
+  for (int i = 0; i < KERNEL_UNROLL; i++) {
+    if (kernel.body.empty()) {
+      // A chain of jumps, each to the next instruction
+      emit(static_cast<std::uint16_t>(0x1000 | (0x200 + rom.size() + 2)));
+    }
+    for (std::uint16_t opcode : kernel.body) {
+      emit(opcode);
+    }
+  }
+  emit(static_cast<std::uint16_t>(0x1000 | loop));
+
+  Chip8::State state;
+  Chip8::bootState(state, rom.data(), rom.size());
+  // The subroutine called by the call kernel, out of the way of the loop
+  state.memory[0xF00] = 0x00;
+  state.memory[0xF01] = 0xEE;
+  return state;
+}
+
+struct KernelResult {
+  std::string name;
+  double interpreterNs; // per instruction
+  double blocksNs;
+};
+
+KernelResult benchKernel(const std::string& name, const Chip8::State& boot, unsigned int repeat) {
+  KernelResult result = { name, 0, 0 };
+  for (unsigned int run = 0; run < repeat; run++) {
+    Chip8 interpreter{ boot };
+    interpreter.seed(SCRIPT_SEED);
+    Clock::time_point start = Clock::now();
+    for (std::uint64_t i = 0; i < KERNEL_CYCLES; i++) {
+      interpreter.emulateCycle();
+    }
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / KERNEL_CYCLES;
+    result.interpreterNs = run == 0 ? ns : std::min(result.interpreterNs, ns);
+
+    Chip8 blocks{ boot };
+    blocks.seed(SCRIPT_SEED);
+    start = Clock::now();
+    std::uint64_t done = 0;
+    while (done < KERNEL_CYCLES) {
+      done += blocks.runCycles(KERNEL_CHUNK).cycles;
+    }
+    ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / done;
+    result.blocksNs = run == 0 ? ns : std::min(result.blocksNs, ns);
+  }
+  return result;
+}
+
+std::string jsonString(const std::string& text) {
+  std::string quoted = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+bool writeJson(const char* filename, unsigned int frames, unsigned int cyclesPerFrame, unsigned int repeat,
+               const std::vector<RomResult>& roms, const std::vector<KernelResult>& ops) {
+  std::ofstream file{ filename, std::ios::trunc };
+  if (!file) {
+    std::cerr << "Could not open JSON file: " << filename << std::endl;
+    return false;
+  }
+
+  char line[512];
+  file << "{\n  \"version\": 1,\n";
+  std::snprintf(line, sizeof(line), "  \"frames\": %u,\n  \"cycles_per_frame\": %u,\n  \"repeat\": %u,\n  \"roms\": [\n",
+    frames, cyclesPerFrame, repeat);
+  file << line;
+  for (std::size_t i = 0; i < roms.size(); i++) {
+    const RomResult& r = roms[i];
+    std::snprintf(line, sizeof(line),
+      "    { \"name\": %s, \"instructions\": %llu, \"ips\": %.0f, \"ns_per_instruction\": %.2f,"
+      " \"native_ips\": %.0f,"
+      " \"frame_ns\": { \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"max\": %.0f } }%s\n",
+      jsonString(r.name).c_str(), static_cast<unsigned long long>(r.instructions),
+      r.seconds > 0 ? r.instructions / r.seconds : 0.0,
+      r.instructions ? r.seconds * 1e9 / r.instructions : 0.0,
+      r.nativeSeconds > 0 ? r.instructions / r.nativeSeconds : 0.0,
+      r.p50, r.p90, r.p99, r.max, i + 1 < roms.size() ? "," : "");
+    file << line;
+  }
+  file << "  ],\n  \"opcodes\": [\n";
+  for (std::size_t i = 0; i < ops.size(); i++) {
+    std::snprintf(line, sizeof(line),
+      "    { \"class\": %s, \"interpreter_ns\": %.2f, \"blocks_ns\": %.2f }%s\n",
+      jsonString(ops[i].name).c_str(), ops[i].interpreterNs, ops[i].blocksNs,
+      i + 1 < ops.size() ? "," : "");
+    file << line;
+  }
+  file << "  ]\n}\n";
+  if (!file) {
+    std::cerr << "Write error: " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void usage(const char* program) {
+  std::cerr << "Usage: " << program
+            << " [--frames N] [--cycles-per-frame N] [--repeat N] [--json FILE] [<rom or directory>...]\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  unsigned int frames = 60 * 60; // one minute of play
+  unsigned int cyclesPerFrame = 700 / 60; // the core's default pace
+  unsigned int repeat = 3;
+  const char* json = nullptr;
+  std::vector<std::string> paths;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (std::strcmp(arg, "--frames") == 0 && hasValue) {
+      frames = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(arg, "--cycles-per-frame") == 0 && hasValue) {
+      cyclesPerFrame = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(arg, "--repeat") == 0 && hasValue) {
+      repeat = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(arg, "--json") == 0 && hasValue) {
+      json = argv[++i];
+    } else if (arg[0] == '-') {
+      usage(argv[0]);
+      return 1;
+    } else {
+      paths.push_back(arg);
+    }
+  }
+  if (paths.empty()) {
+    paths.push_back("games");
+  }
+  if (frames == 0 || cyclesPerFrame == 0 || repeat == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<std::string> roms;
+  for (const std::string& path : paths) {
+    if (std::filesystem::is_directory(path)) {
+      std::vector<std::string> found;
+      for (const auto& entry : std::filesystem::directory_iterator(path)) {
+        if (entry.is_regular_file()) {
+          found.push_back(entry.path().string());
+        }
+      }
+      std::sort(found.begin(), found.end());
+      roms.insert(roms.end(), found.begin(), found.end());
+    } else if (std::filesystem::is_regular_file(path)) {
+      roms.push_back(path);
+    } else {
+      std::cerr << "No such ROM or directory: " << path << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector<RomResult> romResults;
+  std::printf("%-20s %12s %8s %12s %10s %10s %10s %10s\n",
+    "rom", "MIPS", "ns/inst", "native MIPS", "p50 us", "p90 us", "p99 us", "max us");
+  for (const std::string& rom : roms) {
+    RomResult best = benchRom(rom, frames, cyclesPerFrame);
+    for (unsigned int run = 1; run < repeat; run++) {
+      RomResult next = benchRom(rom, frames, cyclesPerFrame);
+      best.seconds = std::min(best.seconds, next.seconds);
+      best.nativeSeconds = std::min(best.nativeSeconds, next.nativeSeconds);
+      best.p50 = std::min(best.p50, next.p50);
+      best.p90 = std::min(best.p90, next.p90);
+      best.p99 = std::min(best.p99, next.p99);
+      best.max = std::min(best.max, next.max);
+    }
+    std::printf("%-20s %12.1f %8.2f %12.1f %10.2f %10.2f %10.2f %10.2f\n",
+      best.name.c_str(), best.instructions / best.seconds / 1e6,
+      best.seconds * 1e9 / best.instructions,
+      best.nativeSeconds > 0 ? best.instructions / best.nativeSeconds / 1e6 : 0.0,
+      best.p50 / 1e3, best.p90 / 1e3, best.p99 / 1e3, best.max / 1e3);
+    romResults.push_back(best);
+  }
+
+  std::vector<KernelResult> opResults;
+  std::printf("\n%-20s %16s %16s\n", "opcode class", "interpreter ns", "blocks ns");
+  for (const Kernel& kernel : kernels()) {
+    KernelResult result = benchKernel(kernel.name, buildKernel(kernel), repeat);
+    std::printf("%-20s %16.2f %16.2f\n", result.name.c_str(), result.interpreterNs, result.blocksNs);
+    opResults.push_back(result);
+  }
+
+  if (json && !writeJson(json, frames, cyclesPerFrame, repeat, romResults, opResults)) {
+    return 1;
+  }
+  return 0;
+}
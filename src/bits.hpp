@@ -0,0 +1,42 @@
+#ifndef BITS_HPP
+#define BITS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Small pieces of instruction semantics shared by Chip8 and LockstepBatch, so
+// the two cores cannot drift apart on them, and helpers the rest of the core
+// shares.
+
+// Places a sprite byte held in the top bits of a row word at column shift,
+// wrapping around the right edge of the screen.
+inline std::uint64_t rotateRight(std::uint64_t row, unsigned int shift) {
+  return (row >> shift) | (row << ((64 - shift) & 63));
+}
+
+// xorshift32 behind CXNN; the state lives in the machine so it is saved and
+// replayed with it.
+inline std::uint32_t nextRandom(std::uint32_t& rng) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+// xorshift state must be non-zero.
+inline std::uint32_t randomSeed(std::uint32_t seed) {
+  return seed ? seed : 0x9E3779B9;
+}
+
+// FNV-1a, used to checksum save files and to tell ROMs apart by content.
+inline std::uint64_t fnv1a(const void* data, std::size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  std::uint64_t hash = 14695981039346656037ull;
+  for (std::size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+#endif
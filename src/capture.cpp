@@ -0,0 +1,189 @@
+#include "capture.hpp"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+std::size_t encodeFrameDelta(const Chip8::Framebuffer& previous, const Chip8::Framebuffer& frame, unsigned char* out) {
+  unsigned char delta[sizeof(Chip8::Framebuffer)];
+  for (std::size_t i = 0; i < frame.size(); i++) {
+    const std::uint64_t word = previous[i] ^ frame[i];
+    std::memcpy(delta + i * sizeof(word), &word, sizeof(word));
+  }
+
+  std::size_t size = 0;
+  std::size_t i = 0;
+  while (i < sizeof(delta)) {
+    std::size_t run = 0;
+    while (i + run < sizeof(delta) && run < 128 && delta[i + run] == 0) {
+      run++;
+    }
+    if (run > 0) {
+      out[size++] = static_cast<unsigned char>(run - 1);
+      i += run;
+      continue;
+    }
+
+    // Literals up to the next pair of zeros; a lone zero is cheaper to carry
+    // along than to break the literal run for.
+    std::size_t count = 0;
+    while (i + count < sizeof(delta) && count < 128 &&
+           (delta[i + count] != 0 || (i + count + 1 < sizeof(delta) && delta[i + count + 1] != 0))) {
+      count++;
+    }
+    out[size++] = static_cast<unsigned char>(0x7F + count);
+    std::memcpy(out + size, delta + i, count);
+    size += count;
+    i += count;
+  }
+  return size;
+}
+
+bool applyFrameDelta(const unsigned char* delta, std::size_t size, Chip8::Framebuffer& frame) {
+  unsigned char bytes[sizeof(Chip8::Framebuffer)];
+  std::memcpy(bytes, frame.data(), sizeof(bytes));
+
+  std::size_t position = 0;
+  for (std::size_t i = 0; i < size;) {
+    const unsigned char control = delta[i++];
+    if (control < 0x80) {
+      position += control + 1u;
+      if (position > sizeof(bytes)) {
+        return false;
+      }
+      continue;
+    }
+    const std::size_t count = control - 0x7Fu;
+    if (count > size - i || position + count > sizeof(bytes)) {
+      return false;
+    }
+    for (std::size_t j = 0; j < count; j++) {
+      bytes[position++] ^= delta[i++];
+    }
+  }
+  if (position != sizeof(bytes)) {
+    return false;
+  }
+
+  std::memcpy(frame.data(), bytes, sizeof(bytes));
+  return true;
+}
+
+FrameRecorder::FrameRecorder(const char* filename, bool dropWhenFull)
+  : dropWhenFull(dropWhenFull), dropped(0), running(true), file(nullptr) {
+  file = std::fopen(filename, "wb");
+  if (!file) {
+    std::cerr << "Could not open capture file: " << filename << std::endl;
+    running = false;
+    return;
+  }
+
+  CaptureFileHeader header = {
+    { CAPTURE_MAGIC[0], CAPTURE_MAGIC[1], CAPTURE_MAGIC[2], CAPTURE_MAGIC[3] },
+    CAPTURE_VERSION,
+    sizeof(CaptureFrameHeader)
+  };
+  std::fwrite(&header, sizeof(header), 1, file);
+
+  writer = std::thread(&FrameRecorder::drain, this);
+}
+
+FrameRecorder::~FrameRecorder() {
+  running = false;
+  if (writer.joinable()) {
+    writer.join();
+  }
+  if (file) {
+    std::fclose(file);
+  }
+}
+
+void FrameRecorder::drain() {
+  Chip8::Framebuffer previous = {};
+  bool first = true;
+  unsigned char delta[MAX_FRAME_DELTA];
+
+  for (;;) {
+    // Read running before the queue, so everything recorded before shutdown
+    // is seen by the final pass.
+    const bool stopping = !running.load(std::memory_order_acquire);
+    const QueuedFrame* frame = queue.peek();
+
+    if (!frame) {
+      if (stopping) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    CaptureFrameHeader header = {};
+    header.cycle = frame->cycle;
+    header.size = static_cast<std::uint32_t>(encodeFrameDelta(previous, frame->framebuffer, delta));
+    header.hires = frame->hires;
+    header.keyframe = first;
+    first = false;
+    previous = frame->framebuffer;
+    queue.pop();
+
+    std::fwrite(&header, sizeof(header), 1, file);
+    std::fwrite(delta, 1, header.size, file);
+  }
+
+  std::fflush(file);
+}
+
+CaptureReader::CaptureReader(const char* filename) : file(nullptr), cycle(0), hires(false), framebuffer() {
+  file = std::fopen(filename, "rb");
+  if (!file) {
+    std::cerr << "Could not open capture file: " << filename << std::endl;
+    return;
+  }
+  readHeader(filename);
+}
+
+CaptureReader::CaptureReader(std::FILE* stream, const char* name)
+  : file(stream), cycle(0), hires(false), framebuffer() {
+  if (file) {
+    readHeader(name);
+  }
+}
+
+void CaptureReader::readHeader(const char* name) {
+  CaptureFileHeader header;
+  if (std::fread(&header, sizeof(header), 1, file) != 1 ||
+      std::memcmp(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0) {
+    std::cerr << "Not a capture file: " << name << std::endl;
+  } else if (header.version != CAPTURE_VERSION || header.frameHeaderSize != sizeof(CaptureFrameHeader)) {
+    std::cerr << "Unsupported capture version " << header.version << std::endl;
+  } else {
+    return;
+  }
+  std::fclose(file);
+  file = nullptr;
+}
+
+CaptureReader::~CaptureReader() {
+  if (file) {
+    std::fclose(file);
+  }
+}
+
+bool CaptureReader::next() {
+  CaptureFrameHeader header;
+  if (!file || std::fread(&header, sizeof(header), 1, file) != 1) {
+    return false;
+  }
+
+  if (header.keyframe) {
+    framebuffer = {};
+  }
+  unsigned char delta[MAX_FRAME_DELTA];
+  if (header.size > sizeof(delta) || std::fread(delta, 1, header.size, file) != header.size ||
+      !applyFrameDelta(delta, header.size, framebuffer)) {
+    std::cerr << "Corrupt capture frame at cycle " << header.cycle << std::endl;
+    return false;
+  }
+  cycle = header.cycle;
+  hires = header.hires != 0;
+  return true;
+}
@@ -0,0 +1,132 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include "chip8.hpp"
+#include "handoff.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+// Capture files are a CaptureFileHeader followed by one CaptureFrameHeader and
+// its encoded delta per recorded frame. A delta is the XOR of the framebuffer
+// with the previous recorded one, or with a blank one for a keyframe (always
+// the first frame), its words in
+// host byte order like save states, run-length encoded: a control byte below
+// 0x80 stands for that many plus one zero bytes, and one from 0x80 up is
+// followed by that many minus 0x7F literal bytes.
+struct CaptureFileHeader {
+  char magic[4];
+  std::uint16_t version;
+  std::uint16_t frameHeaderSize;
+};
+
+struct CaptureFrameHeader {
+  std::uint64_t cycle; // instructions retired when the frame was recorded
+  std::uint32_t size;  // bytes of encoded delta that follow
+  std::uint8_t hires;    // the frame is 128x64
+  std::uint8_t keyframe; // the delta is against a blank frame
+  std::uint8_t reserved[2];
+};
+
+static constexpr char CAPTURE_MAGIC[4] = { 'C', '8', 'C', 'P' };
+static constexpr std::uint16_t CAPTURE_VERSION = 1;
+
+// Longest possible encoding of one frame: all literals.
+static constexpr std::size_t MAX_FRAME_DELTA = sizeof(Chip8::Framebuffer) + sizeof(Chip8::Framebuffer) / 128;
+
+// Encodes frame against previous into out, which must hold MAX_FRAME_DELTA
+// bytes, and returns the encoded size.
+std::size_t encodeFrameDelta(const Chip8::Framebuffer& previous, const Chip8::Framebuffer& frame, unsigned char* out);
+// Applies an encoded delta to frame in place. Returns false if it is corrupt.
+bool applyFrameDelta(const unsigned char* delta, std::size_t size, Chip8::Framebuffer& frame);
+
+// Records the frames of a run to a capture file. The emulation thread copies
+// each changed frame into a lock-free queue; a background thread encodes and
+// writes them, so file I/O never happens on the emulation thread.
+//
+// A run paced in real time makes frames far slower than they can be written,
+// so the writer only falls a whole queue behind if the disk stalls. Then, with
+// dropWhenFull, frames are dropped rather than waited for: the next one written
+// is simply encoded against the last one that made it. A headless run going
+// flat out makes frames faster than any writer, and waits instead.
+class FrameRecorder {
+public:
+  FrameRecorder(const char* filename, bool dropWhenFull);
+  ~FrameRecorder();
+
+  FrameRecorder(const FrameRecorder&) = delete;
+  FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+  bool isOpen() const { return file != nullptr; }
+
+  // Call once per frame: queues the framebuffer if chip8.getDrawFlag() reports
+  // any change, which clears the flag.
+  void record(Chip8& chip8) {
+    if (!file || !chip8.getDrawFlag()) {
+      return;
+    }
+    const QueuedFrame frame = { chip8.getCycles(), chip8.getFramebuffer(), chip8.isHires() };
+    while (!queue.push(frame)) {
+      if (dropWhenFull) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  // Frames dropped so far because the writer was behind.
+  std::uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+  struct QueuedFrame {
+    std::uint64_t cycle;
+    Chip8::Framebuffer framebuffer;
+    bool hires;
+  };
+
+  // About four seconds of frames at 60 Hz.
+  SpscQueue<QueuedFrame, 256> queue;
+  bool dropWhenFull;
+  std::atomic<std::uint64_t> dropped;
+  std::atomic<bool> running;
+  std::FILE* file;
+  std::thread writer;
+
+  void drain();
+};
+
+// Reads a capture back one frame at a time, from a file or from a stream such
+// as a SpectatorServer connection.
+class CaptureReader {
+public:
+  explicit CaptureReader(const char* filename);
+  // Takes ownership of stream; name is only for error messages.
+  CaptureReader(std::FILE* stream, const char* name);
+  ~CaptureReader();
+
+  CaptureReader(const CaptureReader&) = delete;
+  CaptureReader& operator=(const CaptureReader&) = delete;
+
+  bool isOpen() const { return file != nullptr; }
+
+  // Advances to the next frame. Returns false at the end of the file, or with
+  // an error on std::cerr if the file is corrupt.
+  bool next();
+
+  std::uint64_t getCycle() const { return cycle; }
+  bool isHires() const { return hires; }
+  const Chip8::Framebuffer& getFramebuffer() const { return framebuffer; }
+
+private:
+  std::FILE* file;
+  std::uint64_t cycle;
+  bool hires;
+  Chip8::Framebuffer framebuffer;
+
+  void readHeader(const char* name);
+};
+
+#endif
@@ -0,0 +1,279 @@
+#include "capture.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define CHIP8_HAVE_UNIX_SOCKETS 1
+#endif
+
+// Expands a capture written by FrameRecorder into one PNG per frame, or plays
+// it back in the terminal at the pace it was recorded, or watches a machine
+// live through a SpectatorServer socket.
+//
+// PNGs are 1-bit grayscale at the frame's own resolution, named
+// frame_NNNNNN.png in order; scale them up with any image tool. --play draws
+// two rows of pixels per line of text, turning recorded cycles back into time
+// at --ips instructions per second (700 by default, the front end's pace).
+// --watch draws the same way, each frame as soon as it arrives.
+//
+// Usage: chip8_capture <capture file> <output directory>
+//        chip8_capture --play [--ips N] <capture file>
+//        chip8_capture --watch <socket>
+
+namespace {
+
+std::uint32_t crcTable[256];
+
+void initCrcTable() {
+  for (std::uint32_t n = 0; n < 256; n++) {
+    std::uint32_t c = n;
+    for (int k = 0; k < 8; k++) {
+      c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    }
+    crcTable[n] = c;
+  }
+}
+
+std::uint32_t crc32(const unsigned char* data, std::size_t size, std::uint32_t crc = 0) {
+  crc = ~crc;
+  for (std::size_t i = 0; i < size; i++) {
+    crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void putBigEndian(std::vector<unsigned char>& out, std::uint32_t value) {
+  out.push_back(static_cast<unsigned char>(value >> 24));
+  out.push_back(static_cast<unsigned char>(value >> 16));
+  out.push_back(static_cast<unsigned char>(value >> 8));
+  out.push_back(static_cast<unsigned char>(value));
+}
+
+void putChunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data) {
+  putBigEndian(out, static_cast<std::uint32_t>(data.size()));
+  const std::size_t start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data.begin(), data.end());
+  putBigEndian(out, crc32(&out[start], out.size() - start));
+}
+
+// Row r of the frame as packed pixels, leftmost in the MSB, which is how both
+// the framebuffer and a 1-bit PNG store them.
+void packRow(const Chip8::Framebuffer& framebuffer, bool hires, unsigned int row, std::vector<unsigned char>& out) {
+  const unsigned int words = hires ? 2 : 1;
+  for (unsigned int w = 0; w < words; w++) {
+    const std::uint64_t word = framebuffer[hires ? 2 * row + w : row];
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      out.push_back(static_cast<unsigned char>(word >> shift));
+    }
+  }
+}
+
+// A PNG with the image data in stored (uncompressed) deflate blocks: frames are
+// at most 1 KB of pixels, so compressing them is not worth the code.
+bool writePng(const std::string& filename, const Chip8::Framebuffer& framebuffer, bool hires) {
+  const unsigned int width = hires ? Chip8::HIRES_WIDTH : Chip8::WIDTH;
+  const unsigned int height = hires ? Chip8::HIRES_HEIGHT : Chip8::HEIGHT;
+
+  std::vector<unsigned char> raw;
+  for (unsigned int row = 0; row < height; row++) {
+    raw.push_back(0); // no filter
+    packRow(framebuffer, hires, row, raw);
+  }
+
+  std::vector<unsigned char> header;
+  putBigEndian(header, width);
+  putBigEndian(header, height);
+  header.insert(header.end(), { 1, 0, 0, 0, 0 }); // 1-bit grayscale, no interlace
+
+  std::vector<unsigned char> zlib = { 0x78, 0x01 };
+  std::uint32_t a = 1;
+  std::uint32_t b = 0;
+  for (std::size_t start = 0; start < raw.size(); start += 0xFFFF) {
+    const std::size_t length = std::min<std::size_t>(0xFFFF, raw.size() - start);
+    zlib.push_back(start + length == raw.size() ? 1 : 0);
+    zlib.push_back(static_cast<unsigned char>(length));
+    zlib.push_back(static_cast<unsigned char>(length >> 8));
+    zlib.push_back(static_cast<unsigned char>(~length));
+    zlib.push_back(static_cast<unsigned char>(~length >> 8));
+    for (std::size_t i = start; i < start + length; i++) {
+      zlib.push_back(raw[i]);
+      a = (a + raw[i]) % 65521;
+      b = (b + a) % 65521;
+    }
+  }
+  putBigEndian(zlib, b << 16 | a);
+
+  static const unsigned char signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+  std::vector<unsigned char> png(signature, signature + sizeof(signature));
+  putChunk(png, "IHDR", header);
+  putChunk(png, "IDAT", zlib);
+  putChunk(png, "IEND", {});
+
+  std::ofstream file{ filename, std::ios::binary | std::ios::trunc };
+  file.write(reinterpret_cast<const char*>(png.data()), static_cast<std::streamsize>(png.size()));
+  if (!file) {
+    std::cerr << "Could not write " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool isLit(const Chip8::Framebuffer& framebuffer, bool hires, unsigned int row, unsigned int column) {
+  return hires
+    ? (framebuffer[2 * row + column / 64] >> (63 - column % 64)) & 1
+    : (framebuffer[row] >> (63 - column)) & 1;
+}
+
+void drawFrame(const CaptureReader& capture, std::uint64_t frame) {
+  const Chip8::Framebuffer& framebuffer = capture.getFramebuffer();
+  const bool hires = capture.isHires();
+  const unsigned int width = hires ? Chip8::HIRES_WIDTH : Chip8::WIDTH;
+  const unsigned int height = hires ? Chip8::HIRES_HEIGHT : Chip8::HEIGHT;
+
+  // Home the cursor and clear below it, so a change of resolution leaves
+  // nothing behind.
+  std::string text = "\x1b[H\x1b[J";
+  for (unsigned int row = 0; row < height; row += 2) {
+    for (unsigned int column = 0; column < width; column++) {
+      const bool top = isLit(framebuffer, hires, row, column);
+      const bool bottom = isLit(framebuffer, hires, row + 1, column);
+      text += top ? (bottom ? "█" : "▀") : (bottom ? "▄" : " ");
+    }
+    text += '\n';
+  }
+  std::fputs(text.c_str(), stdout);
+  std::printf("frame %llu  cycle %llu\n", static_cast<unsigned long long>(frame),
+    static_cast<unsigned long long>(capture.getCycle()));
+  std::fflush(stdout);
+}
+
+// The stream from a SpectatorServer listening on path, or nullptr.
+std::FILE* connectSpectator(const char* path) {
+#ifdef CHIP8_HAVE_UNIX_SOCKETS
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (std::strlen(path) >= sizeof(address.sun_path)) {
+    std::cerr << "Socket path too long: " << path << std::endl;
+    return nullptr;
+  }
+  std::strcpy(address.sun_path, path);
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+    std::cerr << "Could not connect to " << path << std::endl;
+    if (fd >= 0) {
+      close(fd);
+    }
+    return nullptr;
+  }
+  std::FILE* stream = fdopen(fd, "rb");
+  if (!stream) {
+    close(fd);
+  }
+  return stream;
+#else
+  (void)path;
+  std::cerr << "Watching is not supported on this platform\n";
+  return nullptr;
+#endif
+}
+
+void usage(const char* program) {
+  std::cerr << "Usage: " << program << " <capture file> <output directory>\n"
+            << "       " << program << " --play [--ips N] <capture file>\n"
+            << "       " << program << " --watch <socket>\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  bool play = false;
+  bool watch = false;
+  double ips = 700;
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--play") == 0) {
+      play = true;
+    } else if (std::strcmp(argv[i], "--watch") == 0) {
+      watch = true;
+    } else if (std::strcmp(argv[i], "--ips") == 0 && i + 1 < argc) {
+      ips = std::strtod(argv[++i], nullptr);
+    } else if (argv[i][0] == '-') {
+      usage(argv[0]);
+      return 1;
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+  if (files.size() != (play || watch ? 1u : 2u) || (play && watch) || ips <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (watch) {
+    CaptureReader live{ connectSpectator(files[0]), files[0] };
+    if (!live.isOpen()) {
+      return 1;
+    }
+    for (std::uint64_t frame = 0; live.next(); frame++) {
+      drawFrame(live, frame);
+    }
+    return 0;
+  }
+
+  CaptureReader capture{ files[0] };
+  if (!capture.isOpen()) {
+    return 1;
+  }
+
+  std::filesystem::path directory;
+  if (!play) {
+    directory = files[1];
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+      std::cerr << "Could not create " << directory.string() << ": " << error.message() << std::endl;
+      return 1;
+    }
+    initCrcTable();
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::uint64_t firstCycle = 0;
+  std::uint64_t frame = 0;
+  for (; capture.next(); frame++) {
+    if (play) {
+      if (frame == 0) {
+        firstCycle = capture.getCycle();
+      }
+      const double seconds = (capture.getCycle() - firstCycle) / ips;
+      std::this_thread::sleep_until(start + std::chrono::duration<double>(seconds));
+      drawFrame(capture, frame);
+      continue;
+    }
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "frame_%06llu.png", static_cast<unsigned long long>(frame));
+    if (!writePng((directory / name).string(), capture.getFramebuffer(), capture.isHires())) {
+      return 1;
+    }
+  }
+
+  if (!play) {
+    std::cerr << "Wrote " << frame << " frames to " << directory.string() << std::endl;
+  }
+  return 0;
+}
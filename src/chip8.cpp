@@ -1,476 +1,1074 @@
 #include "chip8.hpp"
+#include "bits.hpp"
+#include "debug.hpp"
+#include "profile.hpp"
+#include "replay.hpp"
+#include "rom_cache.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <iostream>
-#include <fstream>
-#include <cstdarg>
+#include <memory>
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
-Chip8::Chip8(const char* filename) {
-  pc = 0x200; // Program counter starts at 0x200
-  opcode = 0; // Reset opcode
-  I = 0;      // Reset index register
-  sp = 0;     // Reset stack pointer
+namespace {
 
-  // Clear display
-  for (int i = 0; i < ARRAY_SIZE(gfx); i++) {
-    gfx[i] = false;
+// The boot image for filename, or an empty machine if it cannot be loaded.
+const Chip8::State& bootImage(const char* filename) {
+  std::shared_ptr<const RomImage> rom = RomCache::shared().load(filename);
+  if (!rom) {
+    rom = RomCache::shared().add(nullptr, 0);
   }
+  // The cache keeps every image for the life of the process.
+  return rom->boot;
+}
 
-  // Clear stack
-  for (int i = 0; i < ARRAY_SIZE(stack); i++) {
-    stack[i] = 0;
-  }
+// Every row of the screen in the given resolution, as a dirty row mask.
+std::uint64_t allRows(bool hires) {
+  return hires ? ~std::uint64_t{ 0 } : 0xFFFFFFFFu;
+}
 
-  // Clear registers V0-VF
-  for (int i = 0; i < ARRAY_SIZE(V); i++) {
-    V[i] = 0;
-  }
+} // namespace
 
-  // Clear memory
-  for (int i = 0; i < ARRAY_SIZE(memory); i++) {
-    memory[i] = 0;
-  }
+Chip8::Chip8(const char* filename) : Chip8(bootImage(filename)) {}
 
-  // Load fontset
-  for (int i = 0; i < 80; ++i) {
-    memory[i] = fontset[i];
-  }
+Chip8::Chip8(const State& boot) {
+  opcode = 0; // Reset opcode
+
+  // Memory with the font and the ROM, registers, timers, stack and display
+  // all come from the boot image in one go.
+  std::memcpy(&state, &boot, sizeof(State));
 
-  // Reset timers
-  // TODO: to understand how timers work in Chip-8
-  delay_timer = 0;
-  sound_timer = 0;
+  // Nothing has been decoded or translated yet
+  native = nullptr;
+  debugger = nullptr;
+  invalidateAll();
 
-  drawFlag = false; // Initialize draw flag
+  dirtyRows = 0; // Initialize draw flag
 
-  srand(time(NULL)); // Seed the random number generator
+  tracer = nullptr;
+  profiler = nullptr;
+  inputLog = nullptr;
+  stop = StopReason::CyclesDone;
+  cyclesPerFrame = 700 / 60; // ~700 instructions per second
+  frameCyclesLeft = cyclesPerFrame;
 
-  loadGame(filename);
+  // Seed the random number generator from the clock; hosts that need a
+  // reproducible run call seed() afterwards.
+  seed(static_cast<std::uint32_t>(time(NULL)));
+}
+
+void Chip8::bootState(State& state, const unsigned char* rom, std::size_t size, Variant variant) {
+  std::memset(&state, 0, sizeof(State));
+  std::memcpy(state.memory, fontset, sizeof(fontset));
+  if (quirksOf(variant).superChip) {
+    std::memcpy(state.memory + BIG_FONT_ADDRESS, bigFontset, sizeof(bigFontset));
+  }
+  if (size > 0) {
+    std::memcpy(state.memory + 0x200, rom, size);
+  }
+  state.pc = 0x200; // Program counter starts at 0x200
+  state.rng = randomSeed(0);
+  state.variant = variant;
+  std::memcpy(state.audioPattern, DEFAULT_AUDIO_PATTERN, sizeof(state.audioPattern));
+  state.pitch = DEFAULT_PITCH;
+}
+
+double Chip8::patternRate(unsigned char pitch) {
+  return 4000.0 * std::exp2((pitch - 64) / 48.0);
+}
+
+Variant Chip8::getVariant() const {
+  return state.variant;
+}
+
+void Chip8::setVariant(Variant variant) {
+  state.variant = variant;
+  if (quirksOf(variant).superChip) {
+    std::memcpy(state.memory + BIG_FONT_ADDRESS, bigFontset, sizeof(bigFontset));
+  } else if (state.hires) {
+    setResolution(*this, false);
+  }
+  // Everything decoded so far used the old variant's handlers.
+  invalidateAll();
 }
 
 void Chip8::pressKeys(unsigned char key) {
   if (key < 16) {
-    this->key[key] = true;
+    if (inputLog && !state.key[key]) {
+      inputLog->record({ state.cycles, InputEvent::KEY_DOWN, key });
+    }
+    state.key[key] = true;
   }
 }
 
 void Chip8::releaseKeys(unsigned char key) {
   if (key < 16) {
-    this->key[key] = false;
+    if (inputLog && state.key[key]) {
+      inputLog->record({ state.cycles, InputEvent::KEY_UP, key });
+    }
+    state.key[key] = false;
   }
 }
 
-void Chip8::loadGame(const char* filename) {
-  std::ifstream file{ filename, std::ios::binary | std::ios::ate };
-  if (!file) {
-    std::cerr << "Could not open game file: " << filename << std::endl;
-    // TODO: handle error properly
-    return;
+void Chip8::setKeys(std::uint16_t keys) {
+  for (unsigned char key = 0; key < 16; key++) {
+    if (keys & (1u << key)) {
+      pressKeys(key);
+    } else {
+      releaseKeys(key);
+    }
   }
+}
 
-  std::streamoff pos = file.tellg();
-  if (pos < 0) {
-    std::cerr << "Failed to determine file size\n";
-    return;
+void Chip8::seed(std::uint32_t seed) {
+  state.rng = randomSeed(seed);
+}
+
+std::uint64_t Chip8::getCycles() const {
+  return state.cycles;
+}
+
+unsigned int Chip8::idleTicks() const {
+  if (stop == StopReason::WaitingForKey) {
+    return IDLE_UNTIL_KEY;
+  }
+
+  // Only counts with pc at the top of the loop, where runCycles leaves it
+  // after skipping through one.
+  const unsigned short pc = state.pc & 0x0FFF;
+  if (pc > sizeof(state.memory) - 6) {
+    return 0;
+  }
+  const unsigned short read = state.memory[pc] << 8 | state.memory[pc + 1];
+  const unsigned short poll = state.memory[pc + 2] << 8 | state.memory[pc + 3];
+  const unsigned short jump = state.memory[pc + 4] << 8 | state.memory[pc + 5];
+  const unsigned short x = read & 0x0F00;
+  if ((read & 0xF0FF) == 0xF007 && poll == (0x3000 | x) && jump == (0x1000 | pc)) {
+    return state.delay_timer;
+  }
+  return 0;
+}
+
+void Chip8::setInputLog(InputLog* log) {
+  inputLog = log;
+  if (log) {
+    log->begin(state.rng);
+  }
+}
+
+bool Chip8::loadGame(const char* filename) {
+  std::shared_ptr<const RomImage> rom = RomCache::shared().load(filename);
+  if (!rom) {
+    return false;
   }
-  std::size_t fileSize = static_cast<std::size_t>(pos);
 
   const std::size_t startAddress = 0x200;
-  const std::size_t maxSize = ARRAY_SIZE(memory) - startAddress;
-  if (fileSize > maxSize) {
-    std::cerr << "Game file too large to fit in memory\n";
+  std::memcpy(state.memory + startAddress, rom->boot.memory + startAddress, rom->size);
+
+  invalidate(startAddress, rom->size);
+  resetBlocks();
+  return true;
+}
+
+void Chip8::emulateCycle() {
+  // Direct-threaded dispatch: the cache entry already holds the handler and
+  // its operands, so there is no fetch or decode on the hot path.
+  const Instruction& in = decoded[state.pc & 0x0FFF];
+#if CHIP8_TRACE
+  if (tracer) {
+    observeCycle(in);
     return;
   }
+#endif
+#if CHIP8_PROFILE
+  if (profiler) {
+    observeCycle(in);
+    return;
+  }
+#endif
+  in.handler(*this, in);
+}
 
-  file.seekg(0, std::ios::beg);
-  file.read(
-    reinterpret_cast<char*>(memory + startAddress),
-    static_cast<std::streamsize>(fileSize)
-  );
+void Chip8::setTracer(Tracer* tracer) {
+  this->tracer = tracer;
+}
 
-  if (static_cast<std::size_t>(file.gcount()) != fileSize) {
-    std::cerr << "Read error: only " << file.gcount() << " bytes were read\n";
-    return;
+void Chip8::setProfiler(Profiler* profiler) {
+  this->profiler = profiler;
+}
+
+void Chip8::setDebugger(Debugger* debugger) {
+  this->debugger = debugger;
+  invalidateAll();
+}
+
+bool Chip8::trapped(unsigned short address) const {
+  if (!debugger) {
+    return false;
   }
+  address &= 0x0FFF;
+  return debugger->traps(address, state.memory[address] << 8 | state.memory[(address + 1) & 0x0FFF]);
 }
 
-void Chip8::emulateCycle() {
-  unsigned short opcode =
-    memory[pc] << 8 | memory[pc + 1];
+#if CHIP8_TRACE || CHIP8_PROFILE
+void Chip8::observeCycle(const Instruction& in) {
+  // The cache entry may still be the decode stub, so take the opcode from
+  // memory rather than from the entry.
+  unsigned short address = state.pc & 0x0FFF;
+  unsigned short opcode = state.memory[address] << 8 | state.memory[(address + 1) & 0x0FFF];
+
+  stop = StopReason::CyclesDone;
+  in.handler(*this, in);
+  if (stop != StopReason::CyclesDone) {
+    return; // did not retire
+  }
+
+#if CHIP8_TRACE
+  if (tracer) {
+    tracer->record({ address, opcode, state.I, state.V[(opcode & 0x0F00) >> 8], state.V[0xF] });
+  }
+#endif
+#if CHIP8_PROFILE
+  if (profiler) {
+    profiler->record(address, opcode);
+  }
+#endif
+}
+#endif
+
+void Chip8::tickTimers(unsigned int ticks) {
+  if (inputLog) {
+    inputLog->record({ state.cycles, InputEvent::TIMER_TICK, ticks });
+  }
+
+  if (state.delay_timer > 0)
+    state.delay_timer = state.delay_timer > ticks ? state.delay_timer - ticks : 0;
+
+  if (state.sound_timer > 0)
+    state.sound_timer = state.sound_timer > ticks ? state.sound_timer - ticks : 0;
+}
+
+void Chip8::invalidateAll() {
+  // All translations go too, so unlike invalidate() there is no need to look
+  // for written-over blocks entry by entry.
+  for (Instruction& in : decoded) {
+    in.handler = &Chip8::opDecode;
+  }
+  resetBlocks();
+  bindNative();
+}
+
+void Chip8::invalidate(unsigned short address, unsigned short length) {
+  // The instruction starting one byte before the write overlaps it as well.
+  // Writes through I wrap at 4K, and so does the instruction at 0xFFF.
+  for (unsigned short offset = 0; offset <= length; offset++) {
+    const unsigned short i = (address + ARRAY_SIZE(decoded) - 1 + offset) & 0x0FFF;
+    decoded[i].handler = &Chip8::opDecode;
+    if (blockCode[i]) {
+      codeWritten = true;
+    }
+    if (nativeCode[i]) {
+      nativeWritten = true;
+    }
+  }
+}
+
+bool Chip8::isValidOpcode(unsigned short opcode, Variant variant) {
+  return decode(opcode, variant).handler != &Chip8::opUnknown;
+}
+
+Chip8::Instruction Chip8::decode(unsigned short opcode, Variant variant) {
+  switch (variant) {
+    case Variant::Cosmac: return decode<Variant::Cosmac>(opcode);
+    case Variant::SuperChip: return decode<Variant::SuperChip>(opcode);
+    case Variant::XoChip: return decode<Variant::XoChip>(opcode);
+    case Variant::Chip8:
+    default: return decode<Variant::Chip8>(opcode);
+  }
+}
+
+template <Variant V>
+Chip8::Instruction Chip8::decode(unsigned short opcode) {
+  constexpr Quirks quirks = quirksOf(V);
+  Instruction in;
+  in.opcode = opcode;
+  in.nnn = opcode & 0x0FFF;
+  in.x = (opcode & 0x0F00) >> 8;
+  in.y = (opcode & 0x00F0) >> 4;
+  in.n = opcode & 0x000F;
+  in.nn = opcode & 0x00FF;
+  in.handler = &Chip8::opUnknown;
 
   switch (opcode & 0xF000) {
     case 0x0000:
-      if (opcode == 0x00E0) { // 00E0 - Clears the screen
-        for (int i = 0; i < ARRAY_SIZE(gfx); i++) {
-          gfx[i] = false;
+      if (opcode == 0x00E0) {
+        in.handler = &Chip8::op00E0<V>;
+      } else if (opcode == 0x00EE) {
+        in.handler = &Chip8::op00EE;
+      } else if (quirks.superChip) {
+        switch (opcode & 0xFFF0) {
+          case 0x00C0: in.handler = &Chip8::op00CN; break;
+          case 0x00D0:
+            if (V == Variant::XoChip) {
+              in.handler = &Chip8::op00DN;
+            }
+            break;
+          case 0x00F0:
+            switch (opcode) {
+              case 0x00FB: in.handler = &Chip8::op00FB; break;
+              case 0x00FC: in.handler = &Chip8::op00FC; break;
+              case 0x00FD: in.handler = &Chip8::op00FD; break;
+              case 0x00FE: in.handler = &Chip8::op00FE; break;
+              case 0x00FF: in.handler = &Chip8::op00FF; break;
+            }
+            break;
         }
-        drawFlag = true;
-        pc += 2;
-        d_printf("%04X: Clear the screen\n", opcode);
-      } else if (opcode == 0x00EE) { // 00EE - Returns from a subroutine
-        sp--;
-        pc = stack[sp];
-        pc += 2;
-        d_printf("%04X: Return from subroutine\n", opcode);
-      } else {
-        d_printf("Unknown opcode: 0x%X\n", opcode);
-        exit(1);
       }
       break;
-
-    case 0x1000: // 1NNN - Jump to address NNN
-      pc = opcode & 0x0FFF;
-      d_printf("%X: Jump to address 0x%03X\n", opcode, opcode & 0x0FFF);
-      break;
-
-    case 0x2000: // 2NNN - Calls subroutine at NNN
-      stack[sp] = pc;
-      sp++;
-      pc = opcode & 0x0FFF;
-      d_printf("%X: Call subroutine at 0x%03X\n", opcode, opcode & 0x0FFF);
-      break;
-
-    case 0x3000: // 3XNN - Skips the next instruction if VX equals NN (usually the next instruction is a jump to skip a code block).
-      if (V[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF)) {
-        pc += 4;
-        d_printf("%X: Skip next instruction, V%X == %02X\n", opcode, (opcode & 0x0F00) >> 8, opcode & 0x00FF);
-      } else {
-        pc += 2;
-        d_printf("%X: Do not skip next instruction, V%X != %02X\n", opcode, (opcode & 0x0F00) >> 8, opcode & 0x00FF);
+    case 0x1000: in.handler = &Chip8::op1NNN; break;
+    case 0x2000: in.handler = &Chip8::op2NNN; break;
+    case 0x3000: in.handler = &Chip8::op3XNN; break;
+    case 0x4000: in.handler = &Chip8::op4XNN; break;
+    case 0x5000: in.handler = &Chip8::op5XY0; break;
+    case 0x6000: in.handler = &Chip8::op6XNN; break;
+    case 0x7000: in.handler = &Chip8::op7XNN; break;
+    case 0x8000:
+      switch (opcode & 0x000F) {
+        case 0x0000: in.handler = &Chip8::op8XY0; break;
+        case 0x0001: in.handler = &Chip8::op8XY1<V>; break;
+        case 0x0002: in.handler = &Chip8::op8XY2<V>; break;
+        case 0x0003: in.handler = &Chip8::op8XY3<V>; break;
+        case 0x0004: in.handler = &Chip8::op8XY4; break;
+        case 0x0005: in.handler = &Chip8::op8XY5; break;
+        case 0x0006: in.handler = &Chip8::op8XY6<V>; break;
+        case 0x0007: in.handler = &Chip8::op8XY7; break;
+        case 0x000E: in.handler = &Chip8::op8XYE<V>; break;
       }
       break;
-
-    case 0x4000: // 4XNN - Skips the next instruction if VX does not equal NN (usually the next instruction is a jump to skip a code block).
-      if (V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF)) {
-        pc += 4;
-        d_printf("%X: Skip next instruction, V%X != %02X\n", opcode, (opcode & 0x0F00) >> 8, opcode & 0x00FF);
-      } else {
-        pc += 2;
-        d_printf("%X: Do not skip next instruction, V%X == %02X\n", opcode, (opcode & 0x0F00) >> 8, opcode & 0x00FF);
+    case 0x9000: in.handler = &Chip8::op9XY0; break;
+    case 0xA000: in.handler = &Chip8::opANNN; break;
+    case 0xB000: in.handler = &Chip8::opBNNN<V>; break;
+    case 0xC000: in.handler = &Chip8::opCXNN; break;
+    case 0xD000: in.handler = &Chip8::opDXYN<V>; break;
+    case 0xE000:
+      switch (opcode & 0x00FF) {
+        case 0x009E: in.handler = &Chip8::opEX9E; break;
+        case 0x00A1: in.handler = &Chip8::opEXA1; break;
       }
       break;
-    
-    case 0x5000: // 5XY0 - Skips the next instruction if VX equals VY (usually the next instruction is a jump to skip a code block).
-      if (V[(opcode & 0x0F00) >> 8] == V[(opcode & 0x00F0) >> 4]) {
-        pc += 4;
-        d_printf("%X: Skip next instruction, V%X == V%X\n", opcode, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
-      } else {
-        pc += 2;
-        d_printf("%X: Do not skip next instruction, V%X != V%X\n", opcode, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
+    case 0xF000:
+      switch (opcode & 0x00FF) {
+        case 0x0007: in.handler = &Chip8::opFX07; break;
+        case 0x000A: in.handler = &Chip8::opFX0A; break;
+        case 0x0015: in.handler = &Chip8::opFX15; break;
+        case 0x0018: in.handler = &Chip8::opFX18; break;
+        case 0x001E: in.handler = &Chip8::opFX1E; break;
+        case 0x0029: in.handler = &Chip8::opFX29; break;
+        case 0x0033: in.handler = &Chip8::opFX33; break;
+        case 0x0055: in.handler = &Chip8::opFX55<V>; break;
+        case 0x0065: in.handler = &Chip8::opFX65<V>; break;
+      }
+      if (quirks.superChip) {
+        switch (opcode & 0x00FF) {
+          case 0x0030: in.handler = &Chip8::opFX30; break;
+          case 0x0075: in.handler = &Chip8::opFX75; break;
+          case 0x0085: in.handler = &Chip8::opFX85; break;
+        }
+      }
+      if (V == Variant::XoChip) {
+        if (opcode == 0xF002) {
+          in.handler = &Chip8::opF002;
+        } else if ((opcode & 0x00FF) == 0x003A) {
+          in.handler = &Chip8::opFX3A;
+        }
       }
       break;
+  }
 
-    case 0x6000: // 6XNN - Sets VX to NN
-      V[(opcode & 0x0F00) >> 8] = opcode & 0x00FF;
-      pc += 2;
-      d_printf("%X: Set V%X to %d\n", opcode, (opcode & 0x0F00) >> 8, opcode & 0x00FF);
-      break;
+  return in;
+}
 
-    case 0x7000: // 7XNN - Adds NN to VX (carry flag is not changed).
-      V[(opcode & 0x0F00) >> 8] += opcode & 0x00FF;
-      pc += 2;
-      d_printf("%X: Add %02X to V%X\n", opcode, opcode & 0x00FF, (opcode & 0x0F00) >> 8);
-      break;
+std::string Chip8::disassemble(unsigned short opcode, Variant variant) {
+  const Instruction in = decode(opcode, variant);
+  const char* syntax;
+  switch (variant) {
+    case Variant::Cosmac: syntax = syntaxOf<Variant::Cosmac>(in.handler); break;
+    case Variant::SuperChip: syntax = syntaxOf<Variant::SuperChip>(in.handler); break;
+    case Variant::XoChip: syntax = syntaxOf<Variant::XoChip>(in.handler); break;
+    case Variant::Chip8:
+    default: syntax = syntaxOf<Variant::Chip8>(in.handler); break;
+  }
 
-    case 0x8000:
-      switch (opcode & 0x000F) {
-        case 0x0000: // 8XY0 - Sets VX to the value of VY.
-          V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4];
-          pc += 2;
-          d_printf("%X: Set V%X to V%X\n", opcode, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
-          break;
-
-        case 0x0001: // 8XY1 - Sets VX to VX or VY. (bitwise OR operation).
-          V[(opcode & 0x0F00) >> 8] |= V[(opcode & 0x00F0) >> 4];
-          pc += 2;
-          d_printf("%X: Set V%X to V%X OR V%X\n", opcode, (opcode & 0x0F00) >> 8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
-          break;
-
-        case 0x0002: // 8XY2 - Sets VX to VX and VY. (bitwise AND operation).
-          V[(opcode & 0x0F00) >> 8] &= V[(opcode & 0x00F0) >> 4];
-          pc += 2;
-          d_printf("%X: Set V%X to V%X AND V%X\n", opcode, (opcode & 0x0F00) >> 8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
-          break;
-
-        case 0x0003: // 8XY3 - Sets VX to VX xor VY.
-          V[(opcode & 0x0F00) >> 8] ^= V[(opcode & 0x00F0) >> 4];
-          pc += 2;
-          d_printf("%X: Set V%X to V%X XOR V%X\n", opcode, (opcode & 0x0F00) >> 8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
-          break;
-
-        case 0x0004: { // 8XY4 - Adds VY to VX. VF is set to 1 when there's an overflow, and to 0 when there is not.
-          unsigned char vx = V[(opcode & 0x0F00) >> 8];
-          unsigned char vy = V[(opcode & 0x00F0) >> 4];
-          V[(opcode & 0x0F00) >> 8] += vy;
-          V[0xF] = (vx + vy > 255) ? 1 : 0; // Set carry flag
-          pc += 2;
-          d_printf("%X: Add V%X to V%X, VF set to %d\n", opcode, (opcode & 0x00F0) >> 4, (opcode & 0x0F00) >> 8, V[0xF]);
-          break;
-        }
+  char text[16];
+  if (!syntax) {
+    std::snprintf(text, sizeof(text), "DW 0x%04X", opcode);
+    return text;
+  }
+  // %x and %y stand for the register digits, %n for N, %b for NN and %a for
+  // NNN.
+  std::string line;
+  for (const char* c = syntax; *c; c++) {
+    if (*c != '%') {
+      line += *c;
+      continue;
+    }
+    switch (*++c) {
+      case 'x': std::snprintf(text, sizeof(text), "%X", in.x); break;
+      case 'y': std::snprintf(text, sizeof(text), "%X", in.y); break;
+      case 'n': std::snprintf(text, sizeof(text), "%u", in.n); break;
+      case 'b': std::snprintf(text, sizeof(text), "0x%02X", in.nn); break;
+      case 'a': std::snprintf(text, sizeof(text), "0x%03X", in.nnn); break;
+    }
+    line += text;
+  }
+  return line;
+}
 
-        case 0x0005: { // 8XY5 - VY is subtracted from VX. VF is set to 0 when there's an underflow, and 1 when there is not. (i.e. VF set to 1 if VX >= VY and 0 if not).
-          unsigned char vx = V[(opcode & 0x0F00) >> 8];
-          unsigned char vy = V[(opcode & 0x00F0) >> 4];
-          V[0xF] = (vx > vy) ? 1 : 0; // Set carry flag
-          V[(opcode & 0x0F00) >> 8] -= vy;
-          pc += 2;
-          d_printf("%X: Subtract V%X from V%X, VF set to %d\n", opcode, (opcode & 0x00F0) >> 4, (opcode & 0x0F00) >> 8, V[0xF]);
-          break;
-        }
+template <Variant V>
+const char* Chip8::syntaxOf(Handler handler) {
+  struct Syntax {
+    Handler handler;
+    const char* text;
+  };
+  static const Syntax table[] = {
+    { &Chip8::op00E0<V>, "CLS" },
+    { &Chip8::op00EE, "RET" },
+    { &Chip8::op00CN, "SCD %n" },
+    { &Chip8::op00DN, "SCU %n" },
+    { &Chip8::op00FB, "SCR" },
+    { &Chip8::op00FC, "SCL" },
+    { &Chip8::op00FD, "EXIT" },
+    { &Chip8::op00FE, "LOW" },
+    { &Chip8::op00FF, "HIGH" },
+    { &Chip8::op1NNN, "JP %a" },
+    { &Chip8::op2NNN, "CALL %a" },
+    { &Chip8::op3XNN, "SE V%x, %b" },
+    { &Chip8::op4XNN, "SNE V%x, %b" },
+    { &Chip8::op5XY0, "SE V%x, V%y" },
+    { &Chip8::op6XNN, "LD V%x, %b" },
+    { &Chip8::op7XNN, "ADD V%x, %b" },
+    { &Chip8::op8XY0, "LD V%x, V%y" },
+    { &Chip8::op8XY1<V>, "OR V%x, V%y" },
+    { &Chip8::op8XY2<V>, "AND V%x, V%y" },
+    { &Chip8::op8XY3<V>, "XOR V%x, V%y" },
+    { &Chip8::op8XY4, "ADD V%x, V%y" },
+    { &Chip8::op8XY5, "SUB V%x, V%y" },
+    { &Chip8::op8XY6<V>, "SHR V%x, V%y" },
+    { &Chip8::op8XY7, "SUBN V%x, V%y" },
+    { &Chip8::op8XYE<V>, "SHL V%x, V%y" },
+    { &Chip8::op9XY0, "SNE V%x, V%y" },
+    { &Chip8::opANNN, "LD I, %a" },
+    { &Chip8::opBNNN<V>, quirksOf(V).jumpUsesVX ? "JP V%x, %a" : "JP V0, %a" },
+    { &Chip8::opCXNN, "RND V%x, %b" },
+    { &Chip8::opDXYN<V>, "DRW V%x, V%y, %n" },
+    { &Chip8::opEX9E, "SKP V%x" },
+    { &Chip8::opEXA1, "SKNP V%x" },
+    { &Chip8::opFX07, "LD V%x, DT" },
+    { &Chip8::opFX0A, "LD V%x, K" },
+    { &Chip8::opFX15, "LD DT, V%x" },
+    { &Chip8::opFX18, "LD ST, V%x" },
+    { &Chip8::opFX1E, "ADD I, V%x" },
+    { &Chip8::opFX29, "LD F, V%x" },
+    { &Chip8::opFX30, "LD HF, V%x" },
+    { &Chip8::opFX33, "LD B, V%x" },
+    { &Chip8::opFX55<V>, "LD [I], V%x" },
+    { &Chip8::opFX65<V>, "LD V%x, [I]" },
+    { &Chip8::opFX75, "LD R, V%x" },
+    { &Chip8::opFX85, "LD V%x, R" },
+    { &Chip8::opF002, "AUDIO" },
+    { &Chip8::opFX3A, "PITCH V%x" },
+  };
+  for (const Syntax& syntax : table) {
+    if (syntax.handler == handler) {
+      return syntax.text;
+    }
+  }
+  return nullptr;
+}
 
-        case 0x0006: // 8XY6 - Shifts VX to the right by 1, then stores the least significant bit of VX prior to the shift into VF.
-          V[0xF] = V[(opcode & 0x0F00) >> 8] & 0x1; // Store LSB in VF
-          V[(opcode & 0x0F00) >> 8] >>= 1;
-          pc += 2;
-          d_printf("%X: Shift V%X right by one, VF set to %d\n", opcode, (opcode & 0x0F00) >> 8, V[0xF]);
-          break;
-
-        case 0x0007: { // 8XY7 - Sets VX to VY minus VX. VF is set to 0 when there's an underflow, and 1 when there is not. (i.e. VF set to 1 if VY >= VX).
-          unsigned char vx = V[(opcode & 0x0F00) >> 8];
-          unsigned char vy = V[(opcode & 0x00F0) >> 4];
-          V[0xF] = (vy > vx) ? 1 : 0; // Set carry flag
-          V[(opcode & 0x0F00) >> 8] = vy - vx;
-          pc += 2;
-          d_printf("%X: Set V%X to V%X - V%X, VF set to %d\n", opcode, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4, (opcode & 0x0F00) >> 8, V[0xF]);
-          break;
-        }
+void Chip8::opDecode(Chip8& c, const Instruction& in) {
+  // First execution of this address since it was loaded or written: decode
+  // it, patch the cache entry and run the real handler.
+  std::size_t address = &in - c.decoded;
+  unsigned short opcode =
+    c.state.memory[address] << 8 | c.state.memory[(address + 1) & 0x0FFF];
+  c.decoded[address] = decode(opcode, c.state.variant);
+  if (c.debugger && c.debugger->traps(static_cast<unsigned short>(address), opcode)) {
+    c.decoded[address].handler = &Chip8::opTrap;
+  }
+  c.decoded[address].handler(c, c.decoded[address]);
+}
 
-        case 0x000E: // 8XYE - Shifts VX to the left by 1, then sets VF to 1 if the most significant bit of VX prior to that shift was set, or to 0 if it was unset.
-          V[0xF] = (V[(opcode & 0x0F00) >> 8] & 0x80) >> 7; // Store MSB in VF
-          V[(opcode & 0x0F00) >> 8] <<= 1;
-          pc += 2;
-          d_printf("%X: Shift V%X left by one, VF set to %d\n", opcode, (opcode & 0x0F00) >> 8, V[0xF]);
-          break;
+void Chip8::opTrap(Chip8& c, const Instruction& in) {
+  if (c.debugger && c.debugger->check(in.opcode)) {
+    c.stop = StopReason::Breakpoint;
+    return;
+  }
+  const Instruction real = decode(in.opcode, c.state.variant);
+  real.handler(c, real);
+}
 
-        default:
-          d_printf("Unknown opcode: 0x%04X\n", opcode);
-          exit(1);
-      }
-      break;
+void Chip8::opUnknown(Chip8& c, const Instruction&) {
+  c.stop = StopReason::IllegalOpcode;
+}
 
-    case 0x9000: // 9XY0 - Skips the next instruction if VX does not equal VY. (Usually the next instruction is a jump to skip a code block).
-      if (V[(opcode & 0x0F00) >> 8] != V[(opcode & 0x00F0) >> 4]) {
-        pc += 4;
-        d_printf("%X: Skip next instruction, V%X != V%X\n", opcode, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
-      } else {
-        pc += 2;
-        d_printf("%X: Do not skip next instruction, V%X == V%X\n", opcode, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
-      }
-      break;
-    
-    case 0xA000: // ANNN: Sets I to the address NNN
-      I = opcode & 0x0FFF;
-      pc += 2;
-      d_printf("%X: Set I to 0x%03X\n", opcode, opcode & 0x0FFF);
-      break;
+// 00E0 - Clears the screen
+template <Variant V>
+void Chip8::op00E0(Chip8& c, const Instruction&) {
+  // Only the 128x64 mode lights anything past the first HEIGHT words.
+  constexpr std::size_t words = quirksOf(V).superChip ? HIRES_HEIGHT * 2 : HEIGHT;
+  const bool hires = quirksOf(V).superChip && c.state.hires;
+  for (std::size_t i = 0; i < words; i++) {
+    if (c.state.gfx[i]) {
+      c.dirtyRows |= std::uint64_t{ 1 } << (hires ? i / 2 : i);
+    }
+    c.state.gfx[i] = 0;
+  }
+  c.state.pc += 2;
+}
 
-    case 0xB000: // BNNN - Jumps to the address NNN plus V0
-      pc = (opcode & 0x0FFF) + V[0];
-      d_printf("%X: Jump to address 0x%03X + V0 (%d)\n", opcode, opcode & 0x0FFF, V[0]);
-      break;
+// 00EE - Returns from a subroutine
+void Chip8::op00EE(Chip8& c, const Instruction&) {
+  if (c.state.sp == 0) {
+    c.stop = StopReason::StackUnderflow;
+    return;
+  }
+  c.state.sp--;
+  c.state.pc = c.state.stack[c.state.sp];
+  c.state.pc += 2;
+}
 
-    case 0xC000: { // CXNN - Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN.
-      unsigned char rand_num = rand() % 256; // Generate a random number
-      V[(opcode & 0x0F00) >> 8] = rand_num & (opcode & 0x00FF);
-      pc += 2;
-      d_printf("%X: Set V%X to %d(random) AND %02X\n", opcode, (opcode & 0x0F00) >> 8, rand_num, opcode & 0x00FF);
-      break;
+// 1NNN - Jump to address NNN
+void Chip8::op1NNN(Chip8& c, const Instruction& in) {
+  c.state.pc = in.nnn;
+}
+
+// 2NNN - Calls subroutine at NNN
+void Chip8::op2NNN(Chip8& c, const Instruction& in) {
+  if (c.state.sp >= ARRAY_SIZE(c.state.stack)) {
+    c.stop = StopReason::StackOverflow;
+    return;
+  }
+  c.state.stack[c.state.sp] = c.state.pc;
+  c.state.sp++;
+  c.state.pc = in.nnn;
+}
+
+// 3XNN - Skips the next instruction if VX equals NN (usually the next instruction is a jump to skip a code block).
+void Chip8::op3XNN(Chip8& c, const Instruction& in) {
+  if (c.state.V[in.x] == in.nn) {
+    c.state.pc += 4;
+  } else {
+    c.state.pc += 2;
+  }
+}
+
+// 4XNN - Skips the next instruction if VX does not equal NN (usually the next instruction is a jump to skip a code block).
+void Chip8::op4XNN(Chip8& c, const Instruction& in) {
+  if (c.state.V[in.x] != in.nn) {
+    c.state.pc += 4;
+  } else {
+    c.state.pc += 2;
+  }
+}
+
+// 5XY0 - Skips the next instruction if VX equals VY (usually the next instruction is a jump to skip a code block).
+void Chip8::op5XY0(Chip8& c, const Instruction& in) {
+  if (c.state.V[in.x] == c.state.V[in.y]) {
+    c.state.pc += 4;
+  } else {
+    c.state.pc += 2;
+  }
+}
+
+// 6XNN - Sets VX to NN
+void Chip8::op6XNN(Chip8& c, const Instruction& in) {
+  c.state.V[in.x] = in.nn;
+  c.state.pc += 2;
+}
+
+// 7XNN - Adds NN to VX (carry flag is not changed).
+void Chip8::op7XNN(Chip8& c, const Instruction& in) {
+  c.state.V[in.x] += in.nn;
+  c.state.pc += 2;
+}
+
+// 8XY0 - Sets VX to the value of VY.
+void Chip8::op8XY0(Chip8& c, const Instruction& in) {
+  c.state.V[in.x] = c.state.V[in.y];
+  c.state.pc += 2;
+}
+
+// 8XY1 - Sets VX to VX or VY. (bitwise OR operation).
+template <Variant V>
+void Chip8::op8XY1(Chip8& c, const Instruction& in) {
+  c.state.V[in.x] |= c.state.V[in.y];
+  if constexpr (quirksOf(V).logicResetsVF) {
+    c.state.V[0xF] = 0;
+  }
+  c.state.pc += 2;
+}
+
+// 8XY2 - Sets VX to VX and VY. (bitwise AND operation).
+template <Variant V>
+void Chip8::op8XY2(Chip8& c, const Instruction& in) {
+  c.state.V[in.x] &= c.state.V[in.y];
+  if constexpr (quirksOf(V).logicResetsVF) {
+    c.state.V[0xF] = 0;
+  }
+  c.state.pc += 2;
+}
+
+// 8XY3 - Sets VX to VX xor VY.
+template <Variant V>
+void Chip8::op8XY3(Chip8& c, const Instruction& in) {
+  c.state.V[in.x] ^= c.state.V[in.y];
+  if constexpr (quirksOf(V).logicResetsVF) {
+    c.state.V[0xF] = 0;
+  }
+  c.state.pc += 2;
+}
+
+// 8XY4 - Adds VY to VX. VF is set to 1 when there's an overflow, and to 0 when there is not.
+void Chip8::op8XY4(Chip8& c, const Instruction& in) {
+  unsigned char vx = c.state.V[in.x];
+  unsigned char vy = c.state.V[in.y];
+  c.state.V[in.x] += vy;
+  c.state.V[0xF] = (vx + vy > 255) ? 1 : 0; // Set carry flag
+  c.state.pc += 2;
+}
+
+// 8XY5 - VY is subtracted from VX. VF is set to 0 when there's an underflow, and 1 when there is not. (i.e. VF set to 1 if VX >= VY and 0 if not).
+void Chip8::op8XY5(Chip8& c, const Instruction& in) {
+  unsigned char vx = c.state.V[in.x];
+  unsigned char vy = c.state.V[in.y];
+  c.state.V[0xF] = (vx > vy) ? 1 : 0; // Set carry flag
+  c.state.V[in.x] -= vy;
+  c.state.pc += 2;
+}
+
+// 8XY6 - Shifts VX to the right by 1, then stores the least significant bit of VX prior to the shift into VF.
+// With shiftUsesVY, VY is shifted into VX instead, and the flag is written
+// last so it survives X being F.
+template <Variant V>
+void Chip8::op8XY6(Chip8& c, const Instruction& in) {
+  if constexpr (quirksOf(V).shiftUsesVY) {
+    unsigned char vy = c.state.V[in.y];
+    c.state.V[in.x] = vy >> 1;
+    c.state.V[0xF] = vy & 0x1;
+  } else {
+    c.state.V[0xF] = c.state.V[in.x] & 0x1; // Store LSB in VF
+    c.state.V[in.x] >>= 1;
+  }
+  c.state.pc += 2;
+}
+
+// 8XY7 - Sets VX to VY minus VX. VF is set to 0 when there's an underflow, and 1 when there is not. (i.e. VF set to 1 if VY >= VX).
+void Chip8::op8XY7(Chip8& c, const Instruction& in) {
+  unsigned char vx = c.state.V[in.x];
+  unsigned char vy = c.state.V[in.y];
+  c.state.V[0xF] = (vy > vx) ? 1 : 0; // Set carry flag
+  c.state.V[in.x] = vy - vx;
+  c.state.pc += 2;
+}
+
+// 8XYE - Shifts VX to the left by 1, then sets VF to 1 if the most significant bit of VX prior to that shift was set, or to 0 if it was unset.
+// Same quirk as 8XY6.
+template <Variant V>
+void Chip8::op8XYE(Chip8& c, const Instruction& in) {
+  if constexpr (quirksOf(V).shiftUsesVY) {
+    unsigned char vy = c.state.V[in.y];
+    c.state.V[in.x] = vy << 1;
+    c.state.V[0xF] = (vy & 0x80) >> 7;
+  } else {
+    c.state.V[0xF] = (c.state.V[in.x] & 0x80) >> 7; // Store MSB in VF
+    c.state.V[in.x] <<= 1;
+  }
+  c.state.pc += 2;
+}
+
+// 9XY0 - Skips the next instruction if VX does not equal VY. (Usually the next instruction is a jump to skip a code block).
+void Chip8::op9XY0(Chip8& c, const Instruction& in) {
+  if (c.state.V[in.x] != c.state.V[in.y]) {
+    c.state.pc += 4;
+  } else {
+    c.state.pc += 2;
+  }
+}
+
+// ANNN: Sets I to the address NNN
+void Chip8::opANNN(Chip8& c, const Instruction& in) {
+  c.state.I = in.nnn;
+  c.state.pc += 2;
+}
+
+// BNNN - Jumps to the address NNN plus V0 (SUPER-CHIP: BXNN, XNN plus VX)
+template <Variant V>
+void Chip8::opBNNN(Chip8& c, const Instruction& in) {
+  if constexpr (quirksOf(V).jumpUsesVX) {
+    c.state.pc = in.nnn + c.state.V[in.x];
+  } else {
+    c.state.pc = in.nnn + c.state.V[0];
+  }
+}
+
+// CXNN - Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN.
+void Chip8::opCXNN(Chip8& c, const Instruction& in) {
+  unsigned char rand_num = nextRandom(c.state.rng) >> 24; // Generate a random number
+  c.state.V[in.x] = rand_num & in.nn;
+  c.state.pc += 2;
+}
+
+// DXYN - Draws a sprite at coordinate (VX, VY) with N bytes of sprite data starting at the address stored in I.
+// SUPER-CHIP: DXY0 draws a 16x16 sprite of 32 bytes.
+template <Variant V>
+void Chip8::opDXYN(Chip8& c, const Instruction& in) {
+  constexpr bool clip = quirksOf(V).clipSprites;
+  bool collision;
+  if constexpr (quirksOf(V).superChip) {
+    unsigned int rows = in.n ? in.n : 16;
+    unsigned int bytes = in.n ? 1 : 2;
+    if (c.state.hires) {
+      collision = drawSprite<clip, true>(c, c.state.V[in.x], c.state.V[in.y], rows, bytes);
+    } else {
+      collision = drawSprite<clip, false>(c, c.state.V[in.x], c.state.V[in.y], rows, bytes);
     }
+  } else {
+    collision = drawSprite<clip, false>(c, c.state.V[in.x], c.state.V[in.y], in.n, 1);
+  }
+  c.state.V[0xF] = collision ? 1 : 0; // Set collision flag
 
-    case 0xD000: { // DXYN - Draws a sprite at coordinate (VX, VY) with N bytes of sprite data starting at the address stored in I.
-      unsigned char x = V[(opcode & 0x0F00) >> 8];
-      unsigned char y = V[(opcode & 0x00F0) >> 4];
+  c.state.pc += 2;
+}
 
-      if (x < 0) {
-        x = (-x) % WIDTH;
-        x =  WIDTH - x;
-      } else if (x >= WIDTH) {
-        x = x % WIDTH;
+template <bool Clip, bool Hires>
+bool Chip8::drawSprite(Chip8& c, unsigned int x, unsigned int y, unsigned int rows, unsigned int bytes) {
+  constexpr unsigned int width = Hires ? HIRES_WIDTH : WIDTH;
+  constexpr unsigned int height = Hires ? HIRES_HEIGHT : HEIGHT;
+  x %= width;
+  y %= height;
+
+  // The sprite row is placed in the top bits of a row word and shifted into
+  // position. Wrapping rotates what falls off the right edge back in on the
+  // left and continues rows past the bottom from the top; clipping drops both.
+  bool collision = false;
+  unsigned short address = c.state.I;
+  for (unsigned int i = 0; i < rows; i++) {
+    unsigned int r = y + i;
+    if (r >= height) {
+      if (Clip) {
+        break;
       }
-      if (y < 0) {
-        y = (-y) % HEIGHT;
-        y = HEIGHT - y;
-      } else if (y >= HEIGHT) {
-        y = y % HEIGHT;
+      r -= height;
+    }
+    std::uint64_t sprite = std::uint64_t{ c.state.memory[address++ & 0x0FFF] } << 56;
+    if (bytes == 2) {
+      sprite |= std::uint64_t{ c.state.memory[address++ & 0x0FFF] } << 48;
+    }
+
+    std::uint64_t drawn;
+    if constexpr (!Hires) {
+      sprite = Clip ? sprite >> x : rotateRight(sprite, x);
+      collision |= (c.state.gfx[r] & sprite) != 0;
+      c.state.gfx[r] ^= sprite;
+      drawn = sprite;
+    } else {
+      // A 128-pixel row spans two words, and the sprite may straddle them.
+      std::uint64_t left = 0;
+      std::uint64_t right = 0;
+      if (x < 64) {
+        left = sprite >> x;
+        right = x ? sprite << (64 - x) : 0;
+      } else {
+        right = sprite >> (x - 64);
+        left = !Clip && x > 64 ? sprite << (128 - x) : 0;
       }
+      std::uint64_t* row = &c.state.gfx[2 * r];
+      collision |= ((row[0] & left) | (row[1] & right)) != 0;
+      row[0] ^= left;
+      row[1] ^= right;
+      drawn = left | right;
+    }
+    if (drawn) {
+      c.dirtyRows |= std::uint64_t{ 1 } << r;
+    }
+  }
+  return collision;
+}
 
-      unsigned char height = opcode & 0x000F;
+// EX9E - Skips the next instruction if the key stored in VX is pressed.
+void Chip8::opEX9E(Chip8& c, const Instruction& in) {
+  if (c.state.key[c.state.V[in.x] & 0xF]) {
+    c.state.pc += 4;
+  } else {
+    c.state.pc += 2; // Move to next instruction
+  }
+}
 
-      for (int i = 0; i < height; i++) {
-        unsigned char sprite_byte = memory[I + i];
-        for (int j = 0; j < 8; j++) {
-          unsigned char pixel = sprite_byte & (0x80 >> j);
-          if (pixel) {
-            if (gfx[(x + j) + ((y + i) * WIDTH)]) {
-              V[0xF] = 1; // Set collision flag
-            }
-            gfx[(x + j) + ((y + i) * WIDTH)] ^= true;
-          }
-        }
-      }
+// EXA1 - Skips the next instruction if the key stored in VX(only consider the lowest nibble) is not pressed (usually the next instruction is a jump to skip a code block).
+void Chip8::opEXA1(Chip8& c, const Instruction& in) {
+  if (!c.state.key[c.state.V[in.x] & 0xF]) {
+    c.state.pc += 4; // Skip next instruction
+  } else {
+    c.state.pc += 2; // Move to next instruction
+  }
+}
 
-      drawFlag = true;
-      pc += 2;
+// FX07 - Sets VX to the value of the delay timer.
+void Chip8::opFX07(Chip8& c, const Instruction& in) {
+  c.state.V[in.x] = c.state.delay_timer;
+  c.state.pc += 2;
+}
 
-      d_printf("%X: Draw sprite at (%d, %d) with height %d\n", opcode, x, y, height);
+// FX0A - A key press is awaited, and then stored in VX (blocking operation, all instruction halted until next key event, delay and sound timers should continue processing).
+void Chip8::opFX0A(Chip8& c, const Instruction& in) {
+  bool keyPressed = false;
+  for (int i = 0; i < 16; i++) {
+    if (c.state.key[i]) {
+      c.state.V[in.x] = i;
+      keyPressed = true;
       break;
     }
+  }
+  if (!keyPressed) {
+    c.stop = StopReason::WaitingForKey; // Wait for a key press
+    return;
+  }
+  c.state.pc += 2;
+}
 
-    case 0xE000:
-      switch (opcode & 0x00FF) {
-        case 0x009E: // EX9E - Skips the next instruction if the key stored in VX is pressed.
-          if (key[V[(opcode & 0x0F00) >> 8]]) {
-            pc += 4;
-            d_printf("%X: Skip next instruction, key V%X is pressed\n", opcode, (opcode & 0x0F00) >> 8);
-          } else {
-            pc += 2; // Move to next instruction
-            d_printf("%X: Do not skip next instruction, key V%X is not pressed\n", opcode, (opcode & 0x0F00) >> 8);
-          }
-          break;
-
-        case 0x00A1: // EXA1 - Skips the next instruction if the key stored in VX(only consider the lowest nibble) is not pressed (usually the next instruction is a jump to skip a code block).
-          if (!key[V[(opcode & 0x0F00) >> 8]]) {
-            pc += 4; // Skip next instruction
-            d_printf("%X: Skip next instruction, key V%X is not pressed\n", opcode, (opcode & 0x0F00) >> 8);
-          } else {
-            pc += 2; // Move to next instruction
-            d_printf("%X: Do not skip next instruction, key V%X is pressed\n", opcode, (opcode & 0x0F00) >> 8);
-          }
-          break;
-
-        default:
-          d_printf("Unknown opcode: 0x%04X\n", opcode);
-          exit(1);
-      }
-      break;
+// FX15 - Sets the delay timer to VX.
+void Chip8::opFX15(Chip8& c, const Instruction& in) {
+  c.state.delay_timer = c.state.V[in.x];
+  c.state.pc += 2;
+}
 
-    case 0xF000:
-      switch (opcode & 0x00FF) {
-        case 0x0007: // FX07 - Sets VX to the value of the delay timer.
-          V[(opcode & 0x0F00) >> 8] = delay_timer;
-          pc += 2;
-          d_printf("%X: Set V%X to delay timer value %d\n", opcode, (opcode & 0x0F00) >> 8, delay_timer);
-          break;
-
-        case 0x000A: { // FX0A - A key press is awaited, and then stored in VX (blocking operation, all instruction halted until next key event, delay and sound timers should continue processing).
-          bool keyPressed = false;
-          for (int i = 0; i < 16; i++) {
-            if (key[i]) {
-              V[(opcode & 0x0F00) >> 8] = i;
-              keyPressed = true;
-              break;
-            }
-          }
-          if (!keyPressed) {
-            return; // Wait for a key press
-          }
-          pc += 2;
-          d_printf("%X: Wait for key press, set V%X to %d\n", opcode, (opcode & 0x0F00) >> 8, V[(opcode & 0x0F00) >> 8]);
-          break;
-        }
+// FX18 - Sets the sound timer to VX.
+void Chip8::opFX18(Chip8& c, const Instruction& in) {
+  c.state.sound_timer = c.state.V[in.x];
+  c.state.pc += 2;
+}
 
-        case 0x0015: // FX15 - Sets the delay timer to VX.
-          delay_timer = V[(opcode & 0x0F00) >> 8];
-          pc += 2;
-          d_printf("%X: Set delay timer to V%X\n", opcode, (opcode & 0x0F00) >> 8);
-          break;
-
-        case 0x0018: // FX18 - Sets the sound timer to VX.
-          sound_timer = V[(opcode & 0x0F00) >> 8];
-          pc += 2;
-          d_printf("%X: Set sound timer to V%X\n", opcode, (opcode & 0x0F00) >> 8);
-          break;
-
-        case 0x001E: // FX1E - Adds VX to I. VF is not affected.
-          I += V[(opcode & 0x0F00) >> 8];
-          pc += 2;
-          d_printf("%X: Add V%X to I, new I = %d\n", opcode, (opcode & 0x0F00) >> 8, I);
-          break;
-
-        case 0x0029: // FX29 - Sets I to the location of the sprite for the character in VX(only consider the lowest nibble). Characters 0-F (in hexadecimal) are represented by a 4x5 font.
-          I = V[(opcode & 0x0F00) >> 8] * 0x5;
-          pc += 2;
-          d_printf("%X: Set I to sprite location for V%X\n", opcode, (opcode & 0x0F00) >> 8);
-          break;
-
-        case 0x0033: { // FX33 - Stores the binary-coded decimal representation of VX, with the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2.
-          unsigned short bcd = V[(opcode & 0x0F00) >> 8];
-          memory[I] = bcd / 100;
-          memory[I + 1] = (bcd / 10) % 10;
-          memory[I + 2] = bcd % 10;
-          pc += 2;
-          d_printf("%X: Store binary-coded decimal representation of V%X at I: %d, %d, %d\n",
-            opcode,
-            (opcode & 0x0F00) >> 8,
-            memory[I],
-            memory[I + 1],
-            memory[I + 2]
-          );
-          break;
-        }
+// FX1E - Adds VX to I. VF is not affected.
+void Chip8::opFX1E(Chip8& c, const Instruction& in) {
+  c.state.I += c.state.V[in.x];
+  c.state.pc += 2;
+}
 
-        case 0x0055: // FX55 - Stores from V0 to VX (including VX) in memory, starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified.
-          for (int i = 0; i <= ((opcode & 0x0F00) >> 8); i++) {
-            memory[I + i] = V[i];
-          }
-          pc += 2;
-          d_printf("%X: Store V0 to V%X in memory starting at I\n", opcode, (opcode & 0x0F00) >> 8);
-          break;
-
-        case 0x0065: // FX65 - Fills from V0 to VX (including VX) with values from memory, starting at address I. The offset from I is increased by 1 for each value read, but I itself is left unmodified.
-          for (int i = 0; i <= ((opcode & 0x0F00) >> 8); i++) {
-            V[i] = memory[I + i];
-          }
-          pc += 2;
-          d_printf("%X: Fill V0 to V%X with values from memory starting at I\n", opcode, (opcode & 0x0F00) >> 8);
-          break;
-
-        default:
-          d_printf("Unknown opcode: 0x%04X\n", opcode);
-          exit(1);
-      }
-      break;
+// FX29 - Sets I to the location of the sprite for the character in VX(only consider the lowest nibble). Characters 0-F (in hexadecimal) are represented by a 4x5 font.
+void Chip8::opFX29(Chip8& c, const Instruction& in) {
+  c.state.I = c.state.V[in.x] * 0x5;
+  c.state.pc += 2;
+}
+
+// FX33 - Stores the binary-coded decimal representation of VX, with the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2.
+void Chip8::opFX33(Chip8& c, const Instruction& in) {
+  unsigned short bcd = c.state.V[in.x];
+  c.state.memory[c.state.I & 0x0FFF] = bcd / 100;
+  c.state.memory[(c.state.I + 1) & 0x0FFF] = (bcd / 10) % 10;
+  c.state.memory[(c.state.I + 2) & 0x0FFF] = bcd % 10;
+  c.invalidate(c.state.I & 0x0FFF, 3);
+  c.state.pc += 2;
+}
 
-    default:
-      d_printf("Unknown opcode: 0x%04X\n", opcode);
-      exit(1);
+// FX55 - Stores from V0 to VX (including VX) in memory, starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified.
+template <Variant V>
+void Chip8::opFX55(Chip8& c, const Instruction& in) {
+  for (int i = 0; i <= in.x; i++) {
+    c.state.memory[(c.state.I + i) & 0x0FFF] = c.state.V[i];
   }
+  c.invalidate(c.state.I & 0x0FFF, in.x + 1);
+  if constexpr (quirksOf(V).loadStoreMovesI) {
+    c.state.I += in.x + 1;
+  }
+  c.state.pc += 2;
+}
 
-  // Update timers
-  if (delay_timer > 0)
-    --delay_timer;
+// FX65 - Fills from V0 to VX (including VX) with values from memory, starting at address I. The offset from I is increased by 1 for each value read, but I itself is left unmodified.
+template <Variant V>
+void Chip8::opFX65(Chip8& c, const Instruction& in) {
+  for (int i = 0; i <= in.x; i++) {
+    c.state.V[i] = c.state.memory[(c.state.I + i) & 0x0FFF];
+  }
+  if constexpr (quirksOf(V).loadStoreMovesI) {
+    c.state.I += in.x + 1;
+  }
+  c.state.pc += 2;
+}
+
+// 00CN - Scrolls the display down by N rows (SUPER-CHIP)
+void Chip8::op00CN(Chip8& c, const Instruction& in) {
+  const std::size_t stride = c.state.hires ? 2 : 1;
+  const std::size_t words = (c.state.hires ? HIRES_HEIGHT : HEIGHT) * stride;
+  const std::size_t shift = in.n * stride;
+  std::uint64_t* gfx = c.state.gfx.data();
+  std::memmove(gfx + shift, gfx, (words - shift) * sizeof(*gfx));
+  std::fill(gfx, gfx + shift, 0);
+  c.dirtyRows |= allRows(c.state.hires);
+  c.state.pc += 2;
+}
+
+// 00DN - Scrolls the display up by N rows (XO-CHIP)
+void Chip8::op00DN(Chip8& c, const Instruction& in) {
+  const std::size_t stride = c.state.hires ? 2 : 1;
+  const std::size_t words = (c.state.hires ? HIRES_HEIGHT : HEIGHT) * stride;
+  const std::size_t shift = in.n * stride;
+  std::uint64_t* gfx = c.state.gfx.data();
+  std::memmove(gfx, gfx + shift, (words - shift) * sizeof(*gfx));
+  std::fill(gfx + words - shift, gfx + words, 0);
+  c.dirtyRows |= allRows(c.state.hires);
+  c.state.pc += 2;
+}
 
-  if (sound_timer > 0) {
-    if (sound_timer == 1)
-      printf("BEEP!\n");
-    --sound_timer;
+// 00FB - Scrolls the display right by 4 pixels (SUPER-CHIP)
+void Chip8::op00FB(Chip8& c, const Instruction&) {
+  if (c.state.hires) {
+    for (std::size_t r = 0; r < HIRES_HEIGHT; r++) {
+      std::uint64_t* row = &c.state.gfx[2 * r];
+      row[1] = row[1] >> 4 | row[0] << 60;
+      row[0] >>= 4;
+    }
+  } else {
+    for (std::size_t r = 0; r < HEIGHT; r++) {
+      c.state.gfx[r] >>= 4;
+    }
   }
+  c.dirtyRows |= allRows(c.state.hires);
+  c.state.pc += 2;
 }
 
-std::array<std::array<bool, Chip8::WIDTH>, Chip8::HEIGHT> Chip8::getGraphics() const {
-  std::array<std::array<bool, WIDTH>, HEIGHT> graphics = {};
-  for (size_t y = 0; y < HEIGHT; ++y) {
-    for (size_t x = 0; x < WIDTH; ++x) {
-      graphics[y][x] = gfx[x + (y * WIDTH)];
+// 00FC - Scrolls the display left by 4 pixels (SUPER-CHIP)
+void Chip8::op00FC(Chip8& c, const Instruction&) {
+  if (c.state.hires) {
+    for (std::size_t r = 0; r < HIRES_HEIGHT; r++) {
+      std::uint64_t* row = &c.state.gfx[2 * r];
+      row[0] = row[0] << 4 | row[1] >> 60;
+      row[1] <<= 4;
+    }
+  } else {
+    for (std::size_t r = 0; r < HEIGHT; r++) {
+      c.state.gfx[r] <<= 4;
     }
   }
-  return graphics;
+  c.dirtyRows |= allRows(c.state.hires);
+  c.state.pc += 2;
 }
 
-void Chip8::d_printf(const char* format, ...) {
-  // TODO: port to c++ style
-  if (DEBUG) {
-    va_list args;
-    va_start(args, format);
-    vprintf(format, args);
-    va_end(args);
+// 00FD - Exits the interpreter (SUPER-CHIP)
+void Chip8::op00FD(Chip8& c, const Instruction&) {
+  c.stop = StopReason::Exited;
+}
+
+// 00FE - Switches to 64x32 (SUPER-CHIP)
+void Chip8::op00FE(Chip8& c, const Instruction&) {
+  setResolution(c, false);
+  c.state.pc += 2;
+}
+
+// 00FF - Switches to 128x64 (SUPER-CHIP)
+void Chip8::op00FF(Chip8& c, const Instruction&) {
+  setResolution(c, true);
+  c.state.pc += 2;
+}
+
+void Chip8::setResolution(Chip8& c, bool hires) {
+  // The rows of one mode mean nothing in the other, so start from blank.
+  c.state.hires = hires;
+  c.state.gfx.fill(0);
+  c.dirtyRows = allRows(hires);
+}
+
+// FX30 - Sets I to the 8x10 digit for the lowest nibble of VX (SUPER-CHIP)
+void Chip8::opFX30(Chip8& c, const Instruction& in) {
+  c.state.I = BIG_FONT_ADDRESS + (c.state.V[in.x] & 0xF) * 10;
+  c.state.pc += 2;
+}
+
+// FX75 - Stores V0 to VX in the user flags (SUPER-CHIP)
+void Chip8::opFX75(Chip8& c, const Instruction& in) {
+  for (int i = 0; i <= in.x; i++) {
+    c.state.flags[i] = c.state.V[i];
+  }
+  c.state.pc += 2;
+}
+
+// FX85 - Fills V0 to VX from the user flags (SUPER-CHIP)
+void Chip8::opFX85(Chip8& c, const Instruction& in) {
+  for (int i = 0; i <= in.x; i++) {
+    c.state.V[i] = c.state.flags[i];
+  }
+  c.state.pc += 2;
+}
+
+// F002 - Loads the 16-byte audio pattern from I (XO-CHIP)
+void Chip8::opF002(Chip8& c, const Instruction&) {
+  for (int i = 0; i < 16; i++) {
+    c.state.audioPattern[i] = c.state.memory[(c.state.I + i) & 0x0FFF];
+  }
+  c.state.pc += 2;
+}
+
+// FX3A - Sets the audio pattern's pitch to VX (XO-CHIP)
+void Chip8::opFX3A(Chip8& c, const Instruction& in) {
+  c.state.pitch = c.state.V[in.x];
+  c.state.pc += 2;
+}
+
+// 6XNN; 6YNN - Two register loads in a row
+unsigned int Chip8::op6XNN6XNN(Chip8& c, const BlockOp& op) {
+  op6XNN(c, op.first);
+  op6XNN(c, op.second);
+  return 2;
+}
+
+// ANNN; DXYN - Point I at a sprite and draw it
+template <Variant V>
+unsigned int Chip8::opANNNDXYN(Chip8& c, const BlockOp& op) {
+  opANNN(c, op.first);
+  opDXYN<V>(c, op.second);
+  return 2;
+}
+
+Chip8::BlockHandler Chip8::drawFusion(Variant variant) {
+  switch (variant) {
+    case Variant::Cosmac: return &Chip8::opANNNDXYN<Variant::Cosmac>;
+    case Variant::SuperChip: return &Chip8::opANNNDXYN<Variant::SuperChip>;
+    case Variant::XoChip: return &Chip8::opANNNDXYN<Variant::XoChip>;
+    case Variant::Chip8:
+    default: return &Chip8::opANNNDXYN<Variant::Chip8>;
   }
 }
 
-bool Chip8::getDrawFlag() {
-  bool wasDrawn = drawFlag;
-  drawFlag = false;
+// 3XNN; 1NNN - Jump to NNN unless VX equals NN
+unsigned int Chip8::op3XNN1NNN(Chip8& c, const BlockOp& op) {
+  if (c.state.V[op.first.x] == op.first.nn) {
+    c.state.pc += 4;
+    return 1;
+  }
+  c.state.pc = op.second.nnn;
+  return 2;
+}
+
+const Chip8::Framebuffer& Chip8::getFramebuffer() const {
+  return state.gfx;
+}
+
+bool Chip8::isHires() const {
+  return state.hires;
+}
+
+const Chip8::State& Chip8::getState() const {
+  return state;
+}
+
+std::uint64_t Chip8::getDrawFlag() {
+  std::uint64_t wasDrawn = dirtyRows;
+  dirtyRows = 0;
   return wasDrawn;
 }
@@ -1,28 +1,230 @@
 #ifndef CHIP8_HPP
 #define CHIP8_HPP
 
-#define DEBUG 1
+// Set to 0 to compile instruction tracing out of the core entirely.
+#ifndef CHIP8_TRACE
+#define CHIP8_TRACE 1
+#endif
+
+// Set to 1 to compile the profiler hooks in. Off by default, so the hot path
+// does not even test for a profiler; chip8_profile links a core built with it.
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
 
+#include "quirks.hpp"
 #include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Debugger;
+class InputLog;
+class Profiler;
+class Tracer;
 
 class Chip8 {
 public:
+  // Boots filename through RomCache::shared(), so only the first machine
+  // built from a file reads it.
   Chip8(const char* filename);
   // ~Chip8();
 
-  void loadGame(const char* filename);
+  // Why a batched run returned. Faults leave pc on the offending instruction
+  // so the host can inspect the machine; nothing in the core exits the process.
+  enum class StopReason {
+    CyclesDone,     // ran the full count
+    FrameComplete,  // runFrame finished a 60 Hz frame
+    WaitingForKey,  // blocked on FX0A; pc stays on the FX0A
+    IllegalOpcode,
+    StackOverflow,  // 2NNN with all 16 levels in use
+    StackUnderflow, // 00EE with an empty stack
+    Breakpoint,     // the debugger stopped it; pc stays on the instruction
+    Exited,         // SUPER-CHIP 00FD; pc stays on the 00FD
+  };
+
+  struct RunResult {
+    StopReason reason;
+    unsigned int cycles; // instructions actually retired
+  };
+
+  // Copies the ROM in filename to 0x200 over whatever is in memory. Returns
+  // false, leaving memory alone, if the file cannot be read.
+  bool loadGame(const char* filename);
   void emulateCycle();
+  // Runs up to count instructions in a tight loop, stopping early on a fault
+  // or when the CPU blocks on FX0A.
+  RunResult runCycles(unsigned int count);
+  // Runs what is left of the current 60 Hz frame, then ticks the timers. A CPU
+  // blocked on FX0A sits out the rest of the frame.
+  RunResult runFrame();
+  void setCyclesPerFrame(unsigned int cycles);
+  // Records every retired instruction into tracer, or stops tracing when
+  // passed nullptr. Translated blocks are bypassed while tracing.
+  void setTracer(Tracer* tracer);
+  // Counts every retired instruction into profiler, or stops when passed
+  // nullptr. Like tracing, this runs on the interpreter, so the counts are the
+  // instructions the ROM really executes. Does nothing without CHIP8_PROFILE.
+  void setProfiler(Profiler* profiler);
+  // Stops runs wherever debugger says to (see debug.hpp), or detaches it when
+  // passed nullptr. Drops all decoded code, so that only the instructions the
+  // debugger can stop on are dispatched through it.
+  void setDebugger(Debugger* debugger);
+  // The delay and sound timers count down at 60 Hz independently of the CPU,
+  // so the host calls this once per 60 Hz tick of its own clock. The core makes
+  // no sound itself: the host plays a tone while sound_timer is non-zero.
+  void tickTimers(unsigned int ticks = 1);
   void pressKeys(unsigned char key);
   void releaseKeys(unsigned char key);
+  // Sets the whole keypad at once: bit K of keys set means key K is down.
+  void setKeys(std::uint16_t keys);
+  // Reseeds the random number generator behind CXNN. The same ROM, seed and
+  // input log always produce the same run.
+  void seed(std::uint32_t seed);
+  // Instructions retired by runCycles/runFrame since the machine was created.
+  std::uint64_t getCycles() const;
+  // As of the last run, how many more 60 Hz ticks the guest is certain to
+  // spend without drawing or looking at the keypad, so a host pacing in real
+  // time can sleep through them and run them later: the delay timer's count
+  // while polling it in the FX07; 3X00; 1NNN idiom, IDLE_UNTIL_KEY while
+  // blocked on FX0A (timers still tick), 0 when busy.
+  unsigned int idleTicks() const;
+  static constexpr unsigned int IDLE_UNTIL_KEY = ~0u;
+  // Records key presses, releases and timer ticks into log, stamped with the
+  // cycle count, or stops recording when passed nullptr. Attach it before the
+  // first instruction runs so the log can be replayed from boot.
+  void setInputLog(InputLog* log);
 
   static constexpr unsigned char WIDTH = 64;
   static constexpr unsigned char HEIGHT = 32;
+  // SUPER-CHIP high resolution, switched on by 00FF
+  static constexpr unsigned char HIRES_WIDTH = 128;
+  static constexpr unsigned char HIRES_HEIGHT = 64;
+
+  // Read-only view of the live framebuffer, leftmost pixel in the most
+  // significant bit. In low resolution row N is word N; in high resolution it
+  // is words 2N and 2N+1, left half first. Valid for the lifetime of the Chip8
+  // object.
+  using Framebuffer = std::array<std::uint64_t, HIRES_HEIGHT * 2>;
+  const Framebuffer& getFramebuffer() const;
+  bool isHires() const;
+
+  // The interpreter the machine behaves like. Machines booted from a file pick
+  // it by ROM (see variantFor); switching drops all decoded code.
+  Variant getVariant() const;
+  void setVariant(Variant variant);
+  // Whether the given variant's interpreter knows opcode at all.
+  static bool isValidOpcode(unsigned short opcode, Variant variant);
+  // The instruction in assembler syntax (CLS, LD VA, 0x05, ...), or DW for a
+  // word the variant's interpreter would not run.
+  static std::string disassemble(unsigned short opcode, Variant variant);
+
+  // Code compiled ahead of time from one ROM by chip8_aot; see native.hpp.
+  struct NativeBlock;
+  struct NativeProgram;
+  // Runs compiled blocks instead of the translator wherever the program has
+  // one for pc and memory still holds the code it was compiled from; anything
+  // else, including code the ROM has since written over, is interpreted.
+  // nullptr, or a program for another variant, turns it off.
+  void setNativeProgram(const NativeProgram* program);
+
+  // The whole machine in one trivially copyable block, so a snapshot is a
+  // single memcpy and a save file is this struct behind a small header.
+  struct State {
+    // Chip 8 has 4K memory in total
+    unsigned char memory[4096];
 
-  std::array<std::array<bool, WIDTH>, HEIGHT> getGraphics() const;
+    //  Chip 8 has 15 8-bit general purpose registers named V0,V1 up to VE.
+    // The 16th register is used for the ‘carry flag’.
+    unsigned char V[16];
+
+    // Index Register and Program Counter
+    // which can have a value from 0x000 to 0xFFF
+    unsigned short I;
+    unsigned short pc;
+
+    // Systems memory map:
+    // 0x000-0x1FF - Chip 8 interpreter (contains font set in emu)
+    // 0x050-0x0A0 - Used for the built in 4x5 pixel font set (0-F)
+    // 0x200-0xFFF - Program ROM and work RAM
+
+    // Chip 8 are black and white and the screen has a total of 2048 pixels (64 x
+    // 32). Each row is packed into one word, leftmost pixel in the most
+    // significant bit, so a sprite row is drawn with a single XOR. SUPER-CHIP
+    // doubles both sides and uses two words per row.
+    Framebuffer gfx;
+    bool hires;
+
+    // Interupts and hardware registers.
+    // The Chip 8 has none, but there are two timer registers that count at 60 Hz.
+    // When set above zero they will count down to zero.
+    unsigned char delay_timer;
+    unsigned char sound_timer;
+
+    // The system has 16 levels of stack
+    unsigned short stack[16];
+    unsigned short sp;
+
+    // Chip 8 has a HEX based keypad (0x0-0xF)
+    unsigned char key[16];
+
+    // Per-instance random number generator state used by CXNN
+    std::uint32_t rng;
+
+    // Instructions retired so far; input logs are stamped with it
+    std::uint64_t cycles;
+
+    // SUPER-CHIP "RPL user flags", kept across FX75/FX85
+    unsigned char flags[16];
+
+    // Which interpreter's quirks the machine follows
+    Variant variant;
+
+    // XO-CHIP sound: 128 one-bit samples, first in the MSB of byte 0, looped
+    // while sound_timer runs, and the pitch setting their rate. Boots with
+    // DEFAULT_AUDIO_PATTERN, a plain square wave, until F002 loads another.
+    unsigned char audioPattern[16];
+    unsigned char pitch;
+  };
+
+  static constexpr unsigned char DEFAULT_AUDIO_PATTERN[16] = {
+    0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF,
+    0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF,
+  };
+  static constexpr unsigned char DEFAULT_PITCH = 64;
+  // Samples per second audioPattern plays at: 4000 at the default pitch, an
+  // octave higher or lower every 48 steps.
+  static double patternRate(unsigned char pitch);
+
+  // Boots straight from a boot image (see RomImage), which costs one copy of
+  // the State block and no file I/O.
+  explicit Chip8(const State& boot);
+  // Fills state with the machine as it powers on with rom loaded at 0x200:
+  // the fonts in low memory, everything else zero.
+  static void bootState(State& state, const unsigned char* rom, std::size_t size,
+    Variant variant = Variant::Chip8);
+
+  // Read-only view of the live machine, valid for the lifetime of the Chip8
+  // object. Cheaper than saveState when only a few fields are needed.
+  const State& getState() const;
+
+  // In-memory snapshots: a plain copy of the state block. Restoring also
+  // throws away everything decoded or translated from the old memory.
+  void saveState(State& snapshot) const;
+  void loadState(const State& snapshot);
+  // Save files: a versioned, checksummed header followed by the raw State,
+  // so a file can be mapped and used without parsing. Return false on error.
+  bool saveState(const char* filename) const;
+  bool loadState(const char* filename);
   // unsigned char getDelayTimer();
   // unsigned char getSoundTimer();
 
-  bool getDrawFlag();
+  // Returns a mask with bit N set if row N changed since the last call, and
+  // clears it. Zero means nothing needs to be redrawn. Switching resolution
+  // sets every row of the new one.
+  std::uint64_t getDrawFlag();
 
 private:
   static constexpr unsigned char fontset[80] = {
@@ -44,47 +246,210 @@ private:
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
   };
 
+  // SUPER-CHIP 8x10 digits for FX30, right after the small font
+  static constexpr unsigned short BIG_FONT_ADDRESS = 0x50;
+  static constexpr unsigned char bigFontset[160] = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+  };
+
   // Chip 8 has 35 opcodes
   // Each opcode is 2 bytes long
   unsigned short opcode;
 
-  // Chip 8 has 4K memory in total
-  unsigned char memory[4096];
+  // Pre-decoded form of an opcode: the handler that executes it plus the
+  // operands already extracted from the nibbles, so the hot loop never has to
+  // fetch, mask or switch again.
+  struct Instruction;
+  using Handler = void (*)(Chip8&, const Instruction&);
+
+  struct Instruction {
+    Handler handler;
+    unsigned short opcode;
+    unsigned short nnn;
+    unsigned char x;
+    unsigned char y;
+    unsigned char n;
+    unsigned char nn;
+  };
+
+  // Everything that makes up the running machine
+  State state;
+
+  // Rows touched by 00E0 or DXYN since the last getDrawFlag()
+  std::uint64_t dirtyRows;
+
+  // Set by a handler that cannot complete; checked by runCycles after each
+  // interpreted instruction and each block.
+  StopReason stop;
+
+  unsigned int cyclesPerFrame;
+  unsigned int frameCyclesLeft;
+
+  // Decoded instruction cache, indexed by address. Entries start out pointing
+  // at opDecode, which decodes the opcode on first execution and patches the
+  // entry with the real handler. Any write to memory must invalidate the
+  // entries overlapping it.
+  Instruction decoded[4096];
+
+  void invalidate(unsigned short address, unsigned short length);
+  // Drops every decoded instruction and translated block at once.
+  void invalidateAll();
+  // Handlers are instantiated once per variant; decode picks the set of the
+  // machine's variant, so quirks cost nothing once an address is decoded.
+  static Instruction decode(unsigned short opcode, Variant variant);
+  template <Variant V> static Instruction decode(unsigned short opcode);
+  // The syntax for each handler decode<V> can pick, so the listing always
+  // names what the machine would actually run.
+  template <Variant V> static const char* syntaxOf(Handler handler);
+
+  // Basic-block translation used by runCycles. A block is a straight run of
+  // instructions ending at a jump, call, return, skip or memory write, with
+  // common pairs fused into a single superinstruction.
+  // Fused handlers return how many instructions they actually retired, since
+  // a taken skip retires fewer than the pair it was fused from.
+  struct BlockOp;
+  using BlockHandler = unsigned int (*)(Chip8&, const BlockOp&);
+
+  struct BlockOp {
+    BlockHandler fused; // nullptr for a plain instruction
+    Instruction first;
+    Instruction second;
+    unsigned char cycles;
+  };
+
+  struct Block {
+    unsigned short start;
+    unsigned short end;
+    unsigned short cycles;
+    // FX07; 3X00; 1NNN back to start: spins until the delay timer expires,
+    // which cannot happen before the host's next timer tick.
+    bool idleLoop;
+    std::vector<BlockOp> ops;
+  };
+
+  static constexpr short NO_BLOCK = -1;
+  static constexpr unsigned short MAX_BLOCK_LENGTH = 64;
+
+  std::vector<Block> blocks;
+  short blockIndex[4096];
+  // Addresses covered by a translated block, so writes to them can be caught.
+  std::bitset<4096> blockCode;
+  bool codeWritten;
+  // Set once the ROM writes over translated code; runCycles then stays on the
+  // interpreter for the rest of the run.
+  bool selfModifying;
+
+  // Called after anything runs: drops all translated blocks if it wrote over
+  // one, and any compiled block it wrote over.
+  void checkCodeWritten();
+  void resetBlocks();
+  short translate(unsigned short start);
+  // For a block that is an idle loop on VX starting at start.
+  void skipIdleLoop(unsigned short start, unsigned int cycles, unsigned char x, unsigned int budget,
+    unsigned int& executed);
 
-  //  Chip 8 has 15 8-bit general purpose registers named V0,V1 up to VE.
-  // The 16th register is used for the ‘carry flag’.
-  unsigned char V[16];
+  // Ahead-of-time compiled blocks, indexed by start address; empty when no
+  // program is bound. Rebound from the program whenever memory is replaced
+  // (invalidateAll) or written where compiled code came from (nativeCode).
+  const NativeProgram* native;
+  std::vector<const NativeBlock*> nativeIndex;
+  std::bitset<4096> nativeCode;
+  bool nativeWritten;
 
-  // Index Register and Program Counter
-  // which can have a value from 0x000 to 0xFFF
-  unsigned short I;
-  unsigned short pc;
+  void bindNative();
 
-  // Systems memory map:
-  // 0x000-0x1FF - Chip 8 interpreter (contains font set in emu)
-  // 0x050-0x0A0 - Used for the built in 4x5 pixel font set (0-F)
-  // 0x200-0xFFF - Program ROM and work RAM
+  static unsigned int op6XNN6XNN(Chip8& c, const BlockOp& op);
+  template <Variant V> static unsigned int opANNNDXYN(Chip8& c, const BlockOp& op);
+  static BlockHandler drawFusion(Variant variant);
+  static unsigned int op3XNN1NNN(Chip8& c, const BlockOp& op);
 
-  // Chip 8 are black and white and the screen has a total of 2048 pixels (64 x
-  // 32)
-  bool gfx[WIDTH * HEIGHT];
+  static void opDecode(Chip8& c, const Instruction& in);
+  // Stands in for the handler wherever the debugger may stop, and asks it
+  // before running the real one.
+  static void opTrap(Chip8& c, const Instruction& in);
+  static void opUnknown(Chip8& c, const Instruction& in);
+  template <Variant V> static void op00E0(Chip8& c, const Instruction& in);
+  static void op00EE(Chip8& c, const Instruction& in);
+  static void op1NNN(Chip8& c, const Instruction& in);
+  static void op2NNN(Chip8& c, const Instruction& in);
+  static void op3XNN(Chip8& c, const Instruction& in);
+  static void op4XNN(Chip8& c, const Instruction& in);
+  static void op5XY0(Chip8& c, const Instruction& in);
+  static void op6XNN(Chip8& c, const Instruction& in);
+  static void op7XNN(Chip8& c, const Instruction& in);
+  static void op8XY0(Chip8& c, const Instruction& in);
+  template <Variant V> static void op8XY1(Chip8& c, const Instruction& in);
+  template <Variant V> static void op8XY2(Chip8& c, const Instruction& in);
+  template <Variant V> static void op8XY3(Chip8& c, const Instruction& in);
+  static void op8XY4(Chip8& c, const Instruction& in);
+  static void op8XY5(Chip8& c, const Instruction& in);
+  template <Variant V> static void op8XY6(Chip8& c, const Instruction& in);
+  static void op8XY7(Chip8& c, const Instruction& in);
+  template <Variant V> static void op8XYE(Chip8& c, const Instruction& in);
+  static void op9XY0(Chip8& c, const Instruction& in);
+  static void opANNN(Chip8& c, const Instruction& in);
+  template <Variant V> static void opBNNN(Chip8& c, const Instruction& in);
+  static void opCXNN(Chip8& c, const Instruction& in);
+  template <Variant V> static void opDXYN(Chip8& c, const Instruction& in);
+  static void opEX9E(Chip8& c, const Instruction& in);
+  static void opEXA1(Chip8& c, const Instruction& in);
+  static void opFX07(Chip8& c, const Instruction& in);
+  static void opFX0A(Chip8& c, const Instruction& in);
+  static void opFX15(Chip8& c, const Instruction& in);
+  static void opFX18(Chip8& c, const Instruction& in);
+  static void opFX1E(Chip8& c, const Instruction& in);
+  static void opFX29(Chip8& c, const Instruction& in);
+  static void opFX33(Chip8& c, const Instruction& in);
+  template <Variant V> static void opFX55(Chip8& c, const Instruction& in);
+  template <Variant V> static void opFX65(Chip8& c, const Instruction& in);
 
-  // Interupts and hardware registers.
-  // The Chip 8 has none, but there are two timer registers that count at 60 Hz.
-  // When set above zero they will count down to zero.
-  unsigned char delay_timer;
-  unsigned char sound_timer;
+  // SUPER-CHIP and XO-CHIP additions, decoded only for those variants
+  static void op00CN(Chip8& c, const Instruction& in);
+  static void op00DN(Chip8& c, const Instruction& in);
+  static void op00FB(Chip8& c, const Instruction& in);
+  static void op00FC(Chip8& c, const Instruction& in);
+  static void op00FD(Chip8& c, const Instruction& in);
+  static void op00FE(Chip8& c, const Instruction& in);
+  static void op00FF(Chip8& c, const Instruction& in);
+  static void opFX30(Chip8& c, const Instruction& in);
+  static void opFX75(Chip8& c, const Instruction& in);
+  static void opFX85(Chip8& c, const Instruction& in);
+  static void opF002(Chip8& c, const Instruction& in);
+  static void opFX3A(Chip8& c, const Instruction& in);
 
-  // The system has 16 levels of stack
-  unsigned short stack[16];
-  unsigned short sp;
+  // XORs rows of a sprite from I into the framebuffer at (x, y), one byte
+  // per row or two for DXY0, and returns whether any lit pixel was erased.
+  template <bool Clip, bool Hires>
+  static bool drawSprite(Chip8& c, unsigned int x, unsigned int y, unsigned int rows, unsigned int bytes);
+  // Shared by 00FE and 00FF: blank screen, every row of the new mode dirty.
+  static void setResolution(Chip8& c, bool hires);
 
-  // Chip 8 has a HEX based keypad (0x0-0xF)
-  unsigned char key[16];
+  Tracer* tracer;
+  Profiler* profiler;
+  // Runs one instruction and reports it to the tracer and the profiler.
+  void observeCycle(const Instruction& in);
 
-  bool drawFlag;
+  InputLog* inputLog;
 
-  void d_printf(const char* format, ...);
+  Debugger* debugger;
+  // Whether the debugger may stop at address; decoding and translation keep
+  // those instructions out of the fast paths.
+  bool trapped(unsigned short address) const;
 };
 
 #endif
@@ -0,0 +1,265 @@
+#include "chip8_env.h"
+#include "chip8.hpp"
+#include "native.hpp"
+#include "rom_cache.hpp"
+#include "spectate.hpp"
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CHIP8_HAVE_SHM 1
+#endif
+
+static_assert(std::is_trivially_copyable<EnvObservation>::value, "observations are shared raw");
+static_assert(sizeof(EnvObservation::screen) == sizeof(Chip8::Framebuffer),
+  "an observation holds the framebuffer as is");
+static_assert(sizeof(EnvHeader) % alignof(EnvObservation) == 0,
+  "observations follow the header without padding");
+
+struct Env {
+  std::vector<Chip8> machines;
+  // What every machine boots into, and goes back to on env_reset.
+  std::shared_ptr<const RomImage> rom;
+  EnvHeader* header;
+  EnvObservation* observations;
+  EnvRewardHook rewardHook;
+  void* rewardUser;
+  // Per machine; null unless env_spectate turned it on.
+  std::vector<std::unique_ptr<SpectatorServer>> spectators;
+};
+
+namespace {
+
+// Describes machine index as it is now, after a reset rather than a step.
+void observeReset(Env* env, std::uint32_t index) {
+  Chip8& machine = env->machines[index];
+  const Chip8::State& state = machine.getState();
+  EnvObservation& observation = env->observations[index];
+
+  std::memcpy(observation.screen, state.gfx.data(), sizeof(observation.screen));
+  observation.cycles = state.cycles;
+  observation.changedRows = machine.getDrawFlag();
+  observation.frames = 0;
+  observation.reward = 0;
+  observation.reason = static_cast<std::uint8_t>(Chip8::StopReason::FrameComplete);
+  observation.done = 0;
+  observation.sound = state.sound_timer > 0;
+  observation.hires = state.hires;
+  std::memset(observation.reserved, 0, sizeof(observation.reserved));
+}
+
+// The writer's half of the sequence lock on EnvHeader::step: odd from here
+// until publish().
+void beginWrite(EnvHeader* header) {
+  *static_cast<volatile std::uint64_t*>(&header->step) = header->step + 1;
+  // A client that sees any of the writes that follow sees the odd number too.
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void publish(EnvHeader* header) {
+  // Everything written before the new, even step number is visible to a
+  // client that reads the number with acquire ordering.
+  std::atomic_thread_fence(std::memory_order_release);
+  *static_cast<volatile std::uint64_t*>(&header->step) = header->step + 1;
+}
+
+} // namespace
+
+size_t env_buffer_size(uint32_t count) {
+  return sizeof(EnvHeader) + count * sizeof(EnvObservation);
+}
+
+Env* env_create(const char* rom, uint32_t count, uint32_t seed, void* buffer) {
+  std::shared_ptr<const RomImage> image = RomCache::shared().load(rom);
+  if (!image) {
+    return nullptr;
+  }
+
+  Env* env = new Env{};
+  env->rom = image;
+  env->spectators.resize(count);
+  env->machines.reserve(count);
+  // ROMs compiled into chip8_native run on their compiled code.
+  const Chip8::NativeProgram* program = nativeProgramFor(image->hash);
+  for (std::uint32_t i = 0; i < count; i++) {
+    env->machines.emplace_back(image->boot);
+    env->machines.back().setNativeProgram(program);
+  }
+
+  env->header = static_cast<EnvHeader*>(buffer);
+  env->observations = reinterpret_cast<EnvObservation*>(env->header + 1);
+  env->header->magic = ENV_MAGIC;
+  env->header->version = ENV_VERSION;
+  env->header->count = count;
+  env->header->observationSize = sizeof(EnvObservation);
+  env->header->step = 0;
+  beginWrite(env->header);
+
+  for (std::uint32_t i = 0; i < count; i++) {
+    env->machines[i].seed(seed + i);
+    observeReset(env, i);
+  }
+  publish(env->header);
+  return env;
+}
+
+void env_destroy(Env* env) {
+  delete env;
+}
+
+void env_set_reward_hook(Env* env, EnvRewardHook hook, void* user) {
+  env->rewardHook = hook;
+  env->rewardUser = user;
+}
+
+void env_step(Env* env, const uint16_t* actions, uint32_t frames_to_skip) {
+  beginWrite(env->header);
+  for (std::uint32_t i = 0; i < env->machines.size(); i++) {
+    EnvObservation& observation = env->observations[i];
+    if (observation.done) {
+      observation.changedRows = 0;
+      observation.frames = 0;
+      continue;
+    }
+
+    Chip8& machine = env->machines[i];
+    if (actions) {
+      machine.setKeys(actions[i]);
+    }
+
+    std::uint64_t changedRows = 0;
+    std::uint32_t frames = 0;
+    Chip8::StopReason reason = Chip8::StopReason::FrameComplete;
+    for (; frames < frames_to_skip; frames++) {
+      const Chip8::RunResult result = machine.runFrame();
+      changedRows |= machine.getDrawFlag();
+      reason = result.reason;
+      if (reason != Chip8::StopReason::FrameComplete && reason != Chip8::StopReason::WaitingForKey) {
+        observation.done = 1;
+        break;
+      }
+    }
+
+    const Chip8::State& state = machine.getState();
+    if (changedRows) {
+      std::memcpy(observation.screen, state.gfx.data(), sizeof(observation.screen));
+    }
+    observation.cycles = state.cycles;
+    observation.changedRows = changedRows;
+    observation.frames = frames;
+    observation.reward = env->rewardHook ? env->rewardHook(i, state.memory, state.V, env->rewardUser) : 0;
+    observation.reason = static_cast<std::uint8_t>(reason);
+    observation.sound = state.sound_timer > 0;
+    observation.hires = state.hires;
+    if (env->spectators[i]) {
+      env->spectators[i]->publish(machine);
+    }
+  }
+  publish(env->header);
+}
+
+int env_spectate(Env* env, uint32_t index, const char* path) {
+  env->spectators[index].reset();
+  if (!path) {
+    return 0;
+  }
+  auto server = std::make_unique<SpectatorServer>(path);
+  if (!server->isOpen()) {
+    return -1;
+  }
+  server->publish(env->machines[index]);
+  env->spectators[index] = std::move(server);
+  return 0;
+}
+
+void env_reset(Env* env, uint32_t index, uint32_t seed) {
+  Chip8& machine = env->machines[index];
+  machine.loadState(env->rom->boot);
+  machine.seed(seed);
+  beginWrite(env->header);
+  observeReset(env, index);
+  publish(env->header);
+}
+
+void* env_shm_create(const char* name, uint32_t count) {
+#ifdef CHIP8_HAVE_SHM
+  const std::size_t size = env_buffer_size(count);
+  int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+  if (fd < 0) {
+    std::cerr << "Could not create shared memory: " << name << std::endl;
+    return nullptr;
+  }
+  if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    std::cerr << "Could not size shared memory: " << name << std::endl;
+    close(fd);
+    return nullptr;
+  }
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << "Could not map shared memory: " << name << std::endl;
+    return nullptr;
+  }
+  return data;
+#else
+  (void)name;
+  (void)count;
+  std::cerr << "Shared memory is not supported on this platform\n";
+  return nullptr;
+#endif
+}
+
+const void* env_shm_open(const char* name, size_t* size) {
+#ifdef CHIP8_HAVE_SHM
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    std::cerr << "Could not open shared memory: " << name << std::endl;
+    return nullptr;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(EnvHeader)) {
+    std::cerr << "Shared memory is not an observation buffer: " << name << std::endl;
+    close(fd);
+    return nullptr;
+  }
+  *size = static_cast<std::size_t>(info.st_size);
+  void* data = mmap(nullptr, *size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << "Could not map shared memory: " << name << std::endl;
+    return nullptr;
+  }
+  return data;
+#else
+  (void)name;
+  (void)size;
+  std::cerr << "Shared memory is not supported on this platform\n";
+  return nullptr;
+#endif
+}
+
+void env_shm_close(const void* buffer, size_t size) {
+#ifdef CHIP8_HAVE_SHM
+  munmap(const_cast<void*>(buffer), size);
+#else
+  (void)buffer;
+  (void)size;
+#endif
+}
+
+int env_shm_unlink(const char* name) {
+#ifdef CHIP8_HAVE_SHM
+  return shm_unlink(name);
+#else
+  (void)name;
+  return -1;
+#endif
+}
@@ -0,0 +1,115 @@
+#ifndef CHIP8_ENV_H
+#define CHIP8_ENV_H
+
+/*
+ * C interface for driving a batch of Chip8 machines from another program or
+ * language, one env_step() per action. Every step writes its results into a
+ * single contiguous observation buffer owned by the caller: an EnvHeader
+ * followed by one EnvObservation per machine. Nothing is allocated after
+ * env_create(), and the buffer can live in a POSIX shared-memory segment
+ * (env_shm_create) so a client process maps it and reads screens in place.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ENV_MAGIC 0x4E453843u /* "C8EN" read as a little-endian word */
+#define ENV_VERSION 3
+
+typedef struct EnvHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;           /* machines in the batch */
+  uint32_t observationSize; /* sizeof(EnvObservation) */
+  /*
+   * A sequence lock over the observations: odd while a step (or a reset) is
+   * writing them, even once it is done, so it goes up by 2 per step. A client
+   * on the other side of shared memory loads it with acquire ordering, copies
+   * the observations it needs, issues an acquire fence and loads it again.
+   * The copy is only good if both loads gave the same even number; otherwise
+   * it was torn by a step in progress, and the client tries again.
+   */
+  uint64_t step;
+} EnvHeader;
+
+typedef struct EnvObservation {
+  /*
+   * Leftmost pixel in the MSB. At 64x32, row N is word N; at 128x64
+   * (SUPER-CHIP), row N is words 2N and 2N+1, left half first.
+   */
+  uint64_t screen[128];
+  uint64_t cycles;       /* instructions retired since the last reset */
+  uint64_t changedRows;  /* rows redrawn during the step, bit N for row N */
+  uint32_t frames;       /* frames actually run; fewer if the machine stopped */
+  int32_t reward;        /* from the reward hook, 0 without one */
+  uint8_t reason;        /* Chip8::StopReason of the last frame */
+  uint8_t done;          /* faulted or exited; stays set until env_reset() */
+  uint8_t sound;         /* sound timer running at the end of the step */
+  uint8_t hires;         /* screen is 128x64 */
+  uint8_t reserved[4];
+} EnvObservation;
+
+typedef struct Env Env;
+
+/*
+ * Called once per machine at the end of each step to score it, typically by
+ * reading the score a ROM keeps in memory or in a register. memory is the
+ * 4 KB address space, V the 16 registers; both are read-only views.
+ */
+typedef int32_t (*EnvRewardHook)(uint32_t index, const uint8_t* memory, const uint8_t* V, void* user);
+
+/* Bytes needed for the observation buffer of a batch of count machines. */
+size_t env_buffer_size(uint32_t count);
+
+/*
+ * Boots count copies of rom, machine i seeded with seed + i, and ties them to
+ * buffer, which must hold env_buffer_size(count) bytes, be 8-byte aligned and
+ * outlive the batch. Returns NULL if the ROM cannot be loaded.
+ */
+Env* env_create(const char* rom, uint32_t count, uint32_t seed, void* buffer);
+void env_destroy(Env* env);
+
+void env_set_reward_hook(Env* env, EnvRewardHook hook, void* user);
+
+/*
+ * Holds actions[i] on the keypad of machine i (bit K set = key K down) and
+ * runs frames_to_skip frames, ticking the timers once per frame, then fills
+ * in the observations. Machines that are done are left alone. A machine
+ * blocked on FX0A just idles through its frames until an action lets it go.
+ * actions may be NULL to leave every keypad as it is.
+ */
+void env_step(Env* env, const uint16_t* actions, uint32_t frames_to_skip);
+
+/* Puts machine index back to its boot state with a new seed. */
+void env_reset(Env* env, uint32_t index, uint32_t seed);
+
+/*
+ * Streams machine index's screen to any number of viewers on the Unix domain
+ * socket path, updated after every step; watch it with chip8_capture --watch.
+ * Slow viewers miss frames rather than slowing the step down. A NULL path
+ * stops streaming. Returns 0, or -1 if the socket could not be opened (always,
+ * on platforms other than Linux).
+ */
+int env_spectate(Env* env, uint32_t index, const char* path);
+
+/*
+ * POSIX shared memory for the observation buffer. env_shm_create makes (or
+ * truncates) the segment name, sized for count machines; env_shm_open maps an
+ * existing one read-only for a client and reports its size. Both return NULL
+ * on failure. env_shm_close unmaps; the creator unlinks the name with
+ * env_shm_unlink once clients have attached.
+ */
+void* env_shm_create(const char* name, uint32_t count);
+const void* env_shm_open(const char* name, size_t* size);
+void env_shm_close(const void* buffer, size_t size);
+int env_shm_unlink(const char* name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
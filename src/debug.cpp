@@ -0,0 +1,416 @@
+#include "debug.hpp"
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+// What an instruction reads and writes, as far as watchpoints care: registers
+// as one bit each (I as bit REGISTER_I), and memory from I onwards.
+struct Effects {
+  std::uint32_t reads = 0;
+  std::uint32_t writes = 0;
+  unsigned char memory = 0;  // Debugger::Access bits
+  unsigned short length = 0; // bytes from I
+};
+
+Effects effectsOf(unsigned short opcode, Variant variant) {
+  Effects effects;
+  if (!Chip8::isValidOpcode(opcode, variant)) {
+    return effects;
+  }
+
+  const Quirks quirks = quirksOf(variant);
+  const unsigned int x = (opcode & 0x0F00) >> 8;
+  const unsigned int y = (opcode & 0x00F0) >> 4;
+  const unsigned int n = opcode & 0x000F;
+  const std::uint32_t vx = 1u << x;
+  const std::uint32_t vy = 1u << y;
+  const std::uint32_t vf = 1u << 0xF;
+  const std::uint32_t upToX = (2u << x) - 1; // V0 to VX
+  const std::uint32_t i = 1u << Debugger::REGISTER_I;
+
+  auto memory = [&](unsigned char access, unsigned short length) {
+    effects.memory = length ? access : 0;
+    effects.length = length;
+  };
+
+  switch (opcode & 0xF000) {
+    case 0x3000:
+    case 0x4000:
+    case 0xE000:
+      effects.reads = vx;
+      break;
+    case 0x5000:
+    case 0x9000:
+      effects.reads = vx | vy;
+      break;
+    case 0x6000:
+    case 0xC000:
+      effects.writes = vx;
+      break;
+    case 0x7000:
+      effects.reads = vx;
+      effects.writes = vx;
+      break;
+    case 0x8000:
+      switch (n) {
+        case 0x0:
+          effects.reads = vy;
+          effects.writes = vx;
+          break;
+        case 0x1:
+        case 0x2:
+        case 0x3:
+          effects.reads = vx | vy;
+          effects.writes = vx | (quirks.logicResetsVF ? vf : 0);
+          break;
+        case 0x6:
+        case 0xE:
+          effects.reads = quirks.shiftUsesVY ? vy : vx;
+          effects.writes = vx | vf;
+          break;
+        default: // 8XY4, 8XY5, 8XY7
+          effects.reads = vx | vy;
+          effects.writes = vx | vf;
+      }
+      break;
+    case 0xA000:
+      effects.writes = i;
+      break;
+    case 0xB000:
+      effects.reads = quirks.jumpUsesVX ? vx : 1;
+      break;
+    case 0xD000:
+      effects.reads = vx | vy | i;
+      effects.writes = vf;
+      memory(Debugger::Read, n ? n : (quirks.superChip ? 32 : 0));
+      break;
+    case 0xF000:
+      switch (opcode & 0x00FF) {
+        case 0x07:
+        case 0x0A:
+          effects.writes = vx;
+          break;
+        case 0x15:
+        case 0x18:
+        case 0x3A:
+          effects.reads = vx;
+          break;
+        case 0x1E:
+          effects.reads = vx | i;
+          effects.writes = i;
+          break;
+        case 0x29:
+        case 0x30:
+          effects.reads = vx;
+          effects.writes = i;
+          break;
+        case 0x33:
+          effects.reads = vx | i;
+          memory(Debugger::Write, 3);
+          break;
+        case 0x55:
+          effects.reads = upToX | i;
+          effects.writes = quirks.loadStoreMovesI ? i : 0;
+          memory(Debugger::Write, static_cast<unsigned short>(x + 1));
+          break;
+        case 0x65:
+          effects.reads = i;
+          effects.writes = upToX | (quirks.loadStoreMovesI ? i : 0);
+          memory(Debugger::Read, static_cast<unsigned short>(x + 1));
+          break;
+        case 0x75:
+          effects.reads = upToX;
+          break;
+        case 0x85:
+          effects.writes = upToX;
+          break;
+        case 0x02: // F002
+          effects.reads = i;
+          memory(Debugger::Read, 16);
+          break;
+      }
+      break;
+  }
+  return effects;
+}
+
+// Whether size bytes from address touch the watched range. Accesses through I
+// wrap at 4K, as they do in the core.
+bool overlaps(unsigned short first, unsigned short length, unsigned short address, unsigned short size) {
+  for (unsigned short offset = 0; offset < size; offset++) {
+    const unsigned short byte = (address + offset) & 0x0FFF;
+    if (byte >= first && byte - first < length) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string registerName(unsigned int reg) {
+  char name[4];
+  if (reg == Debugger::REGISTER_I) {
+    return "I";
+  }
+  std::snprintf(name, sizeof(name), "V%X", reg & 0xF);
+  return name;
+}
+
+std::string conditionText(const Debugger::Condition& condition) {
+  using Compare = Debugger::Condition::Compare;
+  const char* op = "";
+  switch (condition.compare) {
+    case Compare::Always: return "";
+    case Compare::Equal: op = "=="; break;
+    case Compare::NotEqual: op = "!="; break;
+    case Compare::Less: op = "<"; break;
+    case Compare::LessEqual: op = "<="; break;
+    case Compare::Greater: op = ">"; break;
+    case Compare::GreaterEqual: op = ">="; break;
+  }
+  char text[32];
+  std::snprintf(text, sizeof(text), " if %s %s 0x%X", registerName(condition.reg).c_str(), op, condition.value);
+  return text;
+}
+
+const char* accessName(unsigned char access) {
+  switch (access) {
+    case Debugger::Read: return "read";
+    case Debugger::Write: return "write";
+    default: return "read/write";
+  }
+}
+
+} // namespace
+
+bool Debugger::Condition::holds(const Chip8::State& state) const {
+  const unsigned int current = reg == REGISTER_I ? state.I : state.V[reg & 0xF];
+  switch (compare) {
+    case Compare::Equal: return current == value;
+    case Compare::NotEqual: return current != value;
+    case Compare::Less: return current < value;
+    case Compare::LessEqual: return current <= value;
+    case Compare::Greater: return current > value;
+    case Compare::GreaterEqual: return current >= value;
+    case Compare::Always:
+    default: return true;
+  }
+}
+
+Debugger::Debugger(Chip8& chip8)
+  : chip8(chip8), nextId(1), watchedReads(0), watchedWrites(0), watchedMemory(0), stepping(false), hit(),
+    resuming(false), stoppedAt(0), changed(false) {
+  arm();
+}
+
+Debugger::~Debugger() {
+  chip8.setDebugger(nullptr);
+}
+
+void Debugger::arm() {
+  breakAt.reset();
+  watchedReads = 0;
+  watchedWrites = 0;
+  watchedMemory = 0;
+  for (const Entry& entry : entries) {
+    switch (entry.kind) {
+      case Kind::Breakpoint:
+        breakAt[entry.first] = true;
+        break;
+      case Kind::Register:
+        if (entry.access & Read) {
+          watchedReads |= 1u << entry.first;
+        }
+        if (entry.access & Write) {
+          watchedWrites |= 1u << entry.first;
+        }
+        break;
+      case Kind::Memory:
+        watchedMemory |= entry.access;
+        break;
+    }
+  }
+  // Armed between runs, so a machine that has moved on since it stopped has
+  // nothing left to get past.
+  if ((chip8.getState().pc & 0x0FFF) != stoppedAt) {
+    resuming = false;
+  }
+  changed = false;
+  chip8.setDebugger(this);
+}
+
+int Debugger::add(Entry entry) {
+  if (entry.depth < 0) {
+    entry.id = nextId++;
+  }
+  entries.push_back(entry);
+  arm();
+  return entry.id;
+}
+
+int Debugger::addBreakpoint(unsigned short address, const Condition& condition) {
+  return add({ 0, Kind::Breakpoint, static_cast<unsigned short>(address & 0x0FFF), 1, ReadWrite, condition, -1 });
+}
+
+int Debugger::watchMemory(unsigned short first, unsigned short length, Access access, const Condition& condition) {
+  return add({ 0, Kind::Memory, static_cast<unsigned short>(first & 0x0FFF), length, access, condition, -1 });
+}
+
+int Debugger::watchRegister(unsigned char reg, Access access, const Condition& condition) {
+  if (reg > REGISTER_I) {
+    return 0;
+  }
+  return add({ 0, Kind::Register, reg, 1, access, condition, -1 });
+}
+
+bool Debugger::remove(int id) {
+  auto found = std::find_if(entries.begin(), entries.end(), [id](const Entry& entry) {
+    return entry.id == id && entry.depth < 0;
+  });
+  if (found == entries.end()) {
+    return false;
+  }
+  entries.erase(found);
+  arm();
+  return true;
+}
+
+void Debugger::clear() {
+  entries.clear();
+  stepping = false;
+  arm();
+}
+
+void Debugger::step() {
+  // The instruction at pc runs first, whether or not the machine stopped
+  // there, and the run stops at the one after it.
+  stepping = true;
+  resuming = true;
+  stoppedAt = chip8.getState().pc & 0x0FFF;
+  arm();
+}
+
+void Debugger::stepOver() {
+  const Chip8::State& state = chip8.getState();
+  const unsigned short pc = state.pc & 0x0FFF;
+  if (state.memory[pc] >> 4 != 0x2) {
+    step();
+    return;
+  }
+  // Calls can nest arbitrarily before returning here, so the temporary
+  // breakpoint only counts once the stack is back to where it is now.
+  add({ 0, Kind::Breakpoint, static_cast<unsigned short>((pc + 2) & 0x0FFF), 1, ReadWrite, {}, state.sp });
+}
+
+bool Debugger::stepOut() {
+  const Chip8::State& state = chip8.getState();
+  if (state.sp == 0) {
+    return false;
+  }
+  const unsigned short caller = state.stack[state.sp - 1];
+  add({ 0, Kind::Breakpoint, static_cast<unsigned short>((caller + 2) & 0x0FFF), 1, ReadWrite, {},
+    state.sp - 1 });
+  return true;
+}
+
+std::vector<std::string> Debugger::describe() const {
+  std::vector<std::string> lines;
+  for (const Entry& entry : entries) {
+    if (entry.depth >= 0) {
+      continue;
+    }
+    char text[64];
+    switch (entry.kind) {
+      case Kind::Breakpoint:
+        std::snprintf(text, sizeof(text), "%d: break at 0x%03X", entry.id, entry.first);
+        break;
+      case Kind::Memory:
+        std::snprintf(text, sizeof(text), "%d: watch %s 0x%03X-0x%03X", entry.id, accessName(entry.access),
+          entry.first, (entry.first + entry.length - 1) & 0x0FFF);
+        break;
+      case Kind::Register:
+        std::snprintf(text, sizeof(text), "%d: watch %s %s", entry.id, accessName(entry.access),
+          registerName(entry.first).c_str());
+        break;
+    }
+    lines.push_back(text + conditionText(entry.condition));
+  }
+  return lines;
+}
+
+bool Debugger::traps(unsigned short address, unsigned short opcode) const {
+  if (stepping || breakAt[address & 0x0FFF]) {
+    return true;
+  }
+  if (!watchedReads && !watchedWrites && !watchedMemory) {
+    return false;
+  }
+  const Effects effects = effectsOf(opcode, chip8.getVariant());
+  return (effects.reads & watchedReads) || (effects.writes & watchedWrites) || (effects.memory & watchedMemory);
+}
+
+bool Debugger::check(unsigned short opcode) {
+  const Chip8::State& state = chip8.getState();
+  const unsigned short pc = state.pc & 0x0FFF;
+  if (resuming) {
+    resuming = false;
+    if (pc == stoppedAt) {
+      return false;
+    }
+  }
+  if (stepping) {
+    stop(HitKind::Step, 0, ReadWrite, pc, 0);
+    return true;
+  }
+
+  const Effects effects = effectsOf(opcode, state.variant);
+  for (const Entry& entry : entries) {
+    if (!entry.condition.holds(state)) {
+      continue;
+    }
+    switch (entry.kind) {
+      case Kind::Breakpoint:
+        if (entry.first == pc && (entry.depth < 0 || entry.depth == state.sp)) {
+          stop(entry.depth < 0 ? HitKind::Breakpoint : HitKind::Step, entry.id, ReadWrite, pc, 0);
+          return true;
+        }
+        break;
+      case Kind::Register: {
+        const std::uint32_t bit = 1u << entry.first;
+        const unsigned int access = entry.access & ((effects.reads & bit ? Read : 0) | (effects.writes & bit ? Write : 0));
+        if (access) {
+          stop(HitKind::Watchpoint, entry.id, static_cast<Access>(access), entry.first, 1);
+          return true;
+        }
+        break;
+      }
+      case Kind::Memory: {
+        const unsigned int access = entry.access & effects.memory;
+        if (access && overlaps(entry.first, entry.length, state.I, effects.length)) {
+          stop(HitKind::Watchpoint, entry.id, static_cast<Access>(access), state.I & 0x0FFF, effects.length);
+          return true;
+        }
+        break;
+      }
+    }
+  }
+  return false;
+}
+
+void Debugger::stop(HitKind kind, int id, Access access, unsigned short first, unsigned short length) {
+  const unsigned short pc = chip8.getState().pc & 0x0FFF;
+  hit = { kind, id, pc, access, first, length };
+  resuming = true;
+  stoppedAt = pc;
+
+  // Whatever fired, a step in progress is over. Re-arming drops decoded code,
+  // which must not happen under the handler calling this, so leave it to the
+  // next run.
+  const std::size_t before = entries.size();
+  entries.erase(std::remove_if(entries.begin(), entries.end(), [](const Entry& entry) { return entry.depth >= 0; }),
+    entries.end());
+  if (stepping || entries.size() != before) {
+    stepping = false;
+    changed = true;
+  }
+}
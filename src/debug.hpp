@@ -0,0 +1,138 @@
+#ifndef DEBUG_HPP
+#define DEBUG_HPP
+
+#include "chip8.hpp"
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Breakpoints, watchpoints and stepping for one machine.
+//
+// Nothing here costs anything per instruction unless it can fire there. The
+// machine asks the debugger, once per address as it decodes, whether the
+// instruction could trip anything: a breakpoint on its address, a watched
+// register it reads or writes, memory at all when memory is watched, or
+// anything while stepping. Only those addresses get their dispatch entry
+// swapped for one that consults the debugger before running the instruction;
+// translated and compiled blocks stop short of them. With nothing armed, every
+// address decodes and translates exactly as without a debugger.
+//
+// When something fires, the run returns StopReason::Breakpoint with pc on the
+// instruction, which has not run; getHit() says why. The next run carries on
+// from there, running that instruction first without stopping on it again.
+// Watchpoints fire before the access, so the old value can still be seen.
+class Debugger {
+public:
+  // Registers a watchpoint or condition can name: V0 to VF are 0 to 15.
+  static constexpr unsigned char REGISTER_I = 16;
+
+  enum Access : unsigned char {
+    Read = 1,
+    Write = 2,
+    ReadWrite = 3,
+  };
+
+  // Compares a register with a value; a breakpoint or watchpoint with a
+  // condition only fires while it holds. A zeroed one always holds.
+  struct Condition {
+    enum class Compare : unsigned char { Always, Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual };
+    Compare compare;
+    unsigned char reg; // V0-VF, or REGISTER_I
+    unsigned short value;
+
+    bool holds(const Chip8::State& state) const;
+  };
+
+  enum class HitKind { Breakpoint, Watchpoint, Step };
+
+  struct Hit {
+    HitKind kind;
+    int id;               // of the breakpoint or watchpoint; 0 for a step
+    unsigned short pc;
+    Access access;        // watchpoints: what the instruction was about to do
+    unsigned short first; // and to which memory, or register
+    unsigned short length;
+  };
+
+  // Attaches to chip8 for the debugger's lifetime.
+  explicit Debugger(Chip8& chip8);
+  ~Debugger();
+
+  Debugger(const Debugger&) = delete;
+  Debugger& operator=(const Debugger&) = delete;
+
+  // Each returns an id for remove(), counting up from 1.
+  int addBreakpoint(unsigned short address, const Condition& condition = {});
+  // Memory from first to first + length - 1, as accessed through I by DXYN,
+  // FX33, FX55, FX65 and F002.
+  int watchMemory(unsigned short first, unsigned short length, Access access, const Condition& condition = {});
+  // Returns 0 for a register that does not exist.
+  int watchRegister(unsigned char reg, Access access, const Condition& condition = {});
+  // Returns false if there is no such breakpoint or watchpoint.
+  bool remove(int id);
+  void clear();
+
+  // Where the next run stops instead of at the next breakpoint: after one
+  // instruction; after one, or once it returns if it is a 2NNN; once the
+  // current subroutine returns to its caller. Breakpoints and watchpoints
+  // still fire on the way, and cancel the step. stepOut returns false at the
+  // top level, where there is nothing to return from.
+  void step();
+  void stepOver();
+  bool stepOut();
+
+  const Hit& getHit() const { return hit; }
+
+  // One line per breakpoint and watchpoint, for listings.
+  std::vector<std::string> describe() const;
+
+  // For the core: whether the instruction at address could fire anything, and
+  // whether it does now that the machine is about to run it.
+  bool traps(unsigned short address, unsigned short opcode) const;
+  bool check(unsigned short opcode);
+  // For the core: re-applies changes made while the machine was running.
+  void sync() {
+    if (changed) {
+      arm();
+    }
+  }
+
+private:
+  enum class Kind { Breakpoint, Memory, Register };
+
+  struct Entry {
+    int id;
+    Kind kind;
+    unsigned short first; // address, or register
+    unsigned short length;
+    Access access;
+    Condition condition;
+    // Temporary breakpoints set by stepOver/stepOut: only fire at this stack
+    // depth, and go away when anything fires. -1 for everything else.
+    int depth;
+  };
+
+  Chip8& chip8;
+  std::vector<Entry> entries;
+  int nextId;
+
+  // What traps() looks at, gathered from entries by arm().
+  std::bitset<4096> breakAt;
+  std::uint32_t watchedReads;  // bit N for register N
+  std::uint32_t watchedWrites;
+  unsigned char watchedMemory; // Access bits
+  bool stepping;
+
+  Hit hit;
+  // Set when a run stopped at pc stoppedAt, so the next run can get past it.
+  bool resuming;
+  unsigned short stoppedAt;
+  bool changed;
+
+  void arm();
+  int add(Entry entry);
+  void stop(HitKind kind, int id, Access access, unsigned short first, unsigned short length);
+};
+
+#endif
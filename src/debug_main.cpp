@@ -0,0 +1,359 @@
+#include "debug.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Debugs a ROM from the terminal, gdb style, reading commands from stdin so a
+// session can also be scripted. Runs go a 60 Hz frame at a time, timers
+// included, with no input but the keys set with "keys". Numbers are hex.
+//
+//   break ADDR [if COND]                 stop before running ADDR
+//   watch ADDR[:LEN] | VX | I [r|w|rw]   stop before an access (default w)
+//         [if COND]
+//   delete ID   list
+//   continue [FRAMES]   step   next   finish
+//   regs   mem ADDR [LEN]   disas [ADDR [COUNT]]   keys MASK   quit
+//
+// COND compares a register with a value, e.g. "V3 == 10" or "I >= 300".
+// --disassemble lists the whole ROM instead.
+//
+// Usage: chip8_debug [--variant NAME] [--seed S] [--disassemble] <rom>
+
+namespace {
+
+// A minute of play: how far "continue" runs without hitting anything.
+constexpr unsigned long DEFAULT_FRAMES = 60 * 60;
+
+bool parseNumber(const std::string& text, unsigned long& value) {
+  if (text.empty()) {
+    return false;
+  }
+  char* end;
+  value = std::strtoul(text.c_str(), &end, 16);
+  return *end == '\0';
+}
+
+// V0-VF, or I as Debugger::REGISTER_I.
+bool parseRegister(const std::string& text, unsigned char& reg) {
+  if (text == "I" || text == "i") {
+    reg = Debugger::REGISTER_I;
+    return true;
+  }
+  unsigned long index;
+  if (text.size() == 2 && (text[0] == 'V' || text[0] == 'v') && parseNumber(text.substr(1), index)) {
+    reg = static_cast<unsigned char>(index);
+    return true;
+  }
+  return false;
+}
+
+// "if REG OP VALUE" at the end of a command, if there is one.
+bool parseCondition(std::istringstream& words, Debugger::Condition& condition) {
+  using Compare = Debugger::Condition::Compare;
+  std::string keyword;
+  if (!(words >> keyword)) {
+    return true;
+  }
+  std::string reg;
+  std::string op;
+  std::string value;
+  unsigned long number;
+  if (keyword != "if" || !(words >> reg >> op >> value) || !parseRegister(reg, condition.reg) ||
+      !parseNumber(value, number)) {
+    return false;
+  }
+  condition.value = static_cast<unsigned short>(number);
+  if (op == "==") {
+    condition.compare = Compare::Equal;
+  } else if (op == "!=") {
+    condition.compare = Compare::NotEqual;
+  } else if (op == "<") {
+    condition.compare = Compare::Less;
+  } else if (op == "<=") {
+    condition.compare = Compare::LessEqual;
+  } else if (op == ">") {
+    condition.compare = Compare::Greater;
+  } else if (op == ">=") {
+    condition.compare = Compare::GreaterEqual;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+unsigned short opcodeAt(const Chip8::State& state, unsigned short address) {
+  return state.memory[address & 0x0FFF] << 8 | state.memory[(address + 1) & 0x0FFF];
+}
+
+void printInstruction(const Chip8::State& state, unsigned short address) {
+  const unsigned short opcode = opcodeAt(state, address);
+  std::printf("%c %03X  %04X  %s\n", address == state.pc ? '>' : ' ', address & 0x0FFF, opcode,
+    Chip8::disassemble(opcode, state.variant).c_str());
+}
+
+void printRegisters(const Chip8::State& state) {
+  for (int i = 0; i < 16; i++) {
+    std::printf("V%X=%02X%c", i, state.V[i], i == 7 || i == 15 ? '\n' : ' ');
+  }
+  std::printf("I=%03X PC=%03X SP=%X DT=%02X ST=%02X cycles=%llu\n", state.I, state.pc, state.sp,
+    state.delay_timer, state.sound_timer, static_cast<unsigned long long>(state.cycles));
+  if (state.sp > 0) {
+    std::printf("stack:");
+    for (unsigned short i = 0; i < state.sp && i < 16; i++) {
+      std::printf(" %03X", state.stack[i]);
+    }
+    std::printf("\n");
+  }
+}
+
+void printHit(const Debugger::Hit& hit) {
+  switch (hit.kind) {
+    case Debugger::HitKind::Breakpoint:
+      std::printf("Breakpoint %d\n", hit.id);
+      break;
+    case Debugger::HitKind::Watchpoint: {
+      const char* access = hit.access == Debugger::Read ? "read" : hit.access == Debugger::Write ? "write" : "read/write";
+      if (hit.length == 1 && hit.first <= Debugger::REGISTER_I) {
+        if (hit.first == Debugger::REGISTER_I) {
+          std::printf("Watchpoint %d: %s I\n", hit.id, access);
+        } else {
+          std::printf("Watchpoint %d: %s V%X\n", hit.id, access, hit.first);
+        }
+      } else {
+        std::printf("Watchpoint %d: %s 0x%03X-0x%03X\n", hit.id, access, hit.first,
+          (hit.first + hit.length - 1) & 0x0FFF);
+      }
+      break;
+    }
+    case Debugger::HitKind::Step:
+      break;
+  }
+}
+
+// Runs whole frames until the debugger stops the machine, it faults, or the
+// frames run out.
+void run(Chip8& chip8, Debugger& debugger, unsigned long frames) {
+  for (unsigned long frame = 0; frame < frames; frame++) {
+    const Chip8::RunResult result = chip8.runFrame();
+    switch (result.reason) {
+      case Chip8::StopReason::Breakpoint:
+        printHit(debugger.getHit());
+        printInstruction(chip8.getState(), chip8.getState().pc);
+        return;
+      case Chip8::StopReason::IllegalOpcode:
+        std::printf("Illegal opcode\n");
+        printInstruction(chip8.getState(), chip8.getState().pc);
+        return;
+      case Chip8::StopReason::StackOverflow:
+        std::printf("Stack overflow\n");
+        return;
+      case Chip8::StopReason::StackUnderflow:
+        std::printf("Stack underflow\n");
+        return;
+      case Chip8::StopReason::Exited:
+        std::printf("Exited\n");
+        return;
+      default:
+        break;
+    }
+  }
+  std::printf("Ran %lu frames\n", frames);
+  printInstruction(chip8.getState(), chip8.getState().pc);
+}
+
+void usage(const char* program) {
+  std::cerr << "Usage: " << program << " [--variant NAME] [--seed S] [--disassemble] <rom>\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const char* rom = nullptr;
+  const char* variantName = nullptr;
+  std::uint32_t seed = 1;
+  bool listing = false;
+  for (int i = 1; i < argc; i++) {
+    const bool hasValue = i + 1 < argc;
+    if (std::strcmp(argv[i], "--variant") == 0 && hasValue) {
+      variantName = argv[++i];
+    } else if (std::strcmp(argv[i], "--seed") == 0 && hasValue) {
+      seed = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(argv[i], "--disassemble") == 0) {
+      listing = true;
+    } else if (argv[i][0] == '-' || rom) {
+      usage(argv[0]);
+      return 1;
+    } else {
+      rom = argv[i];
+    }
+  }
+  if (!rom) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  Chip8 chip8{ rom };
+  chip8.seed(seed);
+  if (variantName) {
+    Variant variant;
+    if (!parseVariant(variantName, variant)) {
+      std::cerr << "Unknown variant: " << variantName << std::endl;
+      return 1;
+    }
+    chip8.setVariant(variant);
+  }
+
+  if (listing) {
+    // The boot image has the ROM at 0x200 and nothing after it.
+    const Chip8::State& state = chip8.getState();
+    unsigned short end = sizeof(state.memory);
+    while (end > 0x200 && state.memory[end - 1] == 0) {
+      end--;
+    }
+    for (unsigned short address = 0x200; address < end; address += 2) {
+      printInstruction(state, address);
+    }
+    return 0;
+  }
+
+  Debugger debugger{ chip8 };
+  std::string line;
+  while (std::printf("(chip8) "), std::fflush(stdout), std::getline(std::cin, line)) {
+    std::istringstream words{ line };
+    std::string command;
+    if (!(words >> command)) {
+      continue;
+    }
+    const Chip8::State& state = chip8.getState();
+
+    if (command == "break" || command == "b") {
+      std::string where;
+      unsigned long address;
+      Debugger::Condition condition = {};
+      if (!(words >> where) || !parseNumber(where, address) || !parseCondition(words, condition)) {
+        std::printf("Usage: break ADDR [if REG OP VALUE]\n");
+        continue;
+      }
+      std::printf("Breakpoint %d at 0x%03lX\n", debugger.addBreakpoint(static_cast<unsigned short>(address), condition),
+        address & 0x0FFF);
+    } else if (command == "watch" || command == "w") {
+      std::string what;
+      std::string mode = "w";
+      Debugger::Condition condition = {};
+      if (!(words >> what)) {
+        std::printf("Usage: watch ADDR[:LEN] | VX | I [r|w|rw] [if REG OP VALUE]\n");
+        continue;
+      }
+      // The mode is optional, and the condition starts with "if".
+      std::streampos rest = words.tellg();
+      std::string next;
+      if (words >> next && next != "if") {
+        mode = next;
+      } else {
+        words.clear();
+        words.seekg(rest);
+      }
+      const Debugger::Access access = mode == "r" ? Debugger::Read : mode == "rw" ? Debugger::ReadWrite : Debugger::Write;
+      unsigned char reg;
+      int id = 0;
+      if (!parseCondition(words, condition) || (mode != "r" && mode != "w" && mode != "rw")) {
+        id = 0;
+      } else if (parseRegister(what, reg)) {
+        id = debugger.watchRegister(reg, access, condition);
+      } else {
+        const std::size_t colon = what.find(':');
+        unsigned long address;
+        unsigned long length = 1;
+        if (parseNumber(what.substr(0, colon), address) &&
+            (colon == std::string::npos || parseNumber(what.substr(colon + 1), length)) && length > 0) {
+          id = debugger.watchMemory(static_cast<unsigned short>(address), static_cast<unsigned short>(length), access,
+            condition);
+        }
+      }
+      if (id == 0) {
+        std::printf("Usage: watch ADDR[:LEN] | VX | I [r|w|rw] [if REG OP VALUE]\n");
+        continue;
+      }
+      std::printf("Watchpoint %d\n", id);
+    } else if (command == "delete" || command == "d") {
+      int id;
+      if (!(words >> id) || !debugger.remove(id)) {
+        std::printf("No breakpoint or watchpoint with that number\n");
+      }
+    } else if (command == "list" || command == "l") {
+      for (const std::string& entry : debugger.describe()) {
+        std::printf("%s\n", entry.c_str());
+      }
+    } else if (command == "continue" || command == "c") {
+      std::string count;
+      unsigned long frames = DEFAULT_FRAMES;
+      if (words >> count && !parseNumber(count, frames)) {
+        std::printf("Usage: continue [FRAMES]\n");
+        continue;
+      }
+      run(chip8, debugger, frames);
+    } else if (command == "step" || command == "s") {
+      debugger.step();
+      run(chip8, debugger, DEFAULT_FRAMES);
+    } else if (command == "next" || command == "n") {
+      debugger.stepOver();
+      run(chip8, debugger, DEFAULT_FRAMES);
+    } else if (command == "finish" || command == "f") {
+      if (!debugger.stepOut()) {
+        std::printf("Not in a subroutine\n");
+        continue;
+      }
+      run(chip8, debugger, DEFAULT_FRAMES);
+    } else if (command == "regs" || command == "r") {
+      printRegisters(state);
+    } else if (command == "mem" || command == "x") {
+      std::string from;
+      std::string size = "10";
+      unsigned long address;
+      unsigned long length;
+      words >> from >> size;
+      if (!parseNumber(from, address) || !parseNumber(size, length)) {
+        std::printf("Usage: mem ADDR [LEN]\n");
+        continue;
+      }
+      for (unsigned long offset = 0; offset < length; offset++) {
+        if (offset % 16 == 0) {
+          std::printf(offset ? "\n%03lX:" : "%03lX:", (address + offset) & 0x0FFF);
+        }
+        std::printf(" %02X", state.memory[(address + offset) & 0x0FFF]);
+      }
+      std::printf("\n");
+    } else if (command == "disas" || command == "u") {
+      std::string from;
+      std::string size = "A";
+      unsigned long address = state.pc;
+      unsigned long count;
+      if (words >> from) {
+        words >> size;
+      }
+      if ((!from.empty() && !parseNumber(from, address)) || !parseNumber(size, count)) {
+        std::printf("Usage: disas [ADDR [COUNT]]\n");
+        continue;
+      }
+      for (unsigned long i = 0; i < count; i++) {
+        printInstruction(state, static_cast<unsigned short>(address + 2 * i));
+      }
+    } else if (command == "keys" || command == "k") {
+      std::string mask;
+      unsigned long keys;
+      if (!(words >> mask) || !parseNumber(mask, keys)) {
+        std::printf("Usage: keys MASK\n");
+        continue;
+      }
+      chip8.setKeys(static_cast<std::uint16_t>(keys));
+    } else if (command == "quit" || command == "q") {
+      break;
+    } else {
+      std::printf("Unknown command: %s\n", command.c_str());
+    }
+  }
+  return 0;
+}
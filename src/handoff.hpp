@@ -0,0 +1,88 @@
+#ifndef HANDOFF_HPP
+#define HANDOFF_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Lock-free pieces for passing data between exactly two threads, a producer
+// and a consumer, without either ever waiting on the other.
+
+// Three copies of T: one the producer is filling, one the consumer is reading,
+// and one in between holding the newest finished value. publish() and
+// acquire() each swap their own copy with the middle one, so the producer
+// never blocks and the consumer always gets the latest value, skipping any it
+// was too slow to see.
+template <typename T>
+class TripleBuffer {
+public:
+  // The copy only the producer touches until the next publish().
+  T& back() { return slots[backIndex]; }
+
+  void publish() {
+    backIndex = middle.exchange(static_cast<std::uint8_t>(backIndex | FRESH), std::memory_order_acq_rel) & INDEX;
+  }
+
+  // Swaps in the newest published value, if there is one the consumer has not
+  // seen; returns whether front() changed.
+  bool acquire() {
+    if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+      return false;
+    }
+    frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+
+  // The copy only the consumer touches until the next acquire().
+  const T& front() const { return slots[frontIndex]; }
+
+private:
+  static constexpr std::uint8_t INDEX = 3;
+  static constexpr std::uint8_t FRESH = 4;
+
+  T slots[3] = {};
+  std::uint8_t backIndex = 0;
+  std::uint8_t frontIndex = 1;
+  // Index of the middle copy, with FRESH set while it holds a value the
+  // consumer has not taken yet.
+  std::atomic<std::uint8_t> middle{ 2 };
+};
+
+// Bounded ring of Capacity entries for one producer and one consumer.
+// Capacity must be a power of two.
+template <typename T, std::size_t Capacity>
+class SpscQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+  // Returns false, dropping value, if the queue is full.
+  bool push(const T& value) {
+    const std::size_t tail = tailIndex.load(std::memory_order_relaxed);
+    if (tail - headIndex.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+    entries[tail & (Capacity - 1)] = value;
+    tailIndex.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // The oldest entry, or nullptr if the queue is empty. It stays valid until
+  // pop().
+  const T* peek() const {
+    const std::size_t head = headIndex.load(std::memory_order_relaxed);
+    if (head == tailIndex.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &entries[head & (Capacity - 1)];
+  }
+
+  void pop() { headIndex.store(headIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+  T entries[Capacity] = {};
+  // Apart so the two threads do not fight over one cache line.
+  alignas(64) std::atomic<std::size_t> headIndex{ 0 };
+  alignas(64) std::atomic<std::size_t> tailIndex{ 0 };
+};
+
+#endif
@@ -0,0 +1,839 @@
+#include "lockstep.hpp"
+#include "bits.hpp"
+#include "rom_cache.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <memory>
+
+namespace {
+
+constexpr std::uint8_t RUNNING = static_cast<std::uint8_t>(Chip8::StopReason::CyclesDone);
+
+// After this many steps without every running lane in one group, give up on
+// lockstep for good if the groups average under 1/4 of the running lanes:
+// finding each group costs a pass over all of them.
+constexpr std::size_t DIVERGED_STEPS = 256;
+
+// dst = f(a, b) in the lanes selected by mask, one row of a block. The rows are
+// copied in first, so they may alias each other and the loop still vectorises.
+template <std::size_t N, class F>
+void apply(std::uint8_t* dst, const std::uint8_t* a, const std::uint8_t* b, const std::uint8_t* mask, F f) {
+  std::uint8_t x[N], y[N], d[N], m[N];
+  std::memcpy(x, a, N);
+  std::memcpy(y, b, N);
+  std::memcpy(d, dst, N);
+  std::memcpy(m, mask, N);
+  for (std::size_t j = 0; j < N; j++) {
+    d[j] = m[j] ? static_cast<std::uint8_t>(f(x[j], y[j])) : d[j];
+  }
+  std::memcpy(dst, d, N);
+}
+
+} // namespace
+
+LockstepBatch::LockstepBatch(const char* filename, std::size_t lanes)
+  : laneCount(lanes),
+    splitSteps(0),
+    splitLanes(0),
+    diverged(false),
+    blocks((lanes + BLOCK - 1) / BLOCK),
+    memory(lanes),
+    gfx(lanes) {
+  // Copy the boot image Chip8 starts from into every lane, so the ROM, the
+  // font and the initial registers are exactly the same.
+  std::shared_ptr<const RomImage> rom = RomCache::shared().load(filename);
+  if (!rom) {
+    rom = RomCache::shared().add(nullptr, 0);
+  }
+  const Chip8::State& state = rom->boot;
+
+  for (std::size_t lane = 0; lane < blocks.size() * BLOCK; lane++) {
+    Lanes& L = blocks[lane / BLOCK];
+    const std::size_t j = lane % BLOCK;
+    L.status[j] = RUNNING;
+    if (lane >= laneCount) {
+      L.frozen[j] = 1; // padding up to a whole block
+      continue;
+    }
+
+    for (int r = 0; r < 16; r++) {
+      L.V[r][j] = state.V[r];
+      L.stack[r][j] = state.stack[r];
+      L.key[r][j] = state.key[r];
+    }
+    L.I[j] = state.I;
+    L.pc[j] = state.pc;
+    L.sp[j] = static_cast<std::uint8_t>(state.sp);
+    L.delay_timer[j] = state.delay_timer;
+    L.sound_timer[j] = state.sound_timer;
+    L.rng[j] = state.rng;
+    L.cycles[j] = state.cycles;
+    std::memcpy(memory[lane].data(), state.memory, sizeof(state.memory));
+    gfx[lane] = state.gfx;
+  }
+
+  for (unsigned short address = 0; address < 4096; address++) {
+    decoded[address] = decode(state.memory[address] << 8 | state.memory[(address + 1) & 0x0FFF]);
+  }
+}
+
+bool LockstepBatch::supports(const char* filename) {
+  std::shared_ptr<const RomImage> rom = RomCache::shared().load(filename);
+  // A ROM that cannot be loaded boots an empty machine, which is fine.
+  return !rom || rom->boot.variant == Variant::Chip8;
+}
+
+void LockstepBatch::seed(std::size_t lane, std::uint32_t seed) {
+  blocks[lane / BLOCK].rng[lane % BLOCK] = randomSeed(seed);
+}
+
+void LockstepBatch::pressKeys(std::size_t lane, unsigned char key) {
+  if (key < 16) {
+    blocks[lane / BLOCK].key[key][lane % BLOCK] = 1;
+  }
+}
+
+void LockstepBatch::releaseKeys(std::size_t lane, unsigned char key) {
+  if (key < 16) {
+    blocks[lane / BLOCK].key[key][lane % BLOCK] = 0;
+  }
+}
+
+void LockstepBatch::freeze(std::size_t lane) {
+  blocks[lane / BLOCK].frozen[lane % BLOCK] = 1;
+}
+
+void LockstepBatch::saveState(std::size_t lane, Chip8::State& snapshot) const {
+  const Lanes& L = blocks[lane / BLOCK];
+  const std::size_t j = lane % BLOCK;
+
+  std::memcpy(snapshot.memory, memory[lane].data(), sizeof(snapshot.memory));
+  for (int r = 0; r < 16; r++) {
+    snapshot.V[r] = L.V[r][j];
+    snapshot.stack[r] = L.stack[r][j];
+    snapshot.key[r] = L.key[r][j];
+  }
+  snapshot.I = L.I[j];
+  snapshot.pc = L.pc[j];
+  snapshot.gfx = gfx[lane];
+  snapshot.hires = false;
+  snapshot.delay_timer = L.delay_timer[j];
+  snapshot.sound_timer = L.sound_timer[j];
+  snapshot.sp = L.sp[j];
+  snapshot.rng = L.rng[j];
+  snapshot.cycles = L.cycles[j];
+  std::memset(snapshot.flags, 0, sizeof(snapshot.flags));
+  snapshot.variant = Variant::Chip8;
+  std::memcpy(snapshot.audioPattern, Chip8::DEFAULT_AUDIO_PATTERN, sizeof(snapshot.audioPattern));
+  snapshot.pitch = Chip8::DEFAULT_PITCH;
+}
+
+Chip8::RunResult LockstepBatch::result(std::size_t lane) const {
+  const Lanes& L = blocks[lane / BLOCK];
+  const std::size_t j = lane % BLOCK;
+  return { static_cast<Chip8::StopReason>(L.status[j]), L.retired[j] };
+}
+
+void LockstepBatch::tickTimers(unsigned int ticks) {
+  for (Lanes& L : blocks) {
+    for (std::size_t j = 0; j < BLOCK; j++) {
+      const unsigned int delay = L.delay_timer[j];
+      const unsigned int sound = L.sound_timer[j];
+      const bool frozen = L.frozen[j] != 0;
+      L.delay_timer[j] = frozen ? delay : delay > ticks ? delay - ticks : 0;
+      L.sound_timer[j] = frozen ? sound : sound > ticks ? sound - ticks : 0;
+    }
+  }
+}
+
+void LockstepBatch::runCycles(unsigned int count) {
+  for (Lanes& L : blocks) {
+    for (std::size_t j = 0; j < BLOCK; j++) {
+      L.remaining[j] = L.frozen[j] ? 0 : count;
+      L.retired[j] = 0;
+      L.status[j] = RUNNING;
+    }
+  }
+
+  std::uint16_t pc = 0;
+  std::size_t size = 0;
+  std::size_t active = 0;
+  std::uint32_t budget = 0;
+  bool grouped = false;
+
+  // Seeded lanes that have drifted apart hardly ever line up again.
+  if (diverged) {
+    runEachLane();
+  }
+
+  for (;;) {
+    if (!grouped) {
+      if (!findGroup(pc, size, active, budget)) {
+        break;
+      }
+      // Once most lanes are done (or sat down in an idle loop) the few left
+      // are not worth a pass over the whole batch per instruction.
+      if (active * 8 < laneCount) {
+        runEachLane();
+        break;
+      }
+      if (size == active) {
+        splitSteps = 0;
+        splitLanes = 0;
+      } else {
+        splitSteps++;
+        splitLanes += size;
+        if (splitSteps >= DIVERGED_STEPS && splitLanes * 4 < splitSteps * active) {
+          diverged = true;
+          runEachLane();
+          break;
+        }
+      }
+    }
+
+    // A small group is cheaper to step lane by lane than to run full width.
+    std::uint16_t next = pc;
+    const bool together = executeGroup(pc, size * 4 >= active, next);
+    // Every running lane moved on to the same pc, so the group stands and the
+    // search can be skipped until a lane runs out of cycles.
+    grouped = together && size == active && --budget > 0;
+    pc = next;
+  }
+
+  for (Lanes& L : blocks) {
+    for (std::size_t j = 0; j < BLOCK; j++) {
+      L.cycles[j] += L.retired[j];
+    }
+  }
+}
+
+bool LockstepBatch::findGroup(std::uint16_t& pc, std::size_t& size, std::size_t& active, std::uint32_t& budget) {
+  // The lowest pc goes first: lanes split by a skip meet again once the
+  // ones behind have caught up.
+  std::uint16_t lowest = 0xFFFF;
+  std::size_t running = 0;
+  for (const Lanes& L : blocks) {
+    std::uint16_t blockLowest = 0xFFFF;
+    unsigned int blockRunning = 0;
+    for (std::size_t j = 0; j < BLOCK; j++) {
+      const std::uint16_t address = L.remaining[j] ? (L.pc[j] & 0x0FFF) : 0xFFFF;
+      blockLowest = std::min(blockLowest, address);
+      blockRunning += L.remaining[j] != 0;
+    }
+    lowest = std::min(lowest, blockLowest);
+    running += blockRunning;
+  }
+  if (lowest == 0xFFFF) {
+    return false;
+  }
+
+  size = 0;
+  budget = UINT32_MAX;
+  for (Lanes& L : blocks) {
+    unsigned int members = 0;
+    std::uint32_t blockBudget = UINT32_MAX;
+    for (std::size_t j = 0; j < BLOCK; j++) {
+      const bool member = L.remaining[j] && (L.pc[j] & 0x0FFF) == lowest;
+      L.mask[j] = member ? 0xFF : 0;
+      members += member;
+      blockBudget = std::min(blockBudget, member ? L.remaining[j] : UINT32_MAX);
+    }
+    L.any = members > 0;
+    size += members;
+    budget = std::min(budget, blockBudget);
+  }
+
+  pc = lowest;
+  active = running;
+  return true;
+}
+
+bool LockstepBatch::executeGroup(std::uint16_t pc, bool vector, std::uint16_t& next) {
+  if (written[pc] || written[(pc + 1) & 0x0FFF]) {
+    // Some lane wrote here, so the lanes may not even agree on the opcode.
+    executeEach();
+    return false;
+  }
+
+  const Op& op = decoded[pc];
+  bool ok = true;
+  if (isIdleLoop(pc)) {
+    skipIdleLoop(pc, op);
+    return false;
+  } else if (vector) {
+    ok = executeVector(op);
+  } else {
+    for (std::size_t b = 0; b < blocks.size(); b++) {
+      if (!blocks[b].any) {
+        continue;
+      }
+      for (std::size_t j = 0; j < BLOCK; j++) {
+        if (blocks[b].mask[j]) {
+          ok &= step(b * BLOCK + j, op);
+        }
+      }
+    }
+  }
+
+  switch (op.kind) {
+    case OP_1NNN:
+    case OP_2NNN:
+      next = op.nnn & 0x0FFF;
+      return ok;
+    case OP_00EE:
+    case OP_3XNN:
+    case OP_4XNN:
+    case OP_5XY0:
+    case OP_9XY0:
+    case OP_BNNN:
+    case OP_EX9E:
+    case OP_EXA1:
+    case UNKNOWN:
+      return false; // where each lane goes depends on its own state
+    default:
+      next = (pc + 2) & 0x0FFF;
+      return ok;
+  }
+}
+
+bool LockstepBatch::isIdleLoop(std::uint16_t pc) const {
+  // FX07; 3X00; 1NNN jumping back to the FX07, none of it written over.
+  const Op& read = decoded[pc];
+  const Op& poll = decoded[(pc + 2) & 0x0FFF];
+  const Op& jump = decoded[(pc + 4) & 0x0FFF];
+  if (read.kind != OP_FX07 || poll.kind != OP_3XNN || poll.x != read.x || poll.nn != 0 ||
+      jump.kind != OP_1NNN || jump.nnn != pc) {
+    return false;
+  }
+  for (int i = 0; i < 6; i++) {
+    if (written[(pc + i) & 0x0FFF]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void LockstepBatch::skipIdleLoop(std::uint16_t pc, const Op& read) {
+  // Same shortcut as Chip8::skipIdleLoop: timers do not move during a run, so
+  // a lane polling a running delay timer spends the rest of its budget going
+  // round the loop. Account for the whole trips at once and leave the lane at
+  // the top of the loop.
+  constexpr std::uint32_t TRIP = 3;
+  for (std::size_t b = 0; b < blocks.size(); b++) {
+    Lanes& L = blocks[b];
+    if (!L.any) {
+      continue;
+    }
+    for (std::size_t j = 0; j < BLOCK; j++) {
+      if (!L.mask[j]) {
+        continue;
+      }
+      if (L.delay_timer[j] > 0 && L.remaining[j] >= TRIP) {
+        const std::uint32_t cycles = L.remaining[j] / TRIP * TRIP;
+        L.V[read.x][j] = L.delay_timer[j];
+        L.pc[j] = pc;
+        L.remaining[j] -= cycles;
+        L.retired[j] += cycles;
+      } else {
+        step(b * BLOCK + j, read);
+      }
+    }
+  }
+}
+
+void LockstepBatch::executeEach() {
+  for (std::size_t b = 0; b < blocks.size(); b++) {
+    if (!blocks[b].any) {
+      continue;
+    }
+    for (std::size_t j = 0; j < BLOCK; j++) {
+      if (blocks[b].mask[j]) {
+        step(b * BLOCK + j, fetch(b * BLOCK + j));
+      }
+    }
+  }
+}
+
+void LockstepBatch::runEachLane() {
+  for (std::size_t lane = 0; lane < laneCount; lane++) {
+    Lanes& L = blocks[lane / BLOCK];
+    const std::size_t j = lane % BLOCK;
+    while (L.remaining[j] > 0) {
+      const std::uint16_t pc = L.pc[j] & 0x0FFF;
+      if (L.delay_timer[j] > 0 && L.remaining[j] >= 3 && isIdleLoop(pc)) {
+        const std::uint32_t cycles = L.remaining[j] / 3 * 3;
+        L.V[decoded[pc].x][j] = L.delay_timer[j];
+        L.pc[j] = pc;
+        L.remaining[j] -= cycles;
+        L.retired[j] += cycles;
+        continue;
+      }
+      step(lane, fetch(lane));
+    }
+  }
+}
+
+LockstepBatch::Op LockstepBatch::fetch(std::size_t lane) const {
+  const unsigned short address = blocks[lane / BLOCK].pc[lane % BLOCK] & 0x0FFF;
+  const unsigned short second = (address + 1) & 0x0FFF;
+  if (!written[address] && !written[second]) {
+    return decoded[address];
+  }
+  return decode(memory[lane][address] << 8 | memory[lane][second]);
+}
+
+LockstepBatch::Op LockstepBatch::decode(unsigned short opcode) {
+  Op op;
+  op.x = (opcode & 0x0F00) >> 8;
+  op.y = (opcode & 0x00F0) >> 4;
+  op.n = opcode & 0x000F;
+  op.nn = opcode & 0x00FF;
+  op.nnn = opcode & 0x0FFF;
+  op.kind = UNKNOWN;
+
+  switch (opcode & 0xF000) {
+    case 0x0000:
+      if (opcode == 0x00E0) {
+        op.kind = OP_00E0;
+      } else if (opcode == 0x00EE) {
+        op.kind = OP_00EE;
+      }
+      break;
+    case 0x1000: op.kind = OP_1NNN; break;
+    case 0x2000: op.kind = OP_2NNN; break;
+    case 0x3000: op.kind = OP_3XNN; break;
+    case 0x4000: op.kind = OP_4XNN; break;
+    case 0x5000: op.kind = OP_5XY0; break;
+    case 0x6000: op.kind = OP_6XNN; break;
+    case 0x7000: op.kind = OP_7XNN; break;
+    case 0x8000:
+      switch (opcode & 0x000F) {
+        case 0x0000: op.kind = OP_8XY0; break;
+        case 0x0001: op.kind = OP_8XY1; break;
+        case 0x0002: op.kind = OP_8XY2; break;
+        case 0x0003: op.kind = OP_8XY3; break;
+        case 0x0004: op.kind = OP_8XY4; break;
+        case 0x0005: op.kind = OP_8XY5; break;
+        case 0x0006: op.kind = OP_8XY6; break;
+        case 0x0007: op.kind = OP_8XY7; break;
+        case 0x000E: op.kind = OP_8XYE; break;
+      }
+      break;
+    case 0x9000: op.kind = OP_9XY0; break;
+    case 0xA000: op.kind = OP_ANNN; break;
+    case 0xB000: op.kind = OP_BNNN; break;
+    case 0xC000: op.kind = OP_CXNN; break;
+    case 0xD000: op.kind = OP_DXYN; break;
+    case 0xE000:
+      switch (opcode & 0x00FF) {
+        case 0x009E: op.kind = OP_EX9E; break;
+        case 0x00A1: op.kind = OP_EXA1; break;
+      }
+      break;
+    case 0xF000:
+      switch (opcode & 0x00FF) {
+        case 0x0007: op.kind = OP_FX07; break;
+        case 0x000A: op.kind = OP_FX0A; break;
+        case 0x0015: op.kind = OP_FX15; break;
+        case 0x0018: op.kind = OP_FX18; break;
+        case 0x001E: op.kind = OP_FX1E; break;
+        case 0x0029: op.kind = OP_FX29; break;
+        case 0x0033: op.kind = OP_FX33; break;
+        case 0x0055: op.kind = OP_FX55; break;
+        case 0x0065: op.kind = OP_FX65; break;
+      }
+      break;
+  }
+
+  return op;
+}
+
+// Full-width forms of the instructions that only touch registers and pc. Each
+// statement mirrors the matching Chip8 handler, in the same order, so VF
+// doubling as VX or VY comes out the same.
+bool LockstepBatch::executeVector(const Op& op) {
+  bool branches = false;
+
+  switch (op.kind) {
+    case OP_1NNN:
+    case OP_3XNN:
+    case OP_4XNN:
+    case OP_5XY0:
+    case OP_9XY0:
+      branches = true;
+      break;
+    case OP_6XNN:
+    case OP_7XNN:
+    case OP_8XY0:
+    case OP_8XY1:
+    case OP_8XY2:
+    case OP_8XY3:
+    case OP_8XY4:
+    case OP_8XY5:
+    case OP_8XY6:
+    case OP_8XY7:
+    case OP_8XYE:
+    case OP_ANNN:
+    case OP_FX07:
+    case OP_FX15:
+    case OP_FX18:
+    case OP_FX1E:
+    case OP_FX29:
+      break;
+    default: {
+      // Memory, stack, keys, RNG and the framebuffer: one lane at a time.
+      bool ok = true;
+      for (std::size_t b = 0; b < blocks.size(); b++) {
+        if (!blocks[b].any) {
+          continue;
+        }
+        for (std::size_t j = 0; j < BLOCK; j++) {
+          if (blocks[b].mask[j]) {
+            ok &= step(b * BLOCK + j, op);
+          }
+        }
+      }
+      return ok;
+    }
+  }
+
+  const std::uint8_t nn = op.nn;
+  const std::uint16_t nnn = op.nnn;
+
+  for (Lanes& L : blocks) {
+    if (!L.any) {
+      continue;
+    }
+    std::uint8_t* vx = L.V[op.x];
+    std::uint8_t* vy = L.V[op.y];
+    std::uint8_t* vf = L.V[0xF];
+    std::uint8_t m[BLOCK];
+    std::memcpy(m, L.mask, BLOCK);
+
+    // Chip8 reads VX and VY into locals before setting VF in 8XY4-8XY7.
+    std::uint8_t x[BLOCK], y[BLOCK];
+    std::memcpy(x, vx, BLOCK);
+    std::memcpy(y, vy, BLOCK);
+
+    switch (op.kind) {
+      case OP_1NNN:
+        for (std::size_t j = 0; j < BLOCK; j++) {
+          L.pc[j] = m[j] ? nnn : L.pc[j];
+        }
+        break;
+      case OP_3XNN:
+        for (std::size_t j = 0; j < BLOCK; j++) {
+          L.pc[j] += m[j] ? (x[j] == nn ? 4 : 2) : 0;
+        }
+        break;
+      case OP_4XNN:
+        for (std::size_t j = 0; j < BLOCK; j++) {
+          L.pc[j] += m[j] ? (x[j] != nn ? 4 : 2) : 0;
+        }
+        break;
+      case OP_5XY0:
+        for (std::size_t j = 0; j < BLOCK; j++) {
+          L.pc[j] += m[j] ? (x[j] == y[j] ? 4 : 2) : 0;
+        }
+        break;
+      case OP_9XY0:
+        for (std::size_t j = 0; j < BLOCK; j++) {
+          L.pc[j] += m[j] ? (x[j] != y[j] ? 4 : 2) : 0;
+        }
+        break;
+      case OP_6XNN:
+        apply<BLOCK>(vx, vx, vx, m, [nn](unsigned int, unsigned int) { return nn; });
+        break;
+      case OP_7XNN:
+        apply<BLOCK>(vx, vx, vx, m, [nn](unsigned int a, unsigned int) { return a + nn; });
+        break;
+      case OP_8XY0:
+        apply<BLOCK>(vx, vy, vy, m, [](unsigned int b, unsigned int) { return b; });
+        break;
+      case OP_8XY1:
+        apply<BLOCK>(vx, vx, vy, m, [](unsigned int a, unsigned int b) { return a | b; });
+        break;
+      case OP_8XY2:
+        apply<BLOCK>(vx, vx, vy, m, [](unsigned int a, unsigned int b) { return a & b; });
+        break;
+      case OP_8XY3:
+        apply<BLOCK>(vx, vx, vy, m, [](unsigned int a, unsigned int b) { return a ^ b; });
+        break;
+      case OP_8XY4:
+        apply<BLOCK>(vx, vx, y, m, [](unsigned int a, unsigned int b) { return a + b; });
+        apply<BLOCK>(vf, x, y, m, [](unsigned int a, unsigned int b) { return a + b > 255; });
+        break;
+      case OP_8XY5:
+        apply<BLOCK>(vf, x, y, m, [](unsigned int a, unsigned int b) { return a > b; });
+        apply<BLOCK>(vx, vx, y, m, [](unsigned int a, unsigned int b) { return a - b; });
+        break;
+      case OP_8XY6:
+        apply<BLOCK>(vf, vx, vx, m, [](unsigned int a, unsigned int) { return a & 0x1; });
+        apply<BLOCK>(vx, vx, vx, m, [](unsigned int a, unsigned int) { return a >> 1; });
+        break;
+      case OP_8XY7:
+        apply<BLOCK>(vf, x, y, m, [](unsigned int a, unsigned int b) { return b > a; });
+        apply<BLOCK>(vx, x, y, m, [](unsigned int a, unsigned int b) { return b - a; });
+        break;
+      case OP_8XYE:
+        apply<BLOCK>(vf, vx, vx, m, [](unsigned int a, unsigned int) { return (a & 0x80) >> 7; });
+        apply<BLOCK>(vx, vx, vx, m, [](unsigned int a, unsigned int) { return a << 1; });
+        break;
+      case OP_ANNN:
+        for (std::size_t j = 0; j < BLOCK; j++) {
+          L.I[j] = m[j] ? nnn : L.I[j];
+        }
+        break;
+      case OP_FX07:
+        apply<BLOCK>(vx, L.delay_timer, L.delay_timer, m, [](unsigned int a, unsigned int) { return a; });
+        break;
+      case OP_FX15:
+        apply<BLOCK>(L.delay_timer, x, x, m, [](unsigned int a, unsigned int) { return a; });
+        break;
+      case OP_FX18:
+        apply<BLOCK>(L.sound_timer, x, x, m, [](unsigned int a, unsigned int) { return a; });
+        break;
+      case OP_FX1E:
+        for (std::size_t j = 0; j < BLOCK; j++) {
+          L.I[j] += m[j] ? x[j] : 0;
+        }
+        break;
+      case OP_FX29:
+        for (std::size_t j = 0; j < BLOCK; j++) {
+          L.I[j] = m[j] ? x[j] * 0x5 : L.I[j];
+        }
+        break;
+      default:
+        break;
+    }
+
+    for (std::size_t j = 0; j < BLOCK; j++) {
+      L.pc[j] += branches ? 0 : m[j] & 2;
+      L.remaining[j] -= m[j] & 1;
+      L.retired[j] += m[j] & 1;
+    }
+  }
+
+  return true;
+}
+
+// One lane, one instruction: the Chip8 handlers, column by column.
+bool LockstepBatch::step(std::size_t lane, const Op& op) {
+  Lanes& L = blocks[lane / BLOCK];
+  const std::size_t j = lane % BLOCK;
+  std::uint16_t& pc = L.pc[j];
+  std::uint16_t& I = L.I[j];
+  std::uint8_t& sp = L.sp[j];
+  std::uint8_t& vx = L.V[op.x][j];
+  std::uint8_t& vy = L.V[op.y][j];
+  std::uint8_t& vf = L.V[0xF][j];
+  unsigned char* ram = memory[lane].data();
+  Chip8::StopReason stop = Chip8::StopReason::CyclesDone;
+
+  switch (op.kind) {
+    case UNKNOWN:
+      stop = Chip8::StopReason::IllegalOpcode;
+      break;
+    case OP_00E0:
+      gfx[lane].fill(0);
+      pc += 2;
+      break;
+    case OP_00EE:
+      if (sp == 0) {
+        stop = Chip8::StopReason::StackUnderflow;
+        break;
+      }
+      sp--;
+      pc = L.stack[sp][j];
+      pc += 2;
+      break;
+    case OP_1NNN:
+      pc = op.nnn;
+      break;
+    case OP_2NNN:
+      if (sp >= 16) {
+        stop = Chip8::StopReason::StackOverflow;
+        break;
+      }
+      L.stack[sp][j] = pc;
+      sp++;
+      pc = op.nnn;
+      break;
+    case OP_3XNN:
+      pc += vx == op.nn ? 4 : 2;
+      break;
+    case OP_4XNN:
+      pc += vx != op.nn ? 4 : 2;
+      break;
+    case OP_5XY0:
+      pc += vx == vy ? 4 : 2;
+      break;
+    case OP_6XNN:
+      vx = op.nn;
+      pc += 2;
+      break;
+    case OP_7XNN:
+      vx += op.nn;
+      pc += 2;
+      break;
+    case OP_8XY0:
+      vx = vy;
+      pc += 2;
+      break;
+    case OP_8XY1:
+      vx |= vy;
+      pc += 2;
+      break;
+    case OP_8XY2:
+      vx &= vy;
+      pc += 2;
+      break;
+    case OP_8XY3:
+      vx ^= vy;
+      pc += 2;
+      break;
+    case OP_8XY4: {
+      const std::uint8_t a = vx;
+      const std::uint8_t b = vy;
+      vx += b;
+      vf = (a + b > 255) ? 1 : 0;
+      pc += 2;
+      break;
+    }
+    case OP_8XY5: {
+      const std::uint8_t a = vx;
+      const std::uint8_t b = vy;
+      vf = (a > b) ? 1 : 0;
+      vx -= b;
+      pc += 2;
+      break;
+    }
+    case OP_8XY6:
+      vf = vx & 0x1;
+      vx >>= 1;
+      pc += 2;
+      break;
+    case OP_8XY7: {
+      const std::uint8_t a = vx;
+      const std::uint8_t b = vy;
+      vf = (b > a) ? 1 : 0;
+      vx = b - a;
+      pc += 2;
+      break;
+    }
+    case OP_8XYE:
+      vf = (vx & 0x80) >> 7;
+      vx <<= 1;
+      pc += 2;
+      break;
+    case OP_9XY0:
+      pc += vx != vy ? 4 : 2;
+      break;
+    case OP_ANNN:
+      I = op.nnn;
+      pc += 2;
+      break;
+    case OP_BNNN:
+      pc = op.nnn + L.V[0][j];
+      break;
+    case OP_CXNN:
+      vx = (nextRandom(L.rng[j]) >> 24) & op.nn;
+      pc += 2;
+      break;
+    case OP_DXYN: {
+      const unsigned char x = vx % Chip8::WIDTH;
+      const unsigned char y = vy % Chip8::HEIGHT;
+      bool collision = false;
+      for (int i = 0; i < op.n; i++) {
+        std::uint64_t sprite = rotateRight(std::uint64_t{ ram[(I + i) & 0x0FFF] } << 56, x);
+        unsigned char r = (y + i) % Chip8::HEIGHT;
+        collision |= (gfx[lane][r] & sprite) != 0;
+        gfx[lane][r] ^= sprite;
+      }
+      vf = collision ? 1 : 0;
+      pc += 2;
+      break;
+    }
+    case OP_EX9E:
+      pc += L.key[vx & 0xF][j] ? 4 : 2;
+      break;
+    case OP_EXA1:
+      pc += !L.key[vx & 0xF][j] ? 4 : 2;
+      break;
+    case OP_FX07:
+      vx = L.delay_timer[j];
+      pc += 2;
+      break;
+    case OP_FX0A: {
+      bool keyPressed = false;
+      for (int k = 0; k < 16; k++) {
+        if (L.key[k][j]) {
+          vx = k;
+          keyPressed = true;
+          break;
+        }
+      }
+      if (!keyPressed) {
+        stop = Chip8::StopReason::WaitingForKey;
+        break;
+      }
+      pc += 2;
+      break;
+    }
+    case OP_FX15:
+      L.delay_timer[j] = vx;
+      pc += 2;
+      break;
+    case OP_FX18:
+      L.sound_timer[j] = vx;
+      pc += 2;
+      break;
+    case OP_FX1E:
+      I += vx;
+      pc += 2;
+      break;
+    case OP_FX29:
+      I = vx * 0x5;
+      pc += 2;
+      break;
+    case OP_FX33: {
+      // Accesses through I wrap at 4K, as in Chip8, which also keeps a lane
+      // from writing into its neighbour.
+      const unsigned short bcd = vx;
+      const unsigned char digits[3] = {
+        static_cast<unsigned char>(bcd / 100),
+        static_cast<unsigned char>((bcd / 10) % 10),
+        static_cast<unsigned char>(bcd % 10)
+      };
+      for (int i = 0; i < 3; i++) {
+        ram[(I + i) & 0x0FFF] = digits[i];
+        written.set((I + i) & 0x0FFF);
+      }
+      pc += 2;
+      break;
+    }
+    case OP_FX55:
+      for (int i = 0; i <= op.x; i++) {
+        ram[(I + i) & 0x0FFF] = L.V[i][j];
+        written.set((I + i) & 0x0FFF);
+      }
+      pc += 2;
+      break;
+    case OP_FX65:
+      for (int i = 0; i <= op.x; i++) {
+        L.V[i][j] = ram[(I + i) & 0x0FFF];
+      }
+      pc += 2;
+      break;
+  }
+
+  if (stop != Chip8::StopReason::CyclesDone) {
+    L.status[j] = static_cast<std::uint8_t>(stop);
+    L.remaining[j] = 0;
+    return false;
+  }
+  L.remaining[j]--;
+  L.retired[j]++;
+  return true;
+}
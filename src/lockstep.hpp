@@ -0,0 +1,126 @@
+#ifndef LOCKSTEP_HPP
+#define LOCKSTEP_HPP
+
+#include "chip8.hpp"
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Many copies of one ROM run side by side, differing only in RNG seed and
+// input. Registers, timers, pc and stack are kept structure-of-arrays, 32
+// machines ("lanes") to a block, so one decoded instruction can be applied to
+// every lane that is at the same pc with a handful of vector operations
+// instead of one dispatch per machine.
+//
+// Lanes that share a pc execute together; when they diverge (a skip goes
+// different ways, CXNN hands out different numbers) the lowest pc runs first
+// so the stragglers catch up and the lanes merge again. If they stay apart
+// for long, the rest of the run falls back to stepping each lane on its own.
+// Every lane ends up in exactly the state a Chip8 running the same ROM, seed
+// and input would; chip8_batch --lockstep --verify checks that.
+//
+// Only the default variant is mirrored: ROMs that need another one's quirks
+// or instructions run as separate Chip8 objects instead.
+class LockstepBatch {
+public:
+  LockstepBatch(const char* filename, std::size_t lanes);
+
+  // Whether the ROM in filename runs as Variant::Chip8, the only variant a
+  // batch can run.
+  static bool supports(const char* filename);
+
+  std::size_t size() const { return laneCount; }
+
+  // Per-lane counterparts of the Chip8 calls of the same name.
+  void seed(std::size_t lane, std::uint32_t seed);
+  void pressKeys(std::size_t lane, unsigned char key);
+  void releaseKeys(std::size_t lane, unsigned char key);
+  void saveState(std::size_t lane, Chip8::State& snapshot) const;
+
+  // Every running lane retires up to count instructions, as Chip8::runCycles
+  // would; result() then tells how far each one got.
+  void runCycles(unsigned int count);
+  Chip8::RunResult result(std::size_t lane) const;
+  void tickTimers(unsigned int ticks = 1);
+
+  // Takes a lane out of the batch for good: it no longer runs or ticks, so
+  // its state stays as it was, like a Chip8 the host stopped driving.
+  void freeze(std::size_t lane);
+
+private:
+  static constexpr std::size_t BLOCK = 32;
+
+  enum Kind : std::uint8_t {
+    UNKNOWN,
+    OP_00E0, OP_00EE, OP_1NNN, OP_2NNN, OP_3XNN, OP_4XNN, OP_5XY0, OP_6XNN,
+    OP_7XNN, OP_8XY0, OP_8XY1, OP_8XY2, OP_8XY3, OP_8XY4, OP_8XY5, OP_8XY6,
+    OP_8XY7, OP_8XYE, OP_9XY0, OP_ANNN, OP_BNNN, OP_CXNN, OP_DXYN, OP_EX9E,
+    OP_EXA1, OP_FX07, OP_FX0A, OP_FX15, OP_FX18, OP_FX1E, OP_FX29, OP_FX33,
+    OP_FX55, OP_FX65,
+  };
+
+  struct Op {
+    Kind kind;
+    std::uint8_t x;
+    std::uint8_t y;
+    std::uint8_t n;
+    std::uint8_t nn;
+    std::uint16_t nnn;
+  };
+
+  // One column per lane. Memory and the framebuffer are only ever touched
+  // one lane at a time, so they live outside, one block per lane.
+  struct Lanes {
+    std::uint8_t V[16][BLOCK];
+    std::uint16_t I[BLOCK];
+    std::uint16_t pc[BLOCK];
+    std::uint16_t stack[16][BLOCK];
+    std::uint8_t sp[BLOCK];
+    std::uint8_t delay_timer[BLOCK];
+    std::uint8_t sound_timer[BLOCK];
+    std::uint8_t key[16][BLOCK];
+    std::uint32_t rng[BLOCK];
+    std::uint64_t cycles[BLOCK];
+
+    // Bookkeeping for the current runCycles
+    std::uint32_t remaining[BLOCK]; // zero once the lane is done or stopped
+    std::uint32_t retired[BLOCK];
+    std::uint8_t status[BLOCK];     // a Chip8::StopReason
+    std::uint8_t mask[BLOCK];       // 0xFF for lanes in the executing group
+    std::uint8_t frozen[BLOCK];
+    bool any;                       // some lane of the block is in the group
+  };
+
+  std::size_t laneCount;
+  // Steps since every running lane was last in one group, the lanes those
+  // steps ran, and whether that went on long enough to stop grouping.
+  std::size_t splitSteps;
+  std::size_t splitLanes;
+  bool diverged;
+  std::vector<Lanes> blocks;
+  std::vector<std::array<unsigned char, 4096>> memory;
+  std::vector<Chip8::Framebuffer> gfx;
+
+  // Decoded boot image. An address any lane has written to is decoded per
+  // lane from that lane's memory instead.
+  Op decoded[4096];
+  std::bitset<4096> written;
+
+  static Op decode(unsigned short opcode);
+  Op fetch(std::size_t lane) const;
+
+  bool findGroup(std::uint16_t& pc, std::size_t& size, std::size_t& active, std::uint32_t& budget);
+  bool executeGroup(std::uint16_t pc, bool vector, std::uint16_t& next);
+  bool executeVector(const Op& op);
+  // Steps each lane of the group on the opcode in its own memory.
+  void executeEach();
+  bool isIdleLoop(std::uint16_t pc) const;
+  void skipIdleLoop(std::uint16_t pc, const Op& read);
+  void runEachLane();
+  // Runs one instruction on one lane; false if the lane stopped instead.
+  bool step(std::size_t lane, const Op& op);
+};
+
+#endif
@@ -2,9 +2,18 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 
+#include <algorithm>
+#include <atomic>
+#include <ctime>
 #include <unordered_map>
 
+#include "capture.hpp"
 #include "chip8.hpp"
+#include "handoff.hpp"
+#include "replay.hpp"
+#include "rewind.hpp"
+#include "spectate.hpp"
+#include "trace.hpp"
 
 #define APP_NAME "Chip-8 Emulator"
 #define APP_VERSION "1.0"
@@ -12,15 +21,159 @@
 
 #define WINDOW_RESIZABLE false
 
-#define SCALE 30
-#define WIDTH 64
-#define HEIGHT 32
+/* The texture has room for SUPER-CHIP's 128x64 mode; a 64x32 screen fills it
+   at double size. */
+#define SCALE 15
+#define WIDTH 128
+#define HEIGHT 64
+
+/* Only scale the screen by whole multiples of 128x64, letterboxing the rest. */
+#define INTEGER_SCALING true
+/* Share of its brightness (0-255) a pixel keeps each frame after turning off,
+   to soften the flicker of sprites being erased and redrawn. 0 disables it. */
+#define PHOSPHOR_PERSISTENCE 160
+
+/* CPU speed in instructions per second; 0 runs as fast as the host allows.
+   The timers always tick at 60 Hz regardless. */
+#define INSTRUCTIONS_PER_SECOND 700
+#define TIMER_HZ 60
+/* Host time the emulation thread runs between publishing frames when running
+   unthrottled or in turbo. */
+#define EMULATION_BUDGET_NS (SDL_NS_PER_SECOND / TIMER_HZ / 4)
+/* Longest stretch of host time caught up on at once, e.g. after the window was
+   dragged, so a stall does not turn into a burst of emulation. */
+#define MAX_CATCH_UP_NS (SDL_NS_PER_SECOND / 4)
+/* The emulation thread sleeps until each frame is due: blocked on a semaphore
+   for most of the wait, then spinning through the last PACING_SPIN_NS, which
+   covers how far a sleep overshoots on a typical desktop kernel. */
+#define PACING_SPIN_NS (SDL_NS_PER_SECOND / 5000)
+/* Longest the emulation thread sleeps while the guest idles in FX0A or a delay
+   timer loop; key presses wake it sooner. Well under MAX_CATCH_UP_NS, so none
+   of the time slept through is dropped. */
+#define MAX_IDLE_NS (MAX_CATCH_UP_NS / 2)
+#define UNTHROTTLED_CHUNK 1000
+#define TURBO_SCANCODE SDL_SCANCODE_TAB  /* hold for fast-forward */
+
+/* Every frame is kept for rewinding until this much memory is used, which is
+   several minutes of play for most games. */
+#define REWIND_BUDGET_BYTES (8 * 1024 * 1024)
+#define REWIND_SCANCODE SDL_SCANCODE_BACKSPACE  /* hold to play backwards */
+
+/* Binary instruction trace to record, e.g. "chip8.trace"; read it back with
+   chip8_tracedump. nullptr disables tracing. */
+#define TRACE_FILE nullptr
+/* Input log to record, e.g. "chip8.input"; play it back with chip8_replay.
+   Rewinding is disabled while recording. nullptr disables recording. */
+#define INPUT_LOG_FILE nullptr
+/* Frames to record, e.g. "chip8.c8cap"; expand it with chip8_capture. Frames
+   are written on a thread of their own. nullptr disables capturing. */
+#define CAPTURE_FILE nullptr
+/* Unix domain socket to stream the screen on, e.g. "/tmp/chip8.sock"; watch it
+   with chip8_capture --watch. nullptr disables streaming. */
+#define SPECTATE_SOCKET nullptr
+/* Pacing report to write, e.g. "chip8-frames.csv": a line per pass of the
+   emulation thread with the host time, frames run, CPU time the whole process
+   used since the previous line and how late the pass woke up (negative when a
+   key woke it early). nullptr disables it. */
+#define FRAME_STATS_FILE nullptr
+
+/* Interpreter quirks to run the game with: "chip8", "cosmac", "schip" or
+   "xochip". nullptr picks them by ROM, defaulting to "chip8". */
+#define VARIANT nullptr
+
+/* The buzzer: a square wave at AUDIO_TONE_HZ, or for XO-CHIP games their own
+   sample pattern, played while the sound timer runs. The device asks for
+   AUDIO_BUFFER_FRAMES samples at a time and is only ever given what it asks
+   for, so sound lags the emulation by about one buffer (5 ms at 256 frames and
+   48 kHz); keep it small enough to stay under 10 ms. */
+#define AUDIO_SAMPLE_RATE 48000
+#define AUDIO_BUFFER_FRAMES 256
+#define AUDIO_TONE_HZ 440
+#define AUDIO_VOLUME 0.1f  /* 0-1 */
+
+/* Key events waiting for the emulation thread; more than this many unhandled
+   at once are dropped. Must be a power of two. */
+#define KEY_QUEUE_SIZE 256
+/* Longest the renderer waits for a new frame before going back to SDL to
+   handle events. */
+#define EVENT_POLL_MS (1000 / TIMER_HZ)
+
+#define BACKGROUND_COLOR 33, 33, 33  /* dark gray */
+#define FOREGROUND_COLOR 255, 255, 255  /* white */
 
 /* We will use this renderer to draw into this window every frame. */
 static SDL_Window* window = nullptr;
 static SDL_Renderer* renderer = nullptr;
 
+/* The whole screen is one 128x64 texture, scaled up by the GPU in a single draw.
+   pixels mirrors its contents so only changed rows need to be uploaded. */
+static SDL_Texture* texture = nullptr;
+static Uint32 pixels[HEIGHT][WIDTH];
+static unsigned char brightness[HEIGHT][WIDTH];
+static std::uint64_t fading_rows = 0;
+
+/* The guest runs on its own thread, so a slow present or a window being dragged
+   never holds up the CPU. Finished frames come back through a triple buffer,
+   the renderer always taking the newest; keys go the other way through a
+   queue, each stamped with the cycle it should land on. */
+struct Frame {
+  Chip8::Framebuffer framebuffer;
+  bool hires;
+};
+
+struct KeyEvent {
+  std::uint64_t cycle;
+  unsigned char key;
+  bool down;
+};
+
+/* What the audio callback needs to know to play the buzzer, published by the
+   emulation thread the same way as frames. */
+struct Sound {
+  bool playing;
+  bool pattern;  /* play audio_pattern rather than the square wave */
+  unsigned char audio_pattern[16];
+  unsigned char pitch;
+};
+
+static SDL_Thread* emulation_thread = nullptr;
+static TripleBuffer<Frame> frames;
+static TripleBuffer<Sound> sounds;
+static SDL_AudioStream* audio_stream = nullptr;
+static SpscQueue<KeyEvent, KEY_QUEUE_SIZE> key_events;
+static std::atomic<bool> quitting{ false };
+static std::atomic<bool> guest_stopped{ false };
+static std::atomic<bool> turbo{ false };
+static std::atomic<bool> rewinding{ false };
+/* Signalled to cut the emulation thread's sleep short, and by the emulation
+   thread after each frame it publishes. */
+static SDL_Semaphore* wake = nullptr;
+static SDL_Semaphore* frame_ready = nullptr;
+/* Host time, in SDL_GetTicksNS() nanoseconds, at which the emulated clock
+   read zero cycles; moves whenever emulation falls behind or runs ahead. */
+static std::atomic<Sint64> cycle_zero_ns{ 0 };
+
+/* The frame last uploaded to the texture, to find the rows a new one changes. */
+static Frame shown = {};
+
+/* Emulation thread state. Emulated time runs off the monotonic clock and is
+   split into 60 Hz frames, each running its share of the CPU instructions and
+   one timer tick. clock_cycle counts the cycles those frames were given, even
+   ones a guest waiting on FX0A spent idle, so it stays in step with host time. */
+static Uint64 last_ns = 0;
+static Uint64 pending_ns = 0;
+static unsigned int cycle_remainder = 0;
+static std::uint64_t clock_cycle = 0;
+static std::uint64_t frames_run = 0;
+
+/* Owned by the emulation thread while it runs. */
 static Chip8* chip8 = nullptr;
+static Tracer* tracer = nullptr;
+static RewindBuffer* rewind_buffer = nullptr;
+static InputLog* input_log = nullptr;
+static FrameRecorder* recorder = nullptr;
+static SpectatorServer* spectators = nullptr;
+static SDL_IOStream* frame_stats = nullptr;
 
 const std::unordered_map<SDL_Scancode, unsigned char> scancode_to_chip8 = {
   { SDL_SCANCODE_1, 0x1 },
@@ -41,6 +194,368 @@ const std::unordered_map<SDL_Scancode, unsigned char> scancode_to_chip8 = {
   { SDL_SCANCODE_V, 0xF }
 };
 
+/* Blend between the background and foreground colors. */
+static Uint32 shade(unsigned char level) {
+  const unsigned char background[] = { BACKGROUND_COLOR };
+  const unsigned char foreground[] = { FOREGROUND_COLOR };
+  Uint32 color = 0xFF000000;
+  for (int channel = 0; channel < 3; ++channel) {
+    int value = background[channel] + (foreground[channel] - background[channel]) * level / 255;
+    color |= Uint32(value) << (16 - 8 * channel);
+  }
+  return color;
+}
+
+/* The texture rows where frame differs from the one on screen: the same rows
+   in 128x64 mode, two texture rows for each at 64x32. */
+static std::uint64_t changed_rows(const Frame& frame) {
+  if (frame.hires != shown.hires) {
+    return ~std::uint64_t{ 0 };
+  }
+  std::uint64_t rows = 0;
+  for (size_t row = 0; row < HEIGHT; ++row) {
+    const bool changed = frame.hires
+      ? frame.framebuffer[2 * row] != shown.framebuffer[2 * row] ||
+        frame.framebuffer[2 * row + 1] != shown.framebuffer[2 * row + 1]
+      : frame.framebuffer[row / 2] != shown.framebuffer[row / 2];
+    if (changed) {
+      rows |= std::uint64_t{ 1 } << row;
+    }
+  }
+  return rows;
+}
+
+/* Copy the given rows of the texture from the frame on screen, fading out
+   pixels that have just been turned off. */
+static void upload_rows(std::uint64_t rows) {
+  const Chip8::Framebuffer& framebuffer = shown.framebuffer;
+  const bool hires = shown.hires;
+  fading_rows = 0;
+
+  for (size_t row = 0; row < HEIGHT; ++row) {
+    if (!(rows & (std::uint64_t{ 1 } << row))) {
+      continue;
+    }
+
+    bool fading = false;
+    for (size_t column = 0; column < WIDTH; ++column) {
+      const bool lit = hires
+        ? (framebuffer[2 * row + column / 64] >> (63 - column % 64)) & 1
+        : (framebuffer[row / 2] >> (63 - column / 2)) & 1;
+      unsigned char level = 255;
+      if (!lit) {
+        level = brightness[row][column] * PHOSPHOR_PERSISTENCE / 256;
+        fading |= level != 0;
+      }
+      brightness[row][column] = level;
+      pixels[row][column] = shade(level);
+    }
+    if (fading) {
+      fading_rows |= std::uint64_t{ 1 } << row;
+    }
+
+    const SDL_Rect rect = { 0, int(row), WIDTH, 1 };
+    SDL_UpdateTexture(texture, &rect, pixels[row], sizeof(pixels[row]));
+  }
+}
+
+/* Run a batch of instructions, returning false if the guest crashed. */
+static bool run_cycles(unsigned int count) {
+  const Chip8::RunResult result = chip8->runCycles(count);
+  switch (result.reason) {
+    case Chip8::StopReason::IllegalOpcode:
+      SDL_Log("Guest stopped: illegal opcode");
+      return false;
+    case Chip8::StopReason::StackOverflow:
+      SDL_Log("Guest stopped: stack overflow");
+      return false;
+    case Chip8::StopReason::StackUnderflow:
+      SDL_Log("Guest stopped: stack underflow");
+      return false;
+    case Chip8::StopReason::Exited:
+      SDL_Log("Guest exited");
+      return false;
+    default:
+      /* Waiting on FX0A just ends the frame early. */
+      return true;
+  }
+}
+
+static void apply_key(const KeyEvent& event) {
+  if (event.down) {
+    chip8->pressKeys(event.key);
+  } else {
+    chip8->releaseKeys(event.key);
+  }
+}
+
+/* Run the guest on to the given cycle of the emulated clock, pressing and
+   releasing keys at the cycles they were stamped with. A guest waiting on
+   FX0A idles out the cycles it could not run. */
+static bool run_until(std::uint64_t end) {
+  while (clock_cycle < end) {
+    const KeyEvent* event = key_events.peek();
+    const bool due = event && event->cycle < end;
+    const std::uint64_t stop = due ? std::max(event->cycle, clock_cycle) : end;
+    if (stop > clock_cycle) {
+      if (!run_cycles(unsigned(stop - clock_cycle))) {
+        return false;
+      }
+      clock_cycle = stop;
+    }
+    if (due) {
+      apply_key(*event);
+      key_events.pop();
+    }
+  }
+  return true;
+}
+
+/* Run one 60 Hz frame worth of emulation. */
+static bool run_frame() {
+  unsigned int cycles = UNTHROTTLED_CHUNK;
+  if (INSTRUCTIONS_PER_SECOND > 0) {
+    cycle_remainder += INSTRUCTIONS_PER_SECOND;
+    cycles = cycle_remainder / TIMER_HZ;
+    cycle_remainder %= TIMER_HZ;
+  }
+  const bool ok = run_until(clock_cycle + cycles);
+  chip8->tickTimers();
+  rewind_buffer->capture(*chip8);
+  if (recorder) {
+    recorder->record(*chip8);
+  }
+  frames_run++;
+  return ok;
+}
+
+/* Advance the emulation to match the time that has passed on the host.
+   Returns false once the guest has crashed. */
+static bool schedule() {
+  const Uint64 frame_ns = SDL_NS_PER_SECOND / TIMER_HZ;
+  const Uint64 start_ns = SDL_GetTicksNS();
+
+  Uint64 elapsed_ns = start_ns - last_ns;
+  last_ns = start_ns;
+  if (elapsed_ns > MAX_CATCH_UP_NS) {
+    elapsed_ns = MAX_CATCH_UP_NS;
+  }
+
+  if (rewinding) {
+    /* Step back one recorded frame per 60 Hz frame, until the oldest. Keys
+       still reach the guest, just not at any particular cycle. */
+    for (pending_ns += elapsed_ns; pending_ns >= frame_ns; pending_ns -= frame_ns) {
+      rewind_buffer->stepBack(*chip8);
+    }
+    for (const KeyEvent* event; (event = key_events.peek()); key_events.pop()) {
+      apply_key(*event);
+    }
+    return true;
+  }
+
+  if (turbo) {
+    /* Fast-forward: whole frames back to back until the budget is spent. */
+    do {
+      if (!run_frame()) {
+        return false;
+      }
+    } while (SDL_GetTicksNS() - start_ns < EMULATION_BUDGET_NS);
+    pending_ns = 0;
+    return true;
+  }
+
+  pending_ns += elapsed_ns;
+  if (INSTRUCTIONS_PER_SECOND > 0) {
+    for (; pending_ns >= frame_ns; pending_ns -= frame_ns) {
+      if (!run_frame()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /* Unthrottled CPU: keep the timers on the clock and fill the rest of the
+     budget with instructions. */
+  for (; pending_ns >= frame_ns; pending_ns -= frame_ns) {
+    chip8->tickTimers();
+    rewind_buffer->capture(*chip8);
+    if (recorder) {
+      recorder->record(*chip8);
+    }
+    frames_run++;
+  }
+  do {
+    if (!run_until(clock_cycle + UNTHROTTLED_CHUNK)) {
+      return false;
+    }
+  } while (SDL_GetTicksNS() - start_ns < EMULATION_BUDGET_NS);
+  return true;
+}
+
+/* Hand the screen and the buzzer as they are now to the renderer and the
+   audio callback. */
+static void publish_frame() {
+  Frame& frame = frames.back();
+  frame.framebuffer = chip8->getFramebuffer();
+  frame.hires = chip8->isHires();
+  frames.publish();
+  if (spectators) {
+    spectators->publish(*chip8);
+  }
+
+  const Chip8::State& state = chip8->getState();
+  Sound& sound = sounds.back();
+  sound.playing = state.sound_timer > 0;
+  sound.pattern = state.variant == Variant::XoChip;
+  SDL_memcpy(sound.audio_pattern, state.audioPattern, sizeof(sound.audio_pattern));
+  sound.pitch = state.pitch;
+  sounds.publish();
+  SDL_SignalSemaphore(frame_ready);
+}
+
+/* Runs on SDL's audio thread whenever the device wants more samples. It only
+   reads the latest published Sound and fills a fixed buffer: no locks, no
+   allocations. */
+static void SDLCALL feed_audio(void* userdata, SDL_AudioStream* stream, int additional_amount, int total_amount) {
+  static float samples[AUDIO_BUFFER_FRAMES];
+  static double phase = 0;  /* in periods of the square wave, or in pattern samples */
+
+  sounds.acquire();
+  const Sound& sound = sounds.front();
+  const double step = sound.pattern
+    ? Chip8::patternRate(sound.pitch) / AUDIO_SAMPLE_RATE
+    : double(AUDIO_TONE_HZ) / AUDIO_SAMPLE_RATE;
+
+  for (int wanted = additional_amount / int(sizeof(float)); wanted > 0;) {
+    const int count = wanted < AUDIO_BUFFER_FRAMES ? wanted : AUDIO_BUFFER_FRAMES;
+    for (int i = 0; i < count; ++i) {
+      bool high;
+      if (sound.pattern) {
+        const unsigned int bit = unsigned(phase) % 128;
+        high = (sound.audio_pattern[bit / 8] >> (7 - bit % 8)) & 1;
+        phase += step;
+        if (phase >= 128) {
+          phase -= 128;
+        }
+      } else {
+        high = phase < 0.5;
+        phase += step;
+        if (phase >= 1) {
+          phase -= 1;
+        }
+      }
+      samples[i] = sound.playing ? (high ? AUDIO_VOLUME : -AUDIO_VOLUME) : 0.0f;
+    }
+    SDL_PutAudioStreamData(stream, samples, count * int(sizeof(float)));
+    wanted -= count;
+  }
+}
+
+/* When the emulation thread next has to run: when the next frame is due, or,
+   while the guest idles where nobody can see, when the last of the frames it
+   is certain to idle through is. Those are all run then, back to back. */
+static Uint64 next_deadline() {
+  const Uint64 frame_ns = SDL_NS_PER_SECOND / TIMER_HZ;
+  const Uint64 deadline_ns = last_ns + frame_ns - pending_ns;
+  if (rewinding || key_events.peek()) {
+    return deadline_ns;
+  }
+
+  unsigned int ticks = chip8->idleTicks();
+  const unsigned int sound_ticks = chip8->getState().sound_timer;
+  if (sound_ticks > 0) {
+    ticks = std::min(ticks, sound_ticks);  /* the buzzer still has to stop on time */
+  }
+  if (ticks <= 1) {
+    return deadline_ns;
+  }
+  return deadline_ns + std::min<Uint64>(Uint64(ticks - 1) * frame_ns, MAX_IDLE_NS);
+}
+
+/* Sleep until deadline_ns, or until woken. Most of the wait is spent blocked on
+   the wake semaphore, in the whole milliseconds SDL counts its timeout in; the
+   rest in one short sleep and a spin, to be on time to within microseconds. */
+static void sleep_until(Uint64 deadline_ns) {
+  Uint64 now_ns = SDL_GetTicksNS();
+  if (deadline_ns > now_ns + PACING_SPIN_NS + SDL_NS_PER_MS) {
+    const Sint32 wait_ms = Sint32((deadline_ns - now_ns - PACING_SPIN_NS) / SDL_NS_PER_MS);
+    if (SDL_WaitSemaphoreTimeout(wake, wait_ms)) {
+      return;
+    }
+    now_ns = SDL_GetTicksNS();
+  }
+  if (deadline_ns > now_ns + PACING_SPIN_NS) {
+    SDL_DelayNS(deadline_ns - now_ns - PACING_SPIN_NS);
+  }
+  while (SDL_GetTicksNS() < deadline_ns) {
+    SDL_CPUPauseInstruction();
+  }
+}
+
+/* A line of FRAME_STATS_FILE for the pass that just ran. */
+static void report_pass(Uint64 frames, Sint64 late_ns) {
+  static std::clock_t last_clock = 0;
+  const std::clock_t now_clock = std::clock();
+  const long long cpu_us = (long long)(now_clock - last_clock) * 1000000 / CLOCKS_PER_SEC;
+  last_clock = now_clock;
+  SDL_IOprintf(frame_stats, "%llu,%llu,%lld,%lld\n", (unsigned long long)(SDL_GetTicksNS() / SDL_NS_PER_US),
+    (unsigned long long)frames, cpu_us, (long long)(late_ns / Sint64(SDL_NS_PER_US)));
+}
+
+/* The emulation thread: keeps the guest in step with host time, publishing a
+   frame after every pass, until the app quits or the guest stops. Between
+   passes it sleeps, through several frames at once while the guest idles. */
+static int SDLCALL emulate(void* data) {
+  last_ns = SDL_GetTicksNS();
+  publish_frame();
+  if (frame_stats) {
+    SDL_IOprintf(frame_stats, "time_us,frames,cpu_us,late_us\n");
+    report_pass(0, 0);
+  }
+
+  Sint64 late_ns = 0;
+  while (!quitting) {
+    const Uint64 frames_before = frames_run;
+    if (!schedule()) {
+      guest_stopped = true;
+      break;
+    }
+    publish_frame();
+
+    if (INSTRUCTIONS_PER_SECOND > 0) {
+      /* The emulated clock has caught up with last_ns, less what is pending. */
+      const Sint64 caught_up_ns = Sint64(last_ns - pending_ns);
+      cycle_zero_ns.store(caught_up_ns - Sint64(clock_cycle * SDL_NS_PER_SECOND / INSTRUCTIONS_PER_SECOND),
+        std::memory_order_relaxed);
+    }
+    if (frame_stats) {
+      report_pass(frames_run - frames_before, late_ns);
+    }
+    if ((INSTRUCTIONS_PER_SECOND > 0 && !turbo) || rewinding) {
+      const Uint64 deadline_ns = next_deadline();
+      sleep_until(deadline_ns);
+      late_ns = Sint64(SDL_GetTicksNS() - deadline_ns);
+    } else {
+      late_ns = 0;  /* straight on to the next pass, with no deadline to miss */
+    }
+  }
+  return 0;
+}
+
+/* The cycle a key event should land on, going by when it happened: the point
+   the emulated clock reached at that host time, or 0 (as soon as possible) when
+   the clock is not tied to host time. */
+static std::uint64_t target_cycle(Uint64 timestamp_ns) {
+  if (INSTRUCTIONS_PER_SECOND == 0 || turbo || rewinding) {
+    return 0;
+  }
+  const Sint64 since_zero_ns = Sint64(timestamp_ns) - cycle_zero_ns.load(std::memory_order_relaxed);
+  if (since_zero_ns <= 0) {
+    return 0;
+  }
+  return Uint64(since_zero_ns) * INSTRUCTIONS_PER_SECOND / SDL_NS_PER_SECOND;
+}
+
 /* This function runs once at startup. */
 SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[]) {
   SDL_SetAppMetadata(APP_NAME, APP_VERSION, APP_IDENTIFIER);
@@ -55,8 +570,88 @@ SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[]) {
     return SDL_APP_FAILURE;
   }
   SDL_SetWindowResizable(window, WINDOW_RESIZABLE);
+  SDL_SetRenderVSync(renderer, 1);  /* present at most once per refresh */
+
+  texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_XRGB8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
+  if (!texture) {
+    SDL_Log("Couldn't create texture: %s", SDL_GetError());
+    return SDL_APP_FAILURE;
+  }
+  SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
+
+  /* A missing sound device is no reason not to play. */
+  char buffer_frames[16];
+  SDL_snprintf(buffer_frames, sizeof(buffer_frames), "%d", AUDIO_BUFFER_FRAMES);
+  SDL_SetHint(SDL_HINT_AUDIO_DEVICE_SAMPLE_FRAMES, buffer_frames);
+  const SDL_AudioSpec spec = { SDL_AUDIO_F32, 1, AUDIO_SAMPLE_RATE };
+  if (SDL_InitSubSystem(SDL_INIT_AUDIO)) {
+    audio_stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, feed_audio, nullptr);
+  }
+  if (audio_stream) {
+    SDL_ResumeAudioStreamDevice(audio_stream);
+  } else {
+    SDL_Log("Couldn't open audio, running without sound: %s", SDL_GetError());
+  }
+  SDL_SetRenderLogicalPresentation(renderer, WIDTH, HEIGHT,
+    INTEGER_SCALING ? SDL_LOGICAL_PRESENTATION_INTEGER_SCALE : SDL_LOGICAL_PRESENTATION_LETTERBOX);
+
+  /* Start from a blank screen; from here on only dirty rows are uploaded. */
+  for (size_t row = 0; row < HEIGHT; ++row) {
+    for (size_t column = 0; column < WIDTH; ++column) {
+      pixels[row][column] = shade(0);
+      brightness[row][column] = 0;
+    }
+  }
+  SDL_UpdateTexture(texture, nullptr, pixels, sizeof(pixels[0]));
 
   chip8 = new Chip8("../games/tetris.c8");
+  if (VARIANT) {
+    Variant variant;
+    if (!parseVariant(VARIANT, variant)) {
+      SDL_Log("Unknown variant: %s", VARIANT);
+      return SDL_APP_FAILURE;
+    }
+    chip8->setVariant(variant);
+  }
+  if (TRACE_FILE) {
+    tracer = new Tracer(TRACE_FILE, chip8->getVariant());
+    if (tracer->isOpen()) {
+      chip8->setTracer(tracer);
+    } else {
+      delete tracer;  /* already said why; run without tracing */
+      tracer = nullptr;
+    }
+  }
+  if (INPUT_LOG_FILE) {
+    input_log = new InputLog();
+    chip8->setInputLog(input_log);
+  }
+  if (CAPTURE_FILE) {
+    recorder = new FrameRecorder(CAPTURE_FILE, true);
+  }
+  if (SPECTATE_SOCKET) {
+    spectators = new SpectatorServer(SPECTATE_SOCKET);
+  }
+  if (FRAME_STATS_FILE) {
+    frame_stats = SDL_IOFromFile(FRAME_STATS_FILE, "w");
+    if (!frame_stats) {
+      SDL_Log("Couldn't open %s: %s", FRAME_STATS_FILE, SDL_GetError());
+    }
+  }
+  rewind_buffer = new RewindBuffer(REWIND_BUDGET_BYTES);
+  rewind_buffer->capture(*chip8);
+
+  wake = SDL_CreateSemaphore(0);
+  frame_ready = SDL_CreateSemaphore(0);
+  if (!wake || !frame_ready) {
+    SDL_Log("Couldn't create semaphores: %s", SDL_GetError());
+    return SDL_APP_FAILURE;
+  }
+  emulation_thread = SDL_CreateThread(emulate, "emulation", nullptr);
+  if (!emulation_thread) {
+    SDL_Log("Couldn't start the emulation thread: %s", SDL_GetError());
+    return SDL_APP_FAILURE;
+  }
 
   return SDL_APP_CONTINUE;  /* carry on with the program! */
 }
@@ -66,18 +661,24 @@ SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* event) {
   if (event->type == SDL_EVENT_QUIT) {
     return SDL_APP_SUCCESS;  /* end the program, reporting success to the OS. */
   }
-  if (event->type == SDL_EVENT_KEY_DOWN) {
-    auto it = scancode_to_chip8.find(event->key.scancode);
-    if (it != scancode_to_chip8.end()) {
-      chip8->pressKeys(it->second);
+  if (event->type == SDL_EVENT_KEY_DOWN || event->type == SDL_EVENT_KEY_UP) {
+    if (event->key.scancode == TURBO_SCANCODE) {
+      turbo = event->type == SDL_EVENT_KEY_DOWN;
+    } else if (event->key.scancode == REWIND_SCANCODE && !input_log) {
+      rewinding = event->type == SDL_EVENT_KEY_DOWN;
     }
-    SDL_Log("Key pressed: %s", SDL_GetScancodeName(event->key.scancode));
-  } else if (event->type == SDL_EVENT_KEY_UP) {
+  }
+  if (event->type == SDL_EVENT_KEY_DOWN || event->type == SDL_EVENT_KEY_UP) {
+    const bool down = event->type == SDL_EVENT_KEY_DOWN;
     auto it = scancode_to_chip8.find(event->key.scancode);
-    if (it != scancode_to_chip8.end()) {
-      chip8->releaseKeys(it->second);
+    if (it != scancode_to_chip8.end() && !event->key.repeat) {
+      const KeyEvent key = { target_cycle(event->key.timestamp), it->second, down };
+      if (!key_events.push(key)) {
+        SDL_Log("Key event dropped: the emulation thread is not keeping up");
+      }
     }
-    SDL_Log("Key released: %s", SDL_GetScancodeName(event->key.scancode));
+    SDL_Log(down ? "Key pressed: %s" : "Key released: %s", SDL_GetScancodeName(event->key.scancode));
+    SDL_SignalSemaphore(wake);  /* neither the guest nor turbo or rewind should wait out an idle sleep */
   }
 
   return SDL_APP_CONTINUE;  /* carry on with the program! */
@@ -86,31 +687,29 @@ SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* event) {
 /* This function runs once per frame, and is the heart of the program. */
 SDL_AppResult SDL_AppIterate(void* appstate) {
 
-  chip8->emulateCycle();
-
-  if (chip8->getDrawFlag()) {
-    /* as you can see from this, rendering draws over whatever was drawn before it. */
-    SDL_SetRenderDrawColor(renderer, 33, 33, 33, SDL_ALPHA_OPAQUE);  /* dark gray, full alpha */
-    SDL_RenderClear(renderer);  /* start with a blank canvas. */
-
-
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, SDL_ALPHA_OPAQUE);  /* blue, full alpha */
-    const auto graphics = chip8->getGraphics();
-    for (size_t row = 0; row < graphics.size(); ++row) {
-      for (size_t column = 0; column < graphics[row].size(); ++column) {
-        if (graphics[row][column] != 0) {
-          SDL_FRect rect;
-          rect.x = column * SCALE;
-          rect.y = row * SCALE;
-          rect.w = SCALE;
-          rect.h = SCALE;
-          SDL_RenderFillRect(renderer, &rect);
-        }
-      }
-    }
+  if (guest_stopped) {
+    return SDL_APP_FAILURE;
+  }
 
-    SDL_RenderPresent(renderer);  /* put it all on the screen! */
+  /* Any signal for a frame already published is used up by this acquire. */
+  while (SDL_TryWaitSemaphore(frame_ready)) {
+  }
+  std::uint64_t rows = 0;
+  if (frames.acquire()) {
+    rows = changed_rows(frames.front());
+    shown = frames.front();
+  }
+  /* Rows still fading out have to be redrawn even if the game left them alone. */
+  rows |= fading_rows;
+  if (rows) {
+    upload_rows(rows);
 
+    SDL_SetRenderDrawColor(renderer, BACKGROUND_COLOR, SDL_ALPHA_OPAQUE);
+    SDL_RenderClear(renderer);  /* clears the letterbox bars too. */
+    SDL_RenderTexture(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);  /* put it all on the screen! */
+  } else {
+    SDL_WaitSemaphoreTimeout(frame_ready, EVENT_POLL_MS);  /* nothing to draw until the next frame */
   }
 
   return SDL_APP_CONTINUE;  /* carry on with the program! */
@@ -119,4 +718,27 @@ SDL_AppResult SDL_AppIterate(void* appstate) {
 /* This function runs once at shutdown. */
 void SDL_AppQuit(void* appstate, SDL_AppResult result) {
   /* SDL will clean up the window/renderer for us. */
+  quitting = true;
+  if (emulation_thread) {
+    SDL_SignalSemaphore(wake);
+    SDL_WaitThread(emulation_thread, nullptr);
+  }
+  SDL_DestroySemaphore(wake);
+  SDL_DestroySemaphore(frame_ready);
+  if (frame_stats) {
+    SDL_CloseIO(frame_stats);
+  }
+  SDL_DestroyAudioStream(audio_stream);
+  delete tracer;  /* flushes the rest of the trace to disk */
+  if (recorder && recorder->getDropped()) {
+    SDL_Log("Capture dropped %llu frames: the disk was not keeping up",
+            (unsigned long long)recorder->getDropped());
+  }
+  delete recorder;  /* flushes the rest of the frames too */
+  delete spectators;
+  delete rewind_buffer;
+  if (input_log) {
+    input_log->save(INPUT_LOG_FILE);
+    delete input_log;
+  }
 }
@@ -0,0 +1,38 @@
+#include "native.hpp"
+#include <cstring>
+
+void Chip8::setNativeProgram(const NativeProgram* program) {
+  native = program;
+  bindNative();
+}
+
+void Chip8::bindNative() {
+  nativeWritten = false;
+  nativeCode.reset();
+  if (!native || native->variant != state.variant) {
+    nativeIndex.clear();
+    return;
+  }
+
+  // Blocks whose bytes in memory differ from the ROM they were compiled from
+  // are left to the interpreter, as are blocks the debugger may stop inside.
+  nativeIndex.assign(4096, nullptr);
+  for (std::size_t i = 0; i < native->blockCount; i++) {
+    const NativeBlock& block = native->blocks[i];
+    if (block.start < 0x200 || block.end > 0x200 + native->romSize ||
+        std::memcmp(state.memory + block.start, native->rom + (block.start - 0x200), block.end - block.start) != 0) {
+      continue;
+    }
+    bool stops = false;
+    for (unsigned short address = block.start; address < block.end && !stops; address += 2) {
+      stops = trapped(address);
+    }
+    if (stops) {
+      continue;
+    }
+    nativeIndex[block.start] = &block;
+    for (unsigned short address = block.start; address < block.end; address++) {
+      nativeCode[address] = true;
+    }
+  }
+}
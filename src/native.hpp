@@ -0,0 +1,53 @@
+#ifndef NATIVE_HPP
+#define NATIVE_HPP
+
+#include "bits.hpp"
+#include "chip8.hpp"
+#include <cstddef>
+#include <cstdint>
+
+// What chip8_aot generates and Chip8::setNativeProgram runs. Each basic block
+// the compiler found by following the ROM's control flow from 0x200 becomes
+// one function that works directly on the machine state, with operands and
+// quirks fixed at compile time. Instructions with side effects outside the
+// state (drawing, memory writes, waiting on a key) are handed back to the
+// interpreter from inside the block.
+
+struct Chip8::NativeBlock {
+  unsigned short start;
+  unsigned short end;     // one past the last byte
+  unsigned short cycles;  // instructions, the most one run retires
+  // Register X of an FX07; 3X00; 1NNN idle loop making up the whole block,
+  // which runCycles skips over like a translated one; -1 otherwise.
+  signed char idleRegister;
+  // Runs the block from its start and returns the instructions it retired.
+  // Only the last one can stop the machine, and then it is not counted.
+  unsigned int (*run)(State& state, Chip8& c);
+};
+
+struct Chip8::NativeProgram {
+  std::uint64_t romHash; // FNV-1a of rom, as in RomImage
+  Variant variant;       // whose quirks the blocks were compiled with
+  // The ROM as compiled, loaded at 0x200. A block is only run while memory
+  // still matches it over the block's bytes.
+  const unsigned char* rom;
+  std::size_t romSize;
+  const NativeBlock* blocks;
+  std::size_t blockCount;
+
+  // Helpers for generated code, which is outside the class.
+
+  // Runs the instruction at pc on the interpreter.
+  static void interpret(Chip8& c) {
+    const Instruction& in = c.decoded[c.state.pc & 0x0FFF];
+    in.handler(c, in);
+  }
+  static bool stopped(const Chip8& c) { return c.stop != StopReason::CyclesDone; }
+};
+
+// Defined in the generated code: the compiled program for the ROM with this
+// hash, or nullptr if it was not compiled. Only programs linking the
+// chip8_native library have it.
+const Chip8::NativeProgram* nativeProgramFor(std::uint64_t romHash);
+
+#endif
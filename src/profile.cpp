@@ -0,0 +1,228 @@
+#include "profile.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+namespace {
+
+const char* FAMILY_NAMES[Profiler::FAMILIES] = {
+  "00E0", "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+  "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE",
+  "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1",
+  "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29", "FX33", "FX55", "FX65",
+  "unknown",
+};
+
+constexpr int UNKNOWN = Profiler::FAMILIES - 1;
+
+std::string nodeName(std::uint16_t address, bool root) {
+  char name[16];
+  std::snprintf(name, sizeof(name), root ? "main" : "sub_%03X", address);
+  return name;
+}
+
+} // namespace
+
+Profiler::Profiler()
+  : pcCounts(4096, 0), familyCounts{}, total(0), current(ROOT), depth(0), maxDepth(0) {
+  nodes.push_back({ ROOT, 0x200, 1, 0 });
+}
+
+int Profiler::family(std::uint16_t opcode) {
+  const unsigned int low = opcode & 0x000F;
+  const unsigned int nn = opcode & 0x00FF;
+  switch (opcode & 0xF000) {
+    case 0x0000:
+      return opcode == 0x00E0 ? 0 : opcode == 0x00EE ? 1 : UNKNOWN;
+    case 0x5000:
+      return low == 0 ? 6 : UNKNOWN;
+    case 0x8000:
+      if (low <= 7) {
+        return 9 + low;
+      }
+      return low == 0xE ? 17 : UNKNOWN;
+    case 0x9000:
+      return low == 0 ? 18 : UNKNOWN;
+    case 0xE000:
+      return nn == 0x9E ? 23 : nn == 0xA1 ? 24 : UNKNOWN;
+    case 0xF000:
+      switch (nn) {
+        case 0x07: return 25;
+        case 0x0A: return 26;
+        case 0x15: return 27;
+        case 0x18: return 28;
+        case 0x1E: return 29;
+        case 0x29: return 30;
+        case 0x33: return 31;
+        case 0x55: return 32;
+        case 0x65: return 33;
+      }
+      return UNKNOWN;
+  }
+  // 1NNN to 4XNN, 6XNN, 7XNN and ANNN to DXYN have a single form each.
+  static const int BY_NIBBLE[16] = {
+    UNKNOWN, 2, 3, 4, 5, UNKNOWN, 7, 8, UNKNOWN, UNKNOWN, 19, 20, 21, 22, UNKNOWN, UNKNOWN,
+  };
+  return BY_NIBBLE[opcode >> 12];
+}
+
+const char* Profiler::familyName(int family) {
+  return family >= 0 && family < FAMILIES ? FAMILY_NAMES[family] : "unknown";
+}
+
+void Profiler::call(std::uint16_t address) {
+  const std::uint64_t key = static_cast<std::uint64_t>(current) << 12 | address;
+  auto found = children.find(key);
+  std::uint32_t child;
+  if (found != children.end()) {
+    child = found->second;
+  } else {
+    child = static_cast<std::uint32_t>(nodes.size());
+    nodes.push_back({ current, address, 0, 0 });
+    children.emplace(key, child);
+  }
+  nodes[child].calls++;
+  current = child;
+  maxDepth = std::max(maxDepth, ++depth);
+}
+
+std::vector<std::uint64_t> Profiler::inclusive() const {
+  // Children are always created after their parent, so one backwards pass
+  // adds every subtree into its parent.
+  std::vector<std::uint64_t> sums(nodes.size());
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    sums[i] = nodes[i].self;
+  }
+  for (std::size_t i = nodes.size() - 1; i > 0; i--) {
+    sums[nodes[i].parent] += sums[i];
+  }
+  return sums;
+}
+
+void Profiler::writeReport(std::FILE* out, unsigned int top) const {
+  auto percent = [this](std::uint64_t count) {
+    return total ? 100.0 * count / total : 0.0;
+  };
+
+  std::fprintf(out, "%llu instructions, call depth up to %u\n\n",
+    static_cast<unsigned long long>(total), maxDepth);
+
+  std::vector<int> families;
+  for (int f = 0; f < FAMILIES; f++) {
+    if (familyCounts[f]) {
+      families.push_back(f);
+    }
+  }
+  std::sort(families.begin(), families.end(), [this](int a, int b) {
+    return familyCounts[a] > familyCounts[b];
+  });
+  std::fprintf(out, "%-8s %14s %7s\n", "opcode", "count", "share");
+  for (int f : families) {
+    std::fprintf(out, "%-8s %14llu %6.2f%%\n", FAMILY_NAMES[f],
+      static_cast<unsigned long long>(familyCounts[f]), percent(familyCounts[f]));
+  }
+
+  std::vector<std::uint16_t> addresses;
+  for (std::uint16_t address = 0; address < 4096; address++) {
+    if (pcCounts[address]) {
+      addresses.push_back(address);
+    }
+  }
+  std::sort(addresses.begin(), addresses.end(), [this](std::uint16_t a, std::uint16_t b) {
+    return pcCounts[a] > pcCounts[b];
+  });
+  if (addresses.size() > top) {
+    addresses.resize(top);
+  }
+  std::fprintf(out, "\n%-8s %14s %7s\n", "pc", "count", "share");
+  for (std::uint16_t address : addresses) {
+    std::fprintf(out, "%03X      %14llu %6.2f%%\n", address,
+      static_cast<unsigned long long>(pcCounts[address]), percent(pcCounts[address]));
+  }
+
+  // Per subroutine, summed over every call path it shows up on. A recursive
+  // call path only counts its outermost entry, so nothing is counted twice.
+  struct Subroutine {
+    std::uint64_t calls = 0;
+    std::uint64_t self = 0;
+    std::uint64_t inclusive = 0;
+  };
+  std::unordered_map<std::uint16_t, Subroutine> subroutines;
+  const std::vector<std::uint64_t> sums = inclusive();
+  for (std::size_t i = 1; i < nodes.size(); i++) {
+    Subroutine& s = subroutines[nodes[i].address];
+    s.calls += nodes[i].calls;
+    s.self += nodes[i].self;
+    bool nested = false;
+    for (std::uint32_t up = nodes[i].parent; up != ROOT && !nested; up = nodes[up].parent) {
+      nested = nodes[up].address == nodes[i].address;
+    }
+    if (!nested) {
+      s.inclusive += sums[i];
+    }
+  }
+  std::vector<std::pair<std::uint16_t, Subroutine>> sorted(subroutines.begin(), subroutines.end());
+  std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+    return a.second.inclusive > b.second.inclusive;
+  });
+  std::fprintf(out, "\n%-10s %12s %14s %14s %7s\n", "subroutine", "calls", "self", "inclusive", "share");
+  std::fprintf(out, "%-10s %12s %14llu %14llu %6.2f%%\n", "main", "-",
+    static_cast<unsigned long long>(nodes[ROOT].self), static_cast<unsigned long long>(sums[ROOT]),
+    percent(sums[ROOT]));
+  for (const auto& entry : sorted) {
+    std::fprintf(out, "%-10s %12llu %14llu %14llu %6.2f%%\n", nodeName(entry.first, false).c_str(),
+      static_cast<unsigned long long>(entry.second.calls),
+      static_cast<unsigned long long>(entry.second.self),
+      static_cast<unsigned long long>(entry.second.inclusive), percent(entry.second.inclusive));
+  }
+}
+
+bool Profiler::writeFolded(const char* filename) const {
+  std::FILE* file = std::fopen(filename, "w");
+  if (!file) {
+    std::cerr << "Could not open folded stack file: " << filename << std::endl;
+    return false;
+  }
+
+  std::vector<std::string> paths(nodes.size());
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    // Parents come first, so their path is already built.
+    paths[i] = i == ROOT ? nodeName(nodes[i].address, true)
+                         : paths[nodes[i].parent] + ";" + nodeName(nodes[i].address, false);
+    if (nodes[i].self) {
+      std::fprintf(file, "%s %llu\n", paths[i].c_str(), static_cast<unsigned long long>(nodes[i].self));
+    }
+  }
+
+  const bool ok = std::ferror(file) == 0;
+  std::fclose(file);
+  if (!ok) {
+    std::cerr << "Write error: " << filename << std::endl;
+  }
+  return ok;
+}
+
+bool Profiler::writeHeatmap(const char* filename) const {
+  std::FILE* file = std::fopen(filename, "wb");
+  if (!file) {
+    std::cerr << "Could not open heatmap file: " << filename << std::endl;
+    return false;
+  }
+
+  const std::uint64_t hottest = *std::max_element(pcCounts.begin(), pcCounts.end());
+  const double scale = hottest ? 255.0 / std::log1p(static_cast<double>(hottest)) : 0.0;
+  unsigned char pixels[4096];
+  for (std::size_t address = 0; address < 4096; address++) {
+    pixels[address] = static_cast<unsigned char>(std::lround(std::log1p(static_cast<double>(pcCounts[address])) * scale));
+  }
+  std::fprintf(file, "P5\n64 64\n255\n");
+  std::fwrite(pixels, 1, sizeof(pixels), file);
+
+  const bool ok = std::ferror(file) == 0;
+  std::fclose(file);
+  if (!ok) {
+    std::cerr << "Write error: " << filename << std::endl;
+  }
+  return ok;
+}
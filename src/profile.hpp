@@ -0,0 +1,78 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+// Counts where a ROM spends its instructions: executions per opcode family
+// and per address, and a call tree built from 2NNN/00EE with the instructions
+// retired at each point of it. The core feeds it one retired instruction at a
+// time when built with CHIP8_PROFILE (see Chip8::setProfiler).
+//
+// Results come out as a text report, a folded-stack file for flamegraph.pl
+// or speedscope, and a 4 KB heatmap image with one pixel per address.
+class Profiler {
+public:
+  Profiler();
+
+  void record(std::uint16_t pc, std::uint16_t opcode) {
+    pcCounts[pc & 0x0FFF]++;
+    familyCounts[family(opcode)]++;
+    nodes[current].self++;
+    total++;
+
+    if ((opcode & 0xF000) == 0x2000) {
+      call(opcode & 0x0FFF);
+    } else if (opcode == 0x00EE && current != ROOT) {
+      // A machine restored from a snapshot may return from calls that started
+      // before profiling; those returns stay at the top level.
+      current = nodes[current].parent;
+      depth--;
+    }
+  }
+
+  std::uint64_t getTotal() const { return total; }
+  unsigned int getMaxDepth() const { return maxDepth; }
+
+  // Opcode families, by their pattern ("8XY4", "DXYN", ...).
+  static constexpr int FAMILIES = 35;
+  static int family(std::uint16_t opcode);
+  static const char* familyName(int family);
+
+  // Opcode families and hottest addresses by count, then every subroutine
+  // with its calls, its own instructions and those of everything it called.
+  void writeReport(std::FILE* out, unsigned int top = 20) const;
+  // One line per call path, "main;sub_2A4;sub_3F0 <instructions>".
+  bool writeFolded(const char* filename) const;
+  // 64x64 binary PGM, address 0 at the top left, brightness log-scaled by
+  // how often the instruction at that address ran.
+  bool writeHeatmap(const char* filename) const;
+
+private:
+  static constexpr std::uint32_t ROOT = 0;
+
+  struct Node {
+    std::uint32_t parent;
+    std::uint16_t address; // subroutine entry; the ROM's start for the root
+    std::uint64_t calls;
+    std::uint64_t self;    // instructions retired directly in this node
+  };
+
+  std::vector<std::uint64_t> pcCounts;
+  std::uint64_t familyCounts[FAMILIES];
+  std::uint64_t total;
+
+  std::vector<Node> nodes;
+  // Child lookup: parent node << 12 | subroutine address
+  std::unordered_map<std::uint64_t, std::uint32_t> children;
+  std::uint32_t current;
+  unsigned int depth;
+  unsigned int maxDepth;
+
+  void call(std::uint16_t address);
+  std::vector<std::uint64_t> inclusive() const;
+};
+
+#endif
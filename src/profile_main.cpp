@@ -0,0 +1,99 @@
+#include "chip8.hpp"
+#include "profile.hpp"
+#include "replay.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#if !CHIP8_PROFILE
+#error "chip8_profile needs a core built with CHIP8_PROFILE=1"
+#endif
+
+// Profiles a ROM: runs it for a number of 60 Hz frames with no input, or
+// replays an input log recorded by the front end, and reports where the
+// instructions went. Also writes <prefix>.folded, for flamegraph.pl or
+// speedscope, and <prefix>.pgm, a heatmap of memory with one pixel per address.
+//
+// Usage: chip8_profile [--frames N | --input LOG] [--seed S] [--out PREFIX] <rom>
+
+namespace {
+
+void usage(const char* program) {
+  std::cerr << "Usage: " << program << " [--frames N | --input LOG] [--seed S] [--out PREFIX] <rom>\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  unsigned long frames = 0;
+  const char* input = nullptr;
+  std::uint32_t seed = 1;
+  std::string prefix = "chip8";
+  const char* rom = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (std::strcmp(arg, "--frames") == 0 && hasValue) {
+      frames = std::strtoul(argv[++i], nullptr, 10);
+    } else if (std::strcmp(arg, "--input") == 0 && hasValue) {
+      input = argv[++i];
+    } else if (std::strcmp(arg, "--seed") == 0 && hasValue) {
+      seed = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(arg, "--out") == 0 && hasValue) {
+      prefix = argv[++i];
+    } else if (arg[0] == '-' || rom) {
+      usage(argv[0]);
+      return 1;
+    } else {
+      rom = arg;
+    }
+  }
+  if (!rom || (input && frames > 0)) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (!input && frames == 0) {
+    frames = 60 * 60; // one minute of play
+  }
+
+  Chip8 chip8{ rom };
+  Profiler profiler;
+  chip8.setProfiler(&profiler);
+
+  Chip8::StopReason reason = Chip8::StopReason::FrameComplete;
+  if (input) {
+    InputLog log;
+    if (!log.load(input)) {
+      return 1;
+    }
+    reason = log.replay(chip8);
+  } else {
+    chip8.seed(seed);
+    for (unsigned long frame = 0; frame < frames; frame++) {
+      Chip8::RunResult result = chip8.runFrame();
+      if (result.reason != Chip8::StopReason::FrameComplete &&
+          result.reason != Chip8::StopReason::WaitingForKey) {
+        reason = result.reason;
+        break;
+      }
+    }
+  }
+  chip8.setProfiler(nullptr);
+
+  if (reason != Chip8::StopReason::FrameComplete && reason != Chip8::StopReason::CyclesDone) {
+    std::fprintf(stderr, "Run stopped early (reason %d) at pc %03X\n",
+      static_cast<int>(reason), chip8.getState().pc);
+  }
+
+  profiler.writeReport(stdout);
+  const std::string folded = prefix + ".folded";
+  const std::string heatmap = prefix + ".pgm";
+  if (!profiler.writeFolded(folded.c_str()) || !profiler.writeHeatmap(heatmap.c_str())) {
+    return 1;
+  }
+  std::fprintf(stderr, "Wrote %s and %s\n", folded.c_str(), heatmap.c_str());
+  return 0;
+}
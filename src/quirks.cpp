@@ -0,0 +1,45 @@
+#include "quirks.hpp"
+#include <cstring>
+
+namespace {
+
+struct KnownRom {
+  std::uint64_t hash;
+  Variant variant;
+  const char* title;
+};
+
+// ROMs that need something other than the default. Written in Octo, they
+// expect its shifts through VY and FX55/FX65 moving I.
+constexpr KnownRom KNOWN_ROMS[] = {
+  { 0xe0f3253ea2ff3e53ull, Variant::XoChip, "Slippery Slope" },
+  { 0x89375b2ddb8aecd2ull, Variant::XoChip, "Octojam 1 title" },
+  { 0xd9b3e1021b60cfbbull, Variant::XoChip, "Octojam 2 title" },
+};
+
+constexpr const char* NAMES[] = { "chip8", "cosmac", "schip", "xochip" };
+
+} // namespace
+
+Variant variantFor(std::uint64_t romHash) {
+  for (const KnownRom& rom : KNOWN_ROMS) {
+    if (rom.hash == romHash) {
+      return rom.variant;
+    }
+  }
+  return Variant::Chip8;
+}
+
+const char* variantName(Variant variant) {
+  return NAMES[static_cast<int>(variant)];
+}
+
+bool parseVariant(const char* name, Variant& variant) {
+  for (int i = 0; i < 4; i++) {
+    if (std::strcmp(name, NAMES[i]) == 0) {
+      variant = static_cast<Variant>(i);
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,50 @@
+#ifndef QUIRKS_HPP
+#define QUIRKS_HPP
+
+#include <cstdint>
+
+// The interpreters CHIP-8 programs were written for disagree on a handful of
+// instructions, and a ROM only runs right on the behaviour it was tested
+// against. Each variant is one fixed set of answers; the core instantiates its
+// handlers once per variant and picks the set when an instruction is decoded,
+// so the hot loop never tests a quirk.
+enum class Variant : std::uint8_t {
+  Chip8,     // what this emulator has always done, and the default
+  Cosmac,    // the original COSMAC VIP interpreter
+  SuperChip, // SUPER-CHIP 1.1
+  XoChip,    // Octo's defaults, which XO-CHIP keeps
+};
+
+struct Quirks {
+  bool shiftUsesVY;     // 8XY6/8XYE shift VY into VX instead of VX in place
+  bool loadStoreMovesI; // FX55/FX65 leave I just past the last register
+  bool clipSprites;     // sprites stop at the screen edges instead of wrapping
+  bool logicResetsVF;   // 8XY1/8XY2/8XY3 clear VF
+  bool jumpUsesVX;      // BXNN jumps to XNN + VX rather than NNN + V0
+  bool superChip;       // 128x64 mode, scrolling, DXY0, FX30, FX75/FX85
+};
+
+constexpr Quirks quirksOf(Variant variant) {
+  switch (variant) {
+    case Variant::Cosmac:
+      return { true, true, true, true, false, false };
+    case Variant::SuperChip:
+      return { false, false, true, false, true, true };
+    case Variant::XoChip:
+      return { true, true, false, false, false, true };
+    case Variant::Chip8:
+    default:
+      return { false, false, false, false, false, false };
+  }
+}
+
+// The variant a ROM is known to need, looked up by the FNV-1a hash of its
+// bytes; Variant::Chip8 for anything not in the table.
+Variant variantFor(std::uint64_t romHash);
+
+// "chip8", "cosmac", "schip" and "xochip", for command lines and reports.
+const char* variantName(Variant variant);
+// Returns false if name is none of the above.
+bool parseVariant(const char* name, Variant& variant);
+
+#endif
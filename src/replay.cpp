@@ -0,0 +1,94 @@
+#include "replay.hpp"
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+void InputLog::begin(std::uint32_t seed) {
+  events.clear();
+  this->seed = seed;
+}
+
+bool InputLog::save(const char* filename) const {
+  InputLogHeader header = {};
+  std::memcpy(header.magic, INPUT_LOG_MAGIC, sizeof(INPUT_LOG_MAGIC));
+  header.version = INPUT_LOG_VERSION;
+  header.eventSize = sizeof(InputEvent);
+  header.seed = seed;
+  header.eventCount = static_cast<std::uint32_t>(events.size());
+
+  std::ofstream file{ filename, std::ios::binary | std::ios::trunc };
+  if (!file) {
+    std::cerr << "Could not open input log: " << filename << std::endl;
+    return false;
+  }
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(events.data()),
+    static_cast<std::streamsize>(events.size() * sizeof(InputEvent)));
+  if (!file) {
+    std::cerr << "Write error: " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool InputLog::load(const char* filename) {
+  std::ifstream file{ filename, std::ios::binary };
+  if (!file) {
+    std::cerr << "Could not open input log: " << filename << std::endl;
+    return false;
+  }
+
+  InputLogHeader header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file || std::memcmp(header.magic, INPUT_LOG_MAGIC, sizeof(INPUT_LOG_MAGIC)) != 0) {
+    std::cerr << "Not an input log: " << filename << std::endl;
+    return false;
+  }
+  if (header.version != INPUT_LOG_VERSION || header.eventSize != sizeof(InputEvent)) {
+    std::cerr << "Unsupported input log version " << header.version << std::endl;
+    return false;
+  }
+
+  events.resize(header.eventCount);
+  file.read(reinterpret_cast<char*>(events.data()),
+    static_cast<std::streamsize>(events.size() * sizeof(InputEvent)));
+  if (!file) {
+    std::cerr << "Input log is truncated: " << filename << std::endl;
+    events.clear();
+    return false;
+  }
+  seed = header.seed;
+  return true;
+}
+
+Chip8::StopReason InputLog::replay(Chip8& chip8) const {
+  chip8.seed(seed);
+
+  for (const InputEvent& event : events) {
+    // Run flat out up to the cycle the event was recorded at.
+    while (chip8.getCycles() < event.cycle) {
+      std::uint64_t left = event.cycle - chip8.getCycles();
+      Chip8::RunResult result = chip8.runCycles(left > UINT_MAX ? UINT_MAX : static_cast<unsigned int>(left));
+      if (result.reason != Chip8::StopReason::CyclesDone) {
+        // The recording moved on from here, so FX0A cannot still be waiting
+        // unless the runs no longer match.
+        return result.reason;
+      }
+    }
+
+    switch (event.type) {
+      case InputEvent::KEY_DOWN:
+        chip8.pressKeys(static_cast<unsigned char>(event.value));
+        break;
+      case InputEvent::KEY_UP:
+        chip8.releaseKeys(static_cast<unsigned char>(event.value));
+        break;
+      case InputEvent::TIMER_TICK:
+        chip8.tickTimers(event.value);
+        break;
+    }
+  }
+
+  return Chip8::StopReason::CyclesDone;
+}
@@ -0,0 +1,61 @@
+#ifndef REPLAY_HPP
+#define REPLAY_HPP
+
+#include "chip8.hpp"
+#include <cstdint>
+#include <vector>
+
+// Something the host did to the machine, stamped with the number of
+// instructions retired when it happened. Key presses and timer ticks are the
+// only inputs a CHIP-8 has, so replaying them at the same cycles reproduces a
+// run exactly, however fast or slow the original host was.
+struct InputEvent {
+  enum Type : std::uint32_t {
+    KEY_DOWN,   // value is the key
+    KEY_UP,     // value is the key
+    TIMER_TICK, // value is the number of 60 Hz ticks
+  };
+
+  std::uint64_t cycle;
+  std::uint32_t type;
+  std::uint32_t value;
+};
+
+// Input log files are an InputLogHeader followed by raw InputEvents.
+struct InputLogHeader {
+  char magic[4];
+  std::uint16_t version;
+  std::uint16_t eventSize;
+  std::uint32_t seed;
+  std::uint32_t eventCount;
+};
+
+static constexpr char INPUT_LOG_MAGIC[4] = { 'C', '8', 'I', 'N' };
+static constexpr std::uint16_t INPUT_LOG_VERSION = 1;
+
+// Records the inputs of a run (see Chip8::setInputLog) and plays them back.
+class InputLog {
+public:
+  // Called by Chip8::setInputLog; starts a new recording.
+  void begin(std::uint32_t seed);
+  void record(const InputEvent& event) { events.push_back(event); }
+
+  bool save(const char* filename) const;
+  bool load(const char* filename);
+
+  // Reseeds chip8 and runs it from the start of the recording to the last
+  // event, feeding the inputs back in at the cycles they were recorded at.
+  // chip8 must be freshly loaded with the same ROM. Returns CyclesDone when
+  // the whole log was replayed, or why the run stopped before the end: a fault
+  // the original run hit too, or WaitingForKey if the run has diverged.
+  Chip8::StopReason replay(Chip8& chip8) const;
+
+  const std::vector<InputEvent>& getEvents() const { return events; }
+  std::uint32_t getSeed() const { return seed; }
+
+private:
+  std::vector<InputEvent> events;
+  std::uint32_t seed = 0;
+};
+
+#endif
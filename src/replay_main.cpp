@@ -0,0 +1,108 @@
+#include "replay.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// Plays an input log recorded by the frontend back against its ROM as fast
+// as the host allows, and prints the final machine state so runs can be
+// compared. With a repeat count, the replay is run that many times on fresh
+// machines and every run has to end in the same state.
+//
+// Usage: chip8_replay <rom> <input log> [repeat]
+
+namespace {
+
+// Hashes the rows of the current resolution only.
+std::uint64_t hashFramebuffer(const Chip8::State& state) {
+  const std::size_t words = state.hires ? state.gfx.size() : Chip8::HEIGHT;
+  std::uint64_t hash = 14695981039346656037ull;
+  for (std::size_t i = 0; i < words; i++) {
+    hash ^= state.gfx[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+const char* describe(Chip8::StopReason reason) {
+  switch (reason) {
+    case Chip8::StopReason::CyclesDone:
+      return "complete";
+    case Chip8::StopReason::WaitingForKey:
+      return "diverged: waiting for a key the recording never waited for";
+    case Chip8::StopReason::IllegalOpcode:
+      return "illegal opcode";
+    case Chip8::StopReason::StackOverflow:
+      return "stack overflow";
+    case Chip8::StopReason::StackUnderflow:
+      return "stack underflow";
+    case Chip8::StopReason::Exited:
+      return "exited";
+    default:
+      return "stopped";
+  }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc != 3 && argc != 4) {
+    std::cerr << "Usage: " << argv[0] << " <rom> <input log> [repeat]\n";
+    return 1;
+  }
+  const int repeat = argc == 4 ? std::atoi(argv[3]) : 1;
+  if (repeat < 1) {
+    std::cerr << "Repeat count must be at least 1\n";
+    return 1;
+  }
+
+  InputLog log;
+  if (!log.load(argv[2])) {
+    return 1;
+  }
+  std::uint64_t ticks = 0;
+  for (const InputEvent& event : log.getEvents()) {
+    if (event.type == InputEvent::TIMER_TICK) {
+      ticks += event.value;
+    }
+  }
+
+  Chip8::State first = {};
+  Chip8::StopReason reason = Chip8::StopReason::CyclesDone;
+  double seconds = 0;
+
+  for (int run = 0; run < repeat; run++) {
+    Chip8 chip8{ argv[1] };
+    auto start = std::chrono::steady_clock::now();
+    reason = log.replay(chip8);
+    seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Chip8::State state;
+    chip8.saveState(state);
+    if (run == 0) {
+      first = state;
+    } else if (std::memcmp(&state, &first, sizeof(state)) != 0) {
+      std::cerr << "Run " << run + 1 << " ended in a different state than run 1\n";
+      return 1;
+    }
+  }
+
+  std::printf("result:      %s\n", describe(reason));
+  std::printf("cycles:      %llu\n", static_cast<unsigned long long>(first.cycles));
+  std::printf("framebuffer: %016llx\n", static_cast<unsigned long long>(hashFramebuffer(first)));
+  std::printf("pc: %03X  I: %03X  V:", first.pc, first.I);
+  for (unsigned char v : first.V) {
+    std::printf(" %02X", v);
+  }
+  std::printf("\n");
+
+  // Recorded time is the number of 60 Hz ticks the host delivered.
+  const double recorded = ticks / 60.0;
+  const double perRun = seconds / repeat;
+  std::printf("replayed %.1f s of play in %.3f ms per run (%.0fx real time, %.1f MIPS)\n",
+    recorded, perRun * 1e3, perRun > 0 ? recorded / perRun : 0.0,
+    perRun > 0 ? first.cycles / perRun / 1e6 : 0.0);
+
+  return reason == Chip8::StopReason::CyclesDone ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+#include "rewind.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Encoded frames are a sequence of runs: one token word holding the number of
+// unchanged words in the high half and the number of changed words in the low
+// half, followed by the changed words XORed with the base.
+constexpr unsigned int RUN_SHIFT = 32;
+constexpr std::uint64_t LITERAL_MASK = 0xFFFFFFFF;
+// Words compared at once when skipping over unchanged parts of the state
+constexpr std::size_t SKIP_BLOCK = 32;
+
+} // namespace
+
+RewindBuffer::RewindBuffer(std::size_t budget, unsigned int keyframeInterval)
+  : budgetWords(budget / sizeof(std::uint64_t)),
+    usedWords(0),
+    frameCount(0),
+    keyframeInterval(keyframeInterval > 0 ? keyframeInterval : 1),
+    keyframe(),
+    scratch() {}
+
+std::size_t RewindBuffer::size() const {
+  return frameCount;
+}
+
+void RewindBuffer::clear() {
+  while (!groups.empty()) {
+    spare.push_back(std::move(groups.back()));
+    groups.pop_back();
+  }
+  usedWords = 0;
+  frameCount = 0;
+}
+
+void RewindBuffer::capture(const Chip8& chip8) {
+  Chip8::State state;
+  chip8.saveState(state);
+  std::memcpy(scratch.data(), &state, sizeof(state));
+
+  if (groups.empty() || groups.back().frames.size() >= keyframeInterval) {
+    Group group;
+    if (!spare.empty()) {
+      group = std::move(spare.back());
+      spare.pop_back();
+    }
+    group.used = 0;
+    group.frames.clear();
+    groups.push_back(std::move(group));
+
+    keyframe = scratch;
+    static const Words zero = {};
+    append(groups.back(), scratch, zero);
+  } else {
+    append(groups.back(), scratch, keyframe);
+  }
+
+  Group& group = groups.back();
+  usedWords += group.used - group.frames.back();
+  frameCount++;
+
+  // Always keep the newest group, even if it alone is over budget.
+  while (usedWords > budgetWords && groups.size() > 1) {
+    Group& oldest = groups.front();
+    usedWords -= oldest.used;
+    frameCount -= oldest.frames.size();
+    spare.push_back(std::move(oldest));
+    groups.pop_front();
+  }
+}
+
+bool RewindBuffer::stepBack(Chip8& chip8) {
+  // The newest frame is the state the machine is already in.
+  if (frameCount < 2) {
+    return false;
+  }
+
+  Group& group = groups.back();
+  usedWords -= group.used - group.frames.back();
+  group.used = group.frames.back();
+  group.frames.pop_back();
+  frameCount--;
+
+  if (group.frames.empty()) {
+    spare.push_back(std::move(group));
+    groups.pop_back();
+
+    static const Words zero = {};
+    decode(groups.back().data.data(), zero, keyframe);
+  }
+
+  const Group& newest = groups.back();
+  if (newest.frames.size() == 1) {
+    load(keyframe, chip8);
+  } else {
+    decode(newest.data.data() + newest.frames.back(), keyframe, scratch);
+    load(scratch, chip8);
+  }
+  return true;
+}
+
+void RewindBuffer::load(const Words& words, Chip8& chip8) {
+  Chip8::State state;
+  std::memcpy(&state, words.data(), sizeof(state));
+  chip8.loadState(state);
+}
+
+void RewindBuffer::append(Group& group, const Words& state, const Words& base) {
+  // Grow geometrically so capacity is rarely touched once a few groups have
+  // been recycled.
+  if (group.data.size() < group.used + MAX_ENCODED) {
+    group.data.resize(std::max(group.data.size() * 2, group.used + MAX_ENCODED));
+  }
+  group.frames.push_back(group.used);
+  group.used += encode(state, base, group.data.data() + group.used);
+}
+
+std::size_t RewindBuffer::encode(const Words& state, const Words& base, std::uint64_t* out) {
+  std::uint64_t* const begin = out;
+  std::size_t i = 0;
+  while (i < WORDS) {
+    std::size_t first = i;
+    // Most of a delta is unchanged, so skip it a block of words at a time:
+    // memcmp is vectorised, which more than halves the cost of a capture.
+    while (i + SKIP_BLOCK <= WORDS &&
+           std::memcmp(&state[i], &base[i], SKIP_BLOCK * sizeof(std::uint64_t)) == 0) {
+      i += SKIP_BLOCK;
+    }
+    while (i + 4 <= WORDS &&
+           ((state[i] ^ base[i]) | (state[i + 1] ^ base[i + 1]) |
+            (state[i + 2] ^ base[i + 2]) | (state[i + 3] ^ base[i + 3])) == 0) {
+      i += 4;
+    }
+    while (i < WORDS && state[i] == base[i]) {
+      i++;
+    }
+    std::uint64_t* token = out++;
+    std::size_t unchanged = i - first;
+
+    first = i;
+    while (i < WORDS && state[i] != base[i]) {
+      *out++ = state[i] ^ base[i];
+      i++;
+    }
+    *token = std::uint64_t{ unchanged } << RUN_SHIFT | (i - first);
+  }
+  return out - begin;
+}
+
+void RewindBuffer::decode(const std::uint64_t* in, const Words& base, Words& out) {
+  std::size_t i = 0;
+  while (i < WORDS) {
+    std::uint64_t token = *in++;
+    std::size_t unchanged = token >> RUN_SHIFT;
+    std::size_t changed = token & LITERAL_MASK;
+
+    for (std::size_t j = 0; j < unchanged; j++, i++) {
+      out[i] = base[i];
+    }
+    for (std::size_t j = 0; j < changed; j++, i++) {
+      out[i] = base[i] ^ *in++;
+    }
+  }
+}
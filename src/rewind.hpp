@@ -0,0 +1,66 @@
+#ifndef REWIND_HPP
+#define REWIND_HPP
+
+#include "chip8.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Keeps one Chip8::State per frame so gameplay can be stepped backwards.
+//
+// Frames are grouped behind a keyframe. Each frame is stored as the XOR of its
+// state with the group's keyframe, run-length encoded a word at a time: memory
+// and the framebuffer barely change from frame to frame, so a delta is mostly
+// one long run of zero words. Once the encoded frames exceed the memory budget
+// the oldest group is dropped as a whole.
+class RewindBuffer {
+public:
+  // budget: bytes of encoded frames to keep. keyframeInterval: frames per
+  // group, i.e. one full (but still run-length encoded) state every N frames.
+  explicit RewindBuffer(std::size_t budget, unsigned int keyframeInterval = 60);
+
+  // Records the current state as the newest frame.
+  void capture(const Chip8& chip8);
+  // Drops the newest frame and restores the one before it. Returns false when
+  // there is nothing older to go back to.
+  bool stepBack(Chip8& chip8);
+  std::size_t size() const;
+  void clear();
+
+private:
+  static constexpr std::size_t WORDS = (sizeof(Chip8::State) + 7) / 8;
+  using Words = std::array<std::uint64_t, WORDS>;
+
+  // Worst case for one encoded frame: every word changed, plus run tokens
+  static constexpr std::size_t MAX_ENCODED = WORDS + WORDS / 2 + 2;
+
+  struct Group {
+    // Encoded keyframe followed by the encoded deltas against it. Only the
+    // first `used` words are meaningful; the rest is room to encode into.
+    std::vector<std::uint64_t> data;
+    std::size_t used = 0;
+    // Offset of each frame in data; frame 0 is the keyframe itself
+    std::vector<std::size_t> frames;
+  };
+
+  std::deque<Group> groups;
+  // Evicted groups, kept so their buffers can be reused without allocating
+  std::vector<Group> spare;
+  std::size_t budgetWords;
+  std::size_t usedWords;
+  std::size_t frameCount;
+  unsigned int keyframeInterval;
+
+  // Decoded keyframe of the newest group, the base for new deltas
+  Words keyframe;
+  Words scratch;
+
+  void load(const Words& words, Chip8& chip8);
+  static void append(Group& group, const Words& state, const Words& base);
+  static std::size_t encode(const Words& state, const Words& base, std::uint64_t* out);
+  static void decode(const std::uint64_t* in, const Words& base, Words& out);
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include "rom_cache.hpp"
+#include "bits.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CHIP8_HAVE_MMAP 1
+#endif
+
+namespace {
+
+constexpr std::size_t ROM_START = 0x200;
+constexpr std::size_t MAX_ROM_SIZE = sizeof(Chip8::State::memory) - ROM_START;
+
+} // namespace
+
+RomCache& RomCache::shared() {
+  static RomCache cache;
+  return cache;
+}
+
+std::shared_ptr<const RomImage> RomCache::load(const char* filename) {
+  std::lock_guard<std::mutex> guard{ lock };
+  auto found = byPath.find(filename);
+  if (found != byPath.end()) {
+    return found->second;
+  }
+
+  std::shared_ptr<const RomImage> image;
+#ifdef CHIP8_HAVE_MMAP
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Could not open game file: " << filename << std::endl;
+    return nullptr;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < 0) {
+    std::cerr << "Failed to determine file size\n";
+    close(fd);
+    return nullptr;
+  }
+  std::size_t size = static_cast<std::size_t>(info.st_size);
+  if (size > MAX_ROM_SIZE) {
+    std::cerr << "Game file too large to fit in memory\n";
+    close(fd);
+    return nullptr;
+  }
+  if (size == 0) {
+    close(fd);
+    image = addLocked(nullptr, 0);
+  } else {
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      std::cerr << "Could not map game file: " << filename << std::endl;
+      return nullptr;
+    }
+    image = addLocked(static_cast<const unsigned char*>(data), size);
+    munmap(data, size);
+  }
+#else
+  std::ifstream file{ filename, std::ios::binary | std::ios::ate };
+  if (!file) {
+    std::cerr << "Could not open game file: " << filename << std::endl;
+    return nullptr;
+  }
+  std::streamoff pos = file.tellg();
+  if (pos < 0) {
+    std::cerr << "Failed to determine file size\n";
+    return nullptr;
+  }
+  std::size_t size = static_cast<std::size_t>(pos);
+  if (size > MAX_ROM_SIZE) {
+    std::cerr << "Game file too large to fit in memory\n";
+    return nullptr;
+  }
+  std::vector<unsigned char> data(size);
+  file.seekg(0, std::ios::beg);
+  file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(size));
+  if (static_cast<std::size_t>(file.gcount()) != size) {
+    std::cerr << "Read error: only " << file.gcount() << " bytes were read\n";
+    return nullptr;
+  }
+  image = addLocked(data.data(), size);
+#endif
+
+  byPath.emplace(filename, image);
+  return image;
+}
+
+std::shared_ptr<const RomImage> RomCache::add(const unsigned char* rom, std::size_t size) {
+  if (size > MAX_ROM_SIZE) {
+    std::cerr << "Game file too large to fit in memory\n";
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> guard{ lock };
+  return addLocked(rom, size);
+}
+
+std::size_t RomCache::size() {
+  std::lock_guard<std::mutex> guard{ lock };
+  return byHash.size();
+}
+
+std::shared_ptr<const RomImage> RomCache::addLocked(const unsigned char* rom, std::size_t size) {
+  const std::uint64_t hash = fnv1a(rom, size);
+  auto candidates = byHash.equal_range(hash);
+  for (auto it = candidates.first; it != candidates.second; ++it) {
+    const RomImage& known = *it->second;
+    if (known.size == size && (size == 0 || std::memcmp(known.boot.memory + ROM_START, rom, size) == 0)) {
+      return it->second;
+    }
+  }
+
+  auto image = std::make_shared<RomImage>();
+  image->hash = hash;
+  image->size = size;
+  Chip8::bootState(image->boot, rom, size, variantFor(hash));
+  byHash.emplace(hash, image);
+  return image;
+}
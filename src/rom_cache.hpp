@@ -0,0 +1,46 @@
+#ifndef ROM_CACHE_HPP
+#define ROM_CACHE_HPP
+
+#include "chip8.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// A ROM together with the machine it boots into: font in low memory, the ROM
+// at 0x200 and every register at its power-on value. Booting or resetting a
+// Chip8 from it is a single copy of the State block.
+struct RomImage {
+  std::uint64_t hash; // FNV-1a of the ROM bytes
+  std::size_t size;
+  Chip8::State boot;
+};
+
+// Loads each ROM once per process and hands out shared, immutable images of
+// it. Files are looked up by path first and then by content, so the same ROM
+// under two names is kept once. Safe to use from several threads.
+class RomCache {
+public:
+  // The cache behind Chip8(filename) and Chip8::loadGame.
+  static RomCache& shared();
+
+  // Returns the image of the ROM in filename, reading the file only the first
+  // time it is asked for. Later changes to the file are not picked up.
+  // nullptr if the file cannot be read or does not fit in memory.
+  std::shared_ptr<const RomImage> load(const char* filename);
+  // Same for a ROM already in memory.
+  std::shared_ptr<const RomImage> add(const unsigned char* rom, std::size_t size);
+
+  std::size_t size();
+
+private:
+  std::mutex lock;
+  std::unordered_map<std::string, std::shared_ptr<const RomImage>> byPath;
+  std::unordered_multimap<std::uint64_t, std::shared_ptr<const RomImage>> byHash;
+
+  std::shared_ptr<const RomImage> addLocked(const unsigned char* rom, std::size_t size);
+};
+
+#endif
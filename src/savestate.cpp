@@ -0,0 +1,173 @@
+#include "chip8.hpp"
+#include "bits.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CHIP8_HAVE_MMAP 1
+#endif
+
+// Save states: the in-memory path is a copy of Chip8::State, and the file
+// format is that same block behind a header, so loading a file is a matter of
+// mapping it, checking the header and copying the block in.
+
+static_assert(std::is_trivially_copyable<Chip8::State>::value,
+  "Chip8::State must stay a plain block of bytes");
+
+namespace {
+
+struct SaveFileHeader {
+  char magic[4];
+  std::uint16_t version;
+  std::uint16_t headerSize;
+  std::uint32_t stateSize;
+  std::uint32_t reserved;
+  std::uint64_t checksum; // FNV-1a over the State bytes
+};
+
+constexpr char SAVE_MAGIC[4] = { 'C', '8', 'S', 'T' };
+// Bump whenever the layout of Chip8::State changes.
+constexpr std::uint16_t SAVE_VERSION = 4;
+
+// Checks a complete save file image and returns its State block, or nullptr.
+const Chip8::State* validate(const unsigned char* data, std::size_t size, const char* filename) {
+  SaveFileHeader header;
+  if (size < sizeof(header)) {
+    std::cerr << "Save file too small: " << filename << std::endl;
+    return nullptr;
+  }
+  std::memcpy(&header, data, sizeof(header));
+
+  if (std::memcmp(header.magic, SAVE_MAGIC, sizeof(SAVE_MAGIC)) != 0) {
+    std::cerr << "Not a save file: " << filename << std::endl;
+    return nullptr;
+  }
+  if (header.version != SAVE_VERSION || header.headerSize != sizeof(header) ||
+      header.stateSize != sizeof(Chip8::State) ||
+      size != sizeof(header) + sizeof(Chip8::State)) {
+    std::cerr << "Unsupported save file version " << header.version << std::endl;
+    return nullptr;
+  }
+
+  const unsigned char* state = data + sizeof(header);
+  if (fnv1a(state, sizeof(Chip8::State)) != header.checksum) {
+    std::cerr << "Save file is corrupt: " << filename << std::endl;
+    return nullptr;
+  }
+
+  // A matching checksum only means the file is intact, not that it came from
+  // a machine: the core indexes the stack and per-variant tables with these
+  // without checking them again.
+  const Chip8::State* snapshot = reinterpret_cast<const Chip8::State*>(state);
+  unsigned char hires;
+  std::memcpy(&hires, &snapshot->hires, sizeof(hires));
+  if (snapshot->sp > sizeof(snapshot->stack) / sizeof(snapshot->stack[0]) ||
+      static_cast<unsigned int>(snapshot->variant) > static_cast<unsigned int>(Variant::XoChip) ||
+      snapshot->pc > 0x0FFF || snapshot->I > 0x0FFF || hires > 1) {
+    std::cerr << "Save file holds an impossible machine: " << filename << std::endl;
+    return nullptr;
+  }
+  return snapshot;
+}
+
+} // namespace
+
+void Chip8::saveState(State& snapshot) const {
+  std::memcpy(&snapshot, &state, sizeof(State));
+}
+
+void Chip8::loadState(const State& snapshot) {
+  std::memcpy(&state, &snapshot, sizeof(State));
+
+  // Nothing decoded or translated from the old memory can be trusted.
+  invalidateAll();
+
+  dirtyRows = ~std::uint64_t{ 0 };
+  stop = StopReason::CyclesDone;
+  frameCyclesLeft = cyclesPerFrame;
+}
+
+bool Chip8::saveState(const char* filename) const {
+  // pc and I can run past 0xFFF, but every use wraps them, so storing them
+  // wrapped changes nothing and keeps them within what loading accepts.
+  State saved;
+  std::memcpy(&saved, &state, sizeof(State));
+  saved.pc &= 0x0FFF;
+  saved.I &= 0x0FFF;
+
+  SaveFileHeader header = {};
+  std::memcpy(header.magic, SAVE_MAGIC, sizeof(SAVE_MAGIC));
+  header.version = SAVE_VERSION;
+  header.headerSize = sizeof(header);
+  header.stateSize = sizeof(State);
+  header.checksum = fnv1a(&saved, sizeof(State));
+
+  std::ofstream file{ filename, std::ios::binary | std::ios::trunc };
+  if (!file) {
+    std::cerr << "Could not open save file: " << filename << std::endl;
+    return false;
+  }
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(&saved), sizeof(State));
+  if (!file) {
+    std::cerr << "Write error: " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool Chip8::loadState(const char* filename) {
+#ifdef CHIP8_HAVE_MMAP
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Could not open save file: " << filename << std::endl;
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+    std::cerr << "Failed to determine file size\n";
+    close(fd);
+    return false;
+  }
+  std::size_t size = static_cast<std::size_t>(info.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << "Could not map save file: " << filename << std::endl;
+    return false;
+  }
+
+  const State* snapshot = validate(static_cast<const unsigned char*>(data), size, filename);
+  if (snapshot) {
+    loadState(*snapshot);
+  }
+  munmap(data, size);
+  return snapshot != nullptr;
+#else
+  std::ifstream file{ filename, std::ios::binary | std::ios::ate };
+  if (!file) {
+    std::cerr << "Could not open save file: " << filename << std::endl;
+    return false;
+  }
+  std::streamoff pos = file.tellg();
+  if (pos <= 0) {
+    std::cerr << "Failed to determine file size\n";
+    return false;
+  }
+  std::vector<unsigned char> data(static_cast<std::size_t>(pos));
+  file.seekg(0, std::ios::beg);
+  file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+
+  const State* snapshot = validate(data.data(), data.size(), filename);
+  if (snapshot) {
+    loadState(*snapshot);
+  }
+  return snapshot != nullptr;
+#endif
+}
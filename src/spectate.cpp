@@ -0,0 +1,286 @@
+#include "spectate.hpp"
+#include "capture.hpp"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define CHIP8_HAVE_EPOLL 1
+#endif
+
+#ifdef CHIP8_HAVE_EPOLL
+
+namespace {
+
+struct Viewer {
+  int fd;
+  // What the viewer has been sent, which the next delta is against
+  Chip8::Framebuffer sent;
+  bool keyframe;  // next frame goes out against a blank one
+  bool writable;  // waiting on EPOLLOUT
+  std::vector<unsigned char> pending;
+  std::size_t written;
+};
+
+void watch(int epoll, Viewer& viewer, bool writable) {
+  epoll_event event = {};
+  event.events = writable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+  event.data.fd = viewer.fd;
+  epoll_ctl(epoll, EPOLL_CTL_MOD, viewer.fd, &event);
+  viewer.writable = writable;
+}
+
+// Writes as much of the viewer's pending bytes as the socket takes without
+// blocking. Returns false if the viewer has gone away.
+bool flush(int epoll, Viewer& viewer) {
+  while (viewer.written < viewer.pending.size()) {
+    const ssize_t sent = send(viewer.fd, viewer.pending.data() + viewer.written,
+      viewer.pending.size() - viewer.written, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent > 0) {
+      viewer.written += static_cast<std::size_t>(sent);
+    } else if (sent < 0 && errno == EINTR) {
+      continue;
+    } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (!viewer.writable) {
+        watch(epoll, viewer, true);
+      }
+      return true;
+    } else {
+      return false;
+    }
+  }
+  viewer.pending.clear();
+  viewer.written = 0;
+  if (viewer.writable) {
+    watch(epoll, viewer, false);
+  }
+  return true;
+}
+
+// Queues frame for the viewer unless it is still taking the previous one, or
+// already has this one. Returns false if the viewer has gone away.
+bool offer(int epoll, Viewer& viewer, std::uint64_t cycle, const Chip8::Framebuffer& framebuffer, bool hires) {
+  if (!viewer.pending.empty() || (!viewer.keyframe && viewer.sent == framebuffer)) {
+    return true;
+  }
+
+  unsigned char delta[MAX_FRAME_DELTA];
+  static const Chip8::Framebuffer blank = {};
+  CaptureFrameHeader header = {};
+  header.cycle = cycle;
+  header.size = static_cast<std::uint32_t>(
+    encodeFrameDelta(viewer.keyframe ? blank : viewer.sent, framebuffer, delta));
+  header.hires = hires;
+  header.keyframe = viewer.keyframe;
+
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&header);
+  viewer.pending.insert(viewer.pending.end(), bytes, bytes + sizeof(header));
+  viewer.pending.insert(viewer.pending.end(), delta, delta + header.size);
+  viewer.sent = framebuffer;
+  viewer.keyframe = false;
+  return flush(epoll, viewer);
+}
+
+} // namespace
+
+SpectatorServer::SpectatorServer(const char* path)
+  : path(path), listener(-1), epoll(-1), wakeup(-1), offered(), viewers(0), running(true) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (std::strlen(path) >= sizeof(address.sun_path)) {
+    std::cerr << "Socket path too long: " << path << std::endl;
+    return;
+  }
+  std::strcpy(address.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  unlink(path);
+  if (fd < 0 || bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    std::cerr << "Could not listen on " << path << ": " << std::strerror(errno) << std::endl;
+    if (fd >= 0) {
+      close(fd);
+    }
+    return;
+  }
+
+  epoll = epoll_create1(EPOLL_CLOEXEC);
+  wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epoll < 0 || wakeup < 0) {
+    std::cerr << "Could not set up spectating: " << std::strerror(errno) << std::endl;
+    close(fd);
+    return;
+  }
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+  event.data.fd = wakeup;
+  epoll_ctl(epoll, EPOLL_CTL_ADD, wakeup, &event);
+
+  listener = fd;
+  server = std::thread(&SpectatorServer::serve, this);
+}
+
+SpectatorServer::~SpectatorServer() {
+  running = false;
+  if (server.joinable()) {
+    const std::uint64_t one = 1;
+    (void)!write(wakeup, &one, sizeof(one));
+    server.join();
+  }
+  if (listener >= 0) {
+    close(listener);
+    unlink(path.c_str());
+  }
+  if (epoll >= 0) {
+    close(epoll);
+  }
+  if (wakeup >= 0) {
+    close(wakeup);
+  }
+}
+
+void SpectatorServer::publish(const Chip8& chip8) {
+  if (listener < 0 || (chip8.isHires() == offered.hires && chip8.getFramebuffer() == offered.framebuffer)) {
+    return;
+  }
+  offered = { chip8.getCycles(), chip8.getFramebuffer(), chip8.isHires() };
+  frames.back() = offered;
+  frames.publish();
+
+  const std::uint64_t one = 1;
+  (void)!write(wakeup, &one, sizeof(one));
+}
+
+void SpectatorServer::serve() {
+  std::map<int, Viewer> connected;
+  Frame latest = {};
+  bool started = false; // latest holds a published frame
+
+  auto drop = [&](int fd) {
+    epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connected.erase(fd);
+    viewers.store(static_cast<unsigned int>(connected.size()), std::memory_order_relaxed);
+  };
+
+  epoll_event events[64];
+  while (running.load(std::memory_order_acquire)) {
+    const int count = epoll_wait(epoll, events, 64, -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "Spectating stopped: " << std::strerror(errno) << std::endl;
+      break;
+    }
+
+    bool fresh = false;
+    for (int i = 0; i < count; i++) {
+      const int fd = events[i].data.fd;
+      if (fd == wakeup) {
+        std::uint64_t value;
+        (void)!read(wakeup, &value, sizeof(value));
+        fresh = true;
+        continue;
+      }
+
+      if (fd == listener) {
+        for (int client; (client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0;) {
+          Viewer& viewer = connected[client];
+          viewer = { client, {}, true, false, {}, 0 };
+          epoll_event event = {};
+          event.events = EPOLLIN;
+          event.data.fd = client;
+          epoll_ctl(epoll, EPOLL_CTL_ADD, client, &event);
+
+          const CaptureFileHeader header = {
+            { CAPTURE_MAGIC[0], CAPTURE_MAGIC[1], CAPTURE_MAGIC[2], CAPTURE_MAGIC[3] },
+            CAPTURE_VERSION,
+            sizeof(CaptureFrameHeader)
+          };
+          const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&header);
+          viewer.pending.assign(bytes, bytes + sizeof(header));
+          if (!flush(epoll, viewer) ||
+              (started && !offer(epoll, viewer, latest.cycle, latest.framebuffer, latest.hires))) {
+            drop(client);
+          }
+        }
+        viewers.store(static_cast<unsigned int>(connected.size()), std::memory_order_relaxed);
+        continue;
+      }
+
+      auto found = connected.find(fd);
+      if (found == connected.end()) {
+        continue;
+      }
+      Viewer& viewer = found->second;
+      bool alive = !(events[i].events & EPOLLERR);
+
+      if (alive && (events[i].events & (EPOLLIN | EPOLLHUP))) {
+        // Anything a viewer writes is a request; only keyframes exist so far.
+        char requests[64];
+        ssize_t received;
+        while ((received = recv(fd, requests, sizeof(requests), MSG_DONTWAIT)) > 0) {
+          if (std::memchr(requests, SPECTATE_KEYFRAME_REQUEST, static_cast<std::size_t>(received))) {
+            viewer.keyframe = true;
+          }
+        }
+        if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+          alive = false;
+        }
+      }
+      if (alive && (events[i].events & EPOLLOUT)) {
+        alive = flush(epoll, viewer);
+      }
+      // Catch the viewer up now rather than on the next frame, which may never
+      // come if the machine has stopped drawing: after a keyframe request, or
+      // once it has taken what it was behind on.
+      if (alive && started) {
+        alive = offer(epoll, viewer, latest.cycle, latest.framebuffer, latest.hires);
+      }
+      if (!alive) {
+        drop(fd);
+      }
+    }
+
+    if (fresh && frames.acquire()) {
+      latest = frames.front();
+      started = true;
+      for (auto it = connected.begin(); it != connected.end();) {
+        const int fd = (it++)->first;
+        if (!offer(epoll, connected[fd], latest.cycle, latest.framebuffer, latest.hires)) {
+          drop(fd);
+        }
+      }
+    }
+  }
+
+  for (auto& entry : connected) {
+    close(entry.first);
+  }
+  viewers = 0;
+}
+
+#else
+
+SpectatorServer::SpectatorServer(const char* path)
+  : path(path), listener(-1), epoll(-1), wakeup(-1), offered(), viewers(0), running(false) {
+  std::cerr << "Spectating is not supported on this platform\n";
+}
+
+SpectatorServer::~SpectatorServer() {}
+
+void SpectatorServer::publish(const Chip8&) {}
+
+void SpectatorServer::serve() {}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef SPECTATE_HPP
+#define SPECTATE_HPP
+
+#include "chip8.hpp"
+#include "handoff.hpp"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+// Streams the frames of a running machine to any number of local viewers over
+// a Unix domain socket, so long-running instances can be watched without a
+// window each.
+//
+// The stream is exactly a capture file (see capture.hpp): a CaptureFileHeader,
+// then frames as deltas against the last frame that viewer was sent. It can be
+// saved and expanded with chip8_capture like any other capture. Joining counts
+// as requesting a keyframe, so a viewer can join mid-stream; after that it can
+// write SPECTATE_KEYFRAME_REQUEST at any time to have the current frame sent
+// again as a keyframe.
+//
+// The emulation thread only hands the newest frame to a triple buffer and
+// wakes the server thread, which fans it out with non-blocking writes. A viewer
+// that has not taken the previous frame yet is skipped: it misses frames, and
+// gets a delta against the last one it did take, rather than holding anything
+// up. Linux only (epoll); elsewhere the server never opens.
+static constexpr char SPECTATE_KEYFRAME_REQUEST = 'K';
+
+class SpectatorServer {
+public:
+  // Listens on path, replacing any socket file already there.
+  explicit SpectatorServer(const char* path);
+  ~SpectatorServer();
+
+  SpectatorServer(const SpectatorServer&) = delete;
+  SpectatorServer& operator=(const SpectatorServer&) = delete;
+
+  bool isOpen() const { return listener >= 0; }
+
+  // Offers viewers the machine's current frame, if it differs from the last
+  // one offered. Never blocks.
+  void publish(const Chip8& chip8);
+
+  // Viewers connected right now.
+  unsigned int getViewers() const { return viewers.load(std::memory_order_relaxed); }
+
+private:
+  struct Frame {
+    std::uint64_t cycle;
+    Chip8::Framebuffer framebuffer;
+    bool hires;
+  };
+
+  std::string path;
+  int listener;
+  int epoll;
+  int wakeup; // eventfd the emulation thread pokes after publishing
+  TripleBuffer<Frame> frames;
+  // The last frame offered, to skip waking the server for nothing. Only the
+  // emulation thread touches it.
+  Frame offered;
+  std::atomic<unsigned int> viewers;
+  std::atomic<bool> running;
+  std::thread server;
+
+  void serve();
+};
+
+#endif
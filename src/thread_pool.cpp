@@ -0,0 +1,100 @@
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(unsigned int threads)
+  : nextQueue(0), pending(0), queued(0), stopping(false) {
+  if (threads == 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+  if (threads == 0) {
+    threads = 1;
+  }
+
+  for (unsigned int i = 0; i < threads; i++) {
+    queues.push_back(std::make_unique<Queue>());
+  }
+  for (unsigned int i = 0; i < threads; i++) {
+    workers.emplace_back(&ThreadPool::work, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  wait();
+  {
+    std::lock_guard<std::mutex> guard{ stateLock };
+    stopping = true;
+  }
+  workAvailable.notify_all();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+  Queue& queue = *queues[nextQueue++ % queues.size()];
+  {
+    std::lock_guard<std::mutex> guard{ queue.lock };
+    queue.jobs.push_back(std::move(job));
+  }
+  {
+    std::lock_guard<std::mutex> guard{ stateLock };
+    pending++;
+    queued++;
+  }
+  workAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> guard{ stateLock };
+  allDone.wait(guard, [this] { return pending == 0; });
+}
+
+bool ThreadPool::take(unsigned int self, std::function<void()>& job) {
+  // Own queue first, newest job first: it is the one most likely still warm.
+  {
+    Queue& own = *queues[self];
+    std::lock_guard<std::mutex> guard{ own.lock };
+    if (!own.jobs.empty()) {
+      job = std::move(own.jobs.back());
+      own.jobs.pop_back();
+      return true;
+    }
+  }
+
+  // Then steal the oldest job of the next worker that has any.
+  for (std::size_t i = 1; i < queues.size(); i++) {
+    Queue& victim = *queues[(self + i) % queues.size()];
+    std::lock_guard<std::mutex> guard{ victim.lock };
+    if (!victim.jobs.empty()) {
+      job = std::move(victim.jobs.front());
+      victim.jobs.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::work(unsigned int self) {
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> guard{ stateLock };
+      workAvailable.wait(guard, [this] { return queued > 0 || stopping; });
+      if (queued == 0) {
+        return; // stopping with nothing left to do
+      }
+      queued--;
+    }
+
+    // A job was counted for us, so one is sitting in some queue; it may take
+    // a pass or two to find while other workers are stealing.
+    std::function<void()> job;
+    while (!take(self, job)) {
+      std::this_thread::yield();
+    }
+    job();
+
+    std::lock_guard<std::mutex> guard{ stateLock };
+    if (--pending == 0) {
+      allDone.notify_all();
+    }
+  }
+}
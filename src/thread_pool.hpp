@@ -0,0 +1,57 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own job queue. Jobs are dealt out
+// round-robin; a worker takes its newest job first and, once its queue is
+// empty, steals the oldest job from another worker. Emulation jobs vary a lot
+// in length (a ROM that halts on FX0A finishes almost at once), so stealing
+// keeps every core busy until the last job is done.
+class ThreadPool {
+public:
+  // threads == 0 uses one worker per hardware thread.
+  explicit ThreadPool(unsigned int threads = 0);
+  // Finishes every queued job before returning.
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  void submit(std::function<void()> job);
+  // Blocks until every submitted job has run.
+  void wait();
+
+  unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<std::function<void()>> jobs;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<unsigned int> nextQueue;
+
+  // Jobs submitted but not yet finished, and jobs not yet picked up
+  std::size_t pending;
+  std::size_t queued;
+  bool stopping;
+  std::mutex stateLock;
+  std::condition_variable workAvailable;
+  std::condition_variable allDone;
+
+  bool take(unsigned int self, std::function<void()>& job);
+  void work(unsigned int self);
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "trace.hpp"
+#include "chip8.hpp"
+#include <chrono>
+#include <iostream>
+
+Tracer::Tracer(const char* filename, Variant variant, std::size_t capacity)
+  : mask(0), head(0), tail(0), running(true), file(nullptr) {
+  std::size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  buffer.resize(size);
+  mask = size - 1;
+
+  file = std::fopen(filename, "wb");
+  if (!file) {
+    std::cerr << "Could not open trace file: " << filename << std::endl;
+    running = false;
+    return;
+  }
+
+  TraceFileHeader header = {
+    { TRACE_MAGIC[0], TRACE_MAGIC[1], TRACE_MAGIC[2], TRACE_MAGIC[3] },
+    TRACE_VERSION,
+    sizeof(TraceRecord),
+    static_cast<std::uint16_t>(variant)
+  };
+  std::fwrite(&header, sizeof(header), 1, file);
+
+  writer = std::thread(&Tracer::drain, this);
+}
+
+Tracer::~Tracer() {
+  running = false;
+  if (writer.joinable()) {
+    writer.join();
+  }
+  if (file) {
+    std::fclose(file);
+  }
+}
+
+void Tracer::drain() {
+  for (;;) {
+    // Read running before head, so everything recorded before shutdown is
+    // seen by the final pass.
+    bool stopping = !running.load(std::memory_order_acquire);
+    std::size_t h = head.load(std::memory_order_acquire);
+    std::size_t t = tail.load(std::memory_order_relaxed);
+
+    if (h == t) {
+      if (stopping) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    // Write up to the end of the buffer in one go; a wrapped range is picked up
+    // on the next pass.
+    std::size_t first = t & mask;
+    std::size_t count = h - t;
+    if (count > buffer.size() - first) {
+      count = buffer.size() - first;
+    }
+    std::fwrite(&buffer[first], sizeof(TraceRecord), count, file);
+    tail.store(t + count, std::memory_order_release);
+  }
+
+  std::fflush(file);
+}
+
+std::string Tracer::format(const TraceRecord& r, Variant variant) {
+  const unsigned int x = (r.opcode & 0x0F00) >> 8;
+  char line[80];
+  std::snprintf(line, sizeof(line), "%03X  %04X  %-16s  V%X=%02X VF=%02X I=%03X", r.pc, r.opcode,
+    Chip8::disassemble(r.opcode, variant).c_str(), x, r.vx, r.vf, r.I);
+  return line;
+}
@@ -0,0 +1,82 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include "quirks.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One executed instruction. Registers are sampled after the instruction ran,
+// which is enough to show what it changed: every opcode writes at most VX, VF
+// and I.
+struct TraceRecord {
+  std::uint16_t pc;
+  std::uint16_t opcode;
+  std::uint16_t I;
+  std::uint8_t vx;
+  std::uint8_t vf;
+};
+
+// Trace files are a TraceFileHeader followed by raw TraceRecords.
+struct TraceFileHeader {
+  char magic[4];
+  std::uint16_t version;
+  std::uint16_t recordSize;
+  // The machine's Variant, which decides what the opcodes mean.
+  std::uint16_t variant;
+};
+
+static constexpr char TRACE_MAGIC[4] = { 'C', '8', 'T', 'R' };
+static constexpr std::uint16_t TRACE_VERSION = 2;
+
+// Collects TraceRecords from the emulation thread into a lock-free
+// single-producer/single-consumer ring buffer, and drains them to a file from
+// a background thread. The emulation thread only ever writes the record and
+// bumps an index; when the writer falls a whole buffer behind, it waits rather
+// than dropping records.
+class Tracer {
+public:
+  // capacity is rounded up to a power of two. variant is the traced machine's,
+  // recorded for format.
+  Tracer(const char* filename, Variant variant, std::size_t capacity = 1 << 16);
+  ~Tracer();
+
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+
+  bool isOpen() const { return file != nullptr; }
+
+  // Does nothing if the file could not be opened, as nothing would drain it.
+  void record(const TraceRecord& r) {
+    if (!file) {
+      return;
+    }
+    std::size_t h = head.load(std::memory_order_relaxed);
+    while (h - tail.load(std::memory_order_acquire) > mask) {
+      std::this_thread::yield();
+    }
+    buffer[h & mask] = r;
+    head.store(h + 1, std::memory_order_release);
+  }
+
+  // One line for a record: where it ran, the instruction as the debugger
+  // lists it, and the registers it left behind.
+  static std::string format(const TraceRecord& r, Variant variant);
+
+private:
+  std::vector<TraceRecord> buffer;
+  std::size_t mask;
+  std::atomic<std::size_t> head;
+  std::atomic<std::size_t> tail;
+  std::atomic<bool> running;
+  std::FILE* file;
+  std::thread writer;
+
+  void drain();
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include "trace.hpp"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+// Turns a binary trace written by Tracer back into one line of text per
+// executed instruction.
+//
+// Usage: chip8_tracedump <trace file>
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " <trace file>\n";
+    return 1;
+  }
+
+  std::FILE* file = std::fopen(argv[1], "rb");
+  if (!file) {
+    std::cerr << "Could not open trace file: " << argv[1] << std::endl;
+    return 1;
+  }
+
+  TraceFileHeader header;
+  if (std::fread(&header, sizeof(header), 1, file) != 1 ||
+      std::memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+    std::cerr << "Not a trace file: " << argv[1] << std::endl;
+    std::fclose(file);
+    return 1;
+  }
+  if (header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+    std::cerr << "Unsupported trace version " << header.version << std::endl;
+    std::fclose(file);
+    return 1;
+  }
+  if (header.variant > static_cast<std::uint16_t>(Variant::XoChip)) {
+    std::cerr << "Unknown variant " << header.variant << " in " << argv[1] << std::endl;
+    std::fclose(file);
+    return 1;
+  }
+  const Variant variant = static_cast<Variant>(header.variant);
+
+  TraceRecord records[4096];
+  std::size_t count;
+  while ((count = std::fread(records, sizeof(TraceRecord), 4096, file)) > 0) {
+    for (std::size_t i = 0; i < count; i++) {
+      std::puts(Tracer::format(records[i], variant).c_str());
+    }
+  }
+
+  std::fclose(file);
+  return 0;
+}
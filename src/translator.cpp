@@ -0,0 +1,276 @@
+#include "chip8.hpp"
+#include "debug.hpp"
+#include "native.hpp"
+
+// Basic-block execution engine behind Chip8::runCycles.
+//
+// Straight-line code is translated once into a Block of pre-decoded handlers
+// and then executed without going back through the per-instruction dispatch.
+// Blocks end at anything that changes control flow or writes memory, so a
+// block never has to stop half way through. Once the ROM writes over code that
+// has been translated, the engine gives up and leaves the rest of the run to
+// the interpreter.
+//
+// Blocks compiled ahead of time (see native.hpp) take precedence over both
+// when a program is bound. Neither covers an instruction the debugger may stop
+// at; those are always interpreted.
+
+namespace {
+
+bool isSkip(unsigned short opcode) {
+  switch (opcode & 0xF000) {
+    case 0x3000:
+    case 0x4000:
+    case 0x5000:
+    case 0x9000:
+      return true;
+    case 0xE000:
+      return (opcode & 0x00FF) == 0x009E || (opcode & 0x00FF) == 0x00A1;
+  }
+  return false;
+}
+
+bool endsBlock(unsigned short opcode) {
+  switch (opcode & 0xF000) {
+    case 0x0000: // 00EE
+    case 0x1000:
+    case 0x2000:
+    case 0xB000:
+      return true;
+    case 0xF000:
+      return (opcode & 0x00FF) == 0x0033 || (opcode & 0x00FF) == 0x0055;
+  }
+  return false;
+}
+
+// Instructions that may leave pc where it is must start their own block, so
+// re-entering the block does not replay the instructions before them.
+bool needsOwnBlock(unsigned short opcode) {
+  return (opcode & 0xF0FF) == 0xF00A || opcode == 0x00FD;
+}
+
+} // namespace
+
+Chip8::RunResult Chip8::runCycles(unsigned int count) {
+  unsigned int executed = 0;
+  stop = StopReason::CyclesDone;
+  selfModifying = false;
+  if (debugger) {
+    debugger->sync();
+  }
+  // emulateCycle() may have written over code since the last run.
+  checkCodeWritten();
+
+  while (executed < count) {
+    short index = NO_BLOCK;
+    bool observed = false;
+#if CHIP8_TRACE
+    observed = observed || tracer;
+#endif
+#if CHIP8_PROFILE
+    observed = observed || profiler;
+#endif
+
+    if (!nativeIndex.empty() && !observed) {
+      const NativeBlock* block = nativeIndex[state.pc & 0x0FFF];
+      if (block && block->cycles <= count - executed) {
+        if (block->idleRegister >= 0 && state.delay_timer > 0) {
+          skipIdleLoop(block->start, block->cycles, static_cast<unsigned char>(block->idleRegister),
+            count - executed, executed);
+          continue;
+        }
+        // Compiled blocks count only what they retired, so unlike translated
+        // ones there is nothing to take back when the last one stops.
+        executed += block->run(state, *this);
+        checkCodeWritten();
+        if (stop != StopReason::CyclesDone) {
+          break;
+        }
+        continue;
+      }
+    }
+
+    if (!selfModifying && !observed) {
+      index = blockIndex[state.pc & 0x0FFF];
+      if (index == NO_BLOCK) {
+        index = translate(state.pc & 0x0FFF);
+      }
+    }
+    if (index == NO_BLOCK || blocks[index].cycles > count - executed) {
+      emulateCycle();
+      checkCodeWritten();
+      if (stop != StopReason::CyclesDone) {
+        break;
+      }
+      executed++;
+      continue;
+    }
+
+    const Block& block = blocks[index];
+    if (block.idleLoop && state.delay_timer > 0) {
+      skipIdleLoop(block.start, block.cycles, block.ops[0].first.x, count - executed, executed);
+      continue;
+    }
+
+    for (const BlockOp& op : block.ops) {
+      unsigned int retired = 1;
+      if (op.fused) {
+        retired = op.fused(*this, op);
+      } else {
+        op.first.handler(*this, op.first);
+      }
+      executed += retired;
+    }
+
+    checkCodeWritten();
+    if (stop != StopReason::CyclesDone) {
+      // Only the last instruction of a block can stop, and it did not retire.
+      executed--;
+      break;
+    }
+  }
+
+  state.cycles += executed;
+  return { stop, executed };
+}
+
+Chip8::RunResult Chip8::runFrame() {
+  RunResult result = runCycles(frameCyclesLeft);
+  frameCyclesLeft -= result.cycles;
+
+  if (result.reason == StopReason::CyclesDone ||
+      result.reason == StopReason::WaitingForKey) {
+    frameCyclesLeft = cyclesPerFrame;
+    tickTimers();
+    if (result.reason == StopReason::CyclesDone) {
+      result.reason = StopReason::FrameComplete;
+    }
+  }
+
+  return result;
+}
+
+void Chip8::setCyclesPerFrame(unsigned int cycles) {
+  cyclesPerFrame = cycles;
+  frameCyclesLeft = cycles;
+}
+
+void Chip8::checkCodeWritten() {
+  // Compiled blocks are checked against memory as they are bound, so only the
+  // ones written over drop out.
+  if (nativeWritten) {
+    bindNative();
+  }
+  // Translating again would likely be undone by the next write, so stay off
+  // blocks until the next run.
+  if (codeWritten) {
+    resetBlocks();
+    selfModifying = true;
+  }
+}
+
+void Chip8::resetBlocks() {
+  blocks.clear();
+  for (int i = 0; i < 4096; i++) {
+    blockIndex[i] = NO_BLOCK;
+  }
+  blockCode.reset();
+  codeWritten = false;
+  selfModifying = false;
+}
+
+short Chip8::translate(unsigned short start) {
+  Block block;
+  block.start = start;
+  block.cycles = 0;
+  block.idleLoop = false;
+
+  unsigned short address = start;
+  while (block.cycles < MAX_BLOCK_LENGTH && address + 1 < 4096) {
+    Instruction in = decode(state.memory[address] << 8 | state.memory[address + 1], state.variant);
+    if (in.handler == &Chip8::opUnknown) {
+      break;
+    }
+    if (needsOwnBlock(in.opcode) && block.cycles > 0) {
+      break;
+    }
+    if (trapped(address)) {
+      break;
+    }
+
+    BlockOp op;
+    op.fused = nullptr;
+    op.first = in;
+    op.second = in;
+    op.cycles = 1;
+
+    bool last = endsBlock(in.opcode) || isSkip(in.opcode) ||
+      needsOwnBlock(in.opcode);
+
+    if (address + 3 < 4096 && !trapped(address + 2)) {
+      Instruction next = decode(state.memory[address + 2] << 8 | state.memory[address + 3], state.variant);
+      unsigned short pair = (in.opcode & 0xF000) | (next.opcode & 0xF000) >> 12;
+      if (pair == 0x6006) {
+        op.fused = &Chip8::op6XNN6XNN;
+      } else if (pair == 0xA00D) {
+        op.fused = drawFusion(state.variant);
+      } else if (pair == 0x3001) {
+        op.fused = &Chip8::op3XNN1NNN;
+      }
+      if (op.fused) {
+        op.second = next;
+        op.cycles = 2;
+      }
+    }
+
+    block.ops.push_back(op);
+    block.cycles += op.cycles;
+    address += 2 * op.cycles;
+
+    if (last) {
+      break;
+    }
+  }
+
+  if (block.ops.empty()) {
+    return NO_BLOCK;
+  }
+  block.end = address;
+
+  // FX07; 3X00; 1NNN jumping back to FX07 with the same X.
+  if (block.ops.size() == 2) {
+    const BlockOp& read = block.ops[0];
+    const BlockOp& poll = block.ops[1];
+    block.idleLoop = !read.fused && (read.first.opcode & 0xF0FF) == 0xF007 &&
+      poll.fused == &Chip8::op3XNN1NNN && poll.first.nn == 0 &&
+      poll.first.x == read.first.x && poll.second.nnn == start;
+  }
+
+  for (unsigned short i = block.start; i < block.end; i++) {
+    blockCode[i] = true;
+  }
+
+  blocks.push_back(std::move(block));
+  short index = static_cast<short>(blocks.size() - 1);
+  blockIndex[start] = index;
+  return index;
+}
+
+void Chip8::skipIdleLoop(unsigned short start, unsigned int cycles, unsigned char x, unsigned int budget,
+  unsigned int& executed) {
+  // Timers only move between calls to runCycles, so the loop would read the
+  // same non-zero value on every trip until the budget runs out. Account for
+  // all of those trips at once and leave the machine at the top of the loop,
+  // ready to see the next timer tick.
+  unsigned int trips = budget / cycles;
+  if (trips == 0) {
+    // Not enough budget left for a whole trip; finish on the interpreter.
+    emulateCycle();
+    executed++;
+    return;
+  }
+
+  state.V[x] = state.delay_timer;
+  state.pc = start;
+  executed += trips * cycles;
+}
@@ -0,0 +1,178 @@
+#include "chip8.hpp"
+#include "debug.hpp"
+#include "native.hpp"
+#include "rom_cache.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Runs every ROM on each way the core can execute it, side by side, and checks
+// the machines agree after every frame:
+//
+//   interpreter  emulateCycle() one instruction at a time
+//   blocks       runCycles(), on translated blocks
+//   native       runCycles() with the ROM's ahead-of-time compiled program
+//   debugger     runCycles() with a debugger watching all of memory under a
+//                condition that never holds, so every instruction that
+//                touches memory goes through it without ever stopping
+//
+// Each frame is run in chunks of varying size, down to single instructions,
+// with a check after every chunk: stale code usually runs only until the next
+// block boundary, and is gone again by the end of the frame. Keys are pressed
+// and released on a fixed pattern so games get past their title screens. A
+// run ends early, after checking the machines stopped the same way, when a
+// ROM faults.
+//
+// Usage: chip8_engines_test <rom or directory>...
+
+namespace {
+
+constexpr unsigned int FRAMES = 3600;
+// More than the default pace, to get further into each game.
+constexpr unsigned int CYCLES_PER_FRAME = 100;
+constexpr std::uint32_t SEED = 1;
+// Sizes of the runCycles calls within a frame, taken in turn.
+constexpr unsigned int CHUNKS[] = { 1, 1, 1, 1, 10, 13, 3, 64, 2, 7 };
+
+enum Engine { Interpreter, Blocks, Native, Debugged, ENGINES };
+const char* const ENGINE_NAMES[ENGINES] = { "interpreter", "blocks", "native", "debugger" };
+
+// Each key is held for 10 frames out of every 20, a different one each time.
+std::uint16_t keysFor(unsigned int frame) {
+  if (frame % 20 >= 10) {
+    return 0;
+  }
+  return static_cast<std::uint16_t>(1u << ((frame / 20) * 7 % 16));
+}
+
+// The first field that differs, or nullptr. The interpreter does not count
+// cycles, so that field is left out.
+const char* difference(const Chip8::State& a, const Chip8::State& b) {
+  if (std::memcmp(a.memory, b.memory, sizeof(a.memory)) != 0) return "memory";
+  if (std::memcmp(a.V, b.V, sizeof(a.V)) != 0) return "V";
+  if (a.I != b.I) return "I";
+  if (a.pc != b.pc) return "pc";
+  if (a.gfx != b.gfx || a.hires != b.hires) return "framebuffer";
+  if (a.delay_timer != b.delay_timer || a.sound_timer != b.sound_timer) return "timers";
+  if (a.sp != b.sp || std::memcmp(a.stack, b.stack, sizeof(a.stack)) != 0) return "stack";
+  if (std::memcmp(a.key, b.key, sizeof(a.key)) != 0) return "keys";
+  if (a.rng != b.rng) return "rng";
+  if (std::memcmp(a.flags, b.flags, sizeof(a.flags)) != 0) return "flags";
+  if (a.variant != b.variant) return "variant";
+  if (std::memcmp(a.audioPattern, b.audioPattern, sizeof(a.audioPattern)) != 0 || a.pitch != b.pitch) {
+    return "audio";
+  }
+  return nullptr;
+}
+
+bool isFault(Chip8::StopReason reason) {
+  return reason != Chip8::StopReason::CyclesDone && reason != Chip8::StopReason::WaitingForKey;
+}
+
+bool runRom(const std::string& rom) {
+  const std::shared_ptr<const RomImage> image = RomCache::shared().load(rom.c_str());
+  if (!image) {
+    return false;
+  }
+  const Chip8::NativeProgram* program = nativeProgramFor(image->hash);
+  if (!program) {
+    std::cerr << rom << ": not compiled, native runs on blocks\n";
+  }
+
+  std::vector<std::unique_ptr<Chip8>> machines;
+  for (int engine = 0; engine < ENGINES; engine++) {
+    machines.emplace_back(new Chip8(image->boot));
+    machines.back()->seed(SEED);
+  }
+  machines[Native]->setNativeProgram(program);
+  machines[Debugged]->setNativeProgram(program);
+
+  Debugger debugger(*machines[Debugged]);
+  const Debugger::Condition never = { Debugger::Condition::Compare::Greater, Debugger::REGISTER_I, 0xFFFF };
+  debugger.watchMemory(0, 4096, Debugger::ReadWrite, never);
+
+  std::size_t chunk = 0;
+  for (unsigned int frame = 0; frame < FRAMES; frame++) {
+    for (unsigned int left = CYCLES_PER_FRAME; left > 0;) {
+      const unsigned int count = std::min(CHUNKS[chunk++ % std::size(CHUNKS)], left);
+      left -= count;
+
+      Chip8::StopReason reasons[ENGINES] = {};
+      for (int engine = 0; engine < ENGINES; engine++) {
+        Chip8& chip8 = *machines[engine];
+        chip8.setKeys(keysFor(frame));
+        if (engine == Interpreter) {
+          // A faulting or waiting instruction just runs again without effect.
+          for (unsigned int i = 0; i < count; i++) {
+            chip8.emulateCycle();
+          }
+          reasons[engine] = Chip8::StopReason::CyclesDone;
+        } else {
+          reasons[engine] = chip8.runCycles(count).reason;
+        }
+      }
+
+      for (int engine = Blocks; engine < ENGINES; engine++) {
+        const char* field = difference(machines[Interpreter]->getState(), machines[engine]->getState());
+        if (field) {
+          std::cerr << rom << ": " << ENGINE_NAMES[engine] << " differs from the interpreter in " << field
+                    << " in frame " << frame << std::endl;
+          return false;
+        }
+        if (reasons[engine] != reasons[Blocks]) {
+          std::cerr << rom << ": " << ENGINE_NAMES[engine] << " stopped differently from blocks in frame "
+                    << frame << std::endl;
+          return false;
+        }
+      }
+      if (isFault(reasons[Blocks])) {
+        std::cout << rom << ": agree until it stops in frame " << frame << std::endl;
+        return true;
+      }
+    }
+
+    for (const std::unique_ptr<Chip8>& chip8 : machines) {
+      chip8->tickTimers();
+    }
+  }
+
+  std::cout << rom << ": agree over " << FRAMES << " frames" << std::endl;
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::vector<std::string> roms;
+  for (int i = 1; i < argc; i++) {
+    if (std::filesystem::is_directory(argv[i])) {
+      std::vector<std::string> found;
+      for (const auto& entry : std::filesystem::directory_iterator(argv[i])) {
+        if (entry.is_regular_file()) {
+          found.push_back(entry.path().string());
+        }
+      }
+      std::sort(found.begin(), found.end());
+      roms.insert(roms.end(), found.begin(), found.end());
+    } else {
+      roms.push_back(argv[i]);
+    }
+  }
+  if (roms.empty()) {
+    std::cerr << "Usage: " << argv[0] << " <rom or directory>...\n";
+    return 1;
+  }
+
+  int failed = 0;
+  for (const std::string& rom : roms) {
+    if (!runRom(rom)) {
+      failed++;
+    }
+  }
+  return failed == 0 ? 0 : 1;
+}
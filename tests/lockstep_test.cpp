@@ -0,0 +1,143 @@
+#include "chip8.hpp"
+#include "lockstep.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+// LockstepBatch keeps its own copy of every instruction's semantics, so this
+// runs each ROM as a batch and as one Chip8 per lane with the same seeds and
+// input, and checks every lane against its Chip8 after every runCycles call.
+// Lanes get different keys, so they split up and merge again, and there are
+// more of them than fit in one block. The test ROMs walk I past 0xFFF and
+// store, load and BCD through it, which the games never do.
+//
+// ROMs a batch cannot run are skipped.
+//
+// Usage: chip8_lockstep_test <rom or directory>...
+
+namespace {
+
+constexpr std::size_t LANES = 40;
+constexpr unsigned int FRAMES = 1800;
+constexpr unsigned int CYCLES_PER_FRAME = 100;
+constexpr unsigned int CHUNKS[] = { 1, 1, 1, 1, 10, 13, 3, 64, 2, 7 };
+
+// Like the engine test's pattern, but each lane presses a different key.
+std::uint16_t keysFor(std::size_t lane, unsigned int frame) {
+  if (frame % 20 >= 10) {
+    return 0;
+  }
+  return static_cast<std::uint16_t>(1u << ((frame / 20 + lane) * 7 % 16));
+}
+
+// The first field that differs, or nullptr.
+const char* difference(const Chip8::State& a, const Chip8::State& b) {
+  if (std::memcmp(a.memory, b.memory, sizeof(a.memory)) != 0) return "memory";
+  if (std::memcmp(a.V, b.V, sizeof(a.V)) != 0) return "V";
+  if (a.I != b.I) return "I";
+  if (a.pc != b.pc) return "pc";
+  if (a.gfx != b.gfx) return "framebuffer";
+  if (a.delay_timer != b.delay_timer || a.sound_timer != b.sound_timer) return "timers";
+  if (a.sp != b.sp || std::memcmp(a.stack, b.stack, sizeof(a.stack)) != 0) return "stack";
+  if (std::memcmp(a.key, b.key, sizeof(a.key)) != 0) return "keys";
+  if (a.rng != b.rng) return "rng";
+  if (a.cycles != b.cycles) return "cycles";
+  return nullptr;
+}
+
+bool runRom(const std::string& rom) {
+  if (!LockstepBatch::supports(rom.c_str())) {
+    std::cout << rom << ": skipped, needs another variant" << std::endl;
+    return true;
+  }
+
+  LockstepBatch batch(rom.c_str(), LANES);
+  std::vector<std::unique_ptr<Chip8>> machines;
+  for (std::size_t lane = 0; lane < LANES; lane++) {
+    machines.emplace_back(new Chip8(rom.c_str()));
+    machines.back()->seed(static_cast<std::uint32_t>(lane));
+    batch.seed(lane, static_cast<std::uint32_t>(lane));
+  }
+
+  std::size_t chunk = 0;
+  Chip8::State lane;
+  for (unsigned int frame = 0; frame < FRAMES; frame++) {
+    for (std::size_t j = 0; j < LANES; j++) {
+      const std::uint16_t keys = keysFor(j, frame);
+      machines[j]->setKeys(keys);
+      for (unsigned char key = 0; key < 16; key++) {
+        if (keys & (1u << key)) {
+          batch.pressKeys(j, key);
+        } else {
+          batch.releaseKeys(j, key);
+        }
+      }
+    }
+
+    for (unsigned int left = CYCLES_PER_FRAME; left > 0;) {
+      const unsigned int count = std::min(CHUNKS[chunk++ % std::size(CHUNKS)], left);
+      left -= count;
+
+      batch.runCycles(count);
+      for (std::size_t j = 0; j < LANES; j++) {
+        const Chip8::RunResult expected = machines[j]->runCycles(count);
+        const Chip8::RunResult result = batch.result(j);
+        batch.saveState(j, lane);
+        const char* field = difference(machines[j]->getState(), lane);
+        if (!field && (result.reason != expected.reason || result.cycles != expected.cycles)) {
+          field = "stop reason";
+        }
+        if (field) {
+          std::cerr << rom << ": lane " << j << " differs from Chip8 in " << field << " in frame " << frame
+                    << std::endl;
+          return false;
+        }
+      }
+    }
+
+    batch.tickTimers();
+    for (const std::unique_ptr<Chip8>& chip8 : machines) {
+      chip8->tickTimers();
+    }
+  }
+
+  std::cout << rom << ": " << LANES << " lanes agree over " << FRAMES << " frames" << std::endl;
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::vector<std::string> roms;
+  for (int i = 1; i < argc; i++) {
+    if (std::filesystem::is_directory(argv[i])) {
+      std::vector<std::string> found;
+      for (const auto& entry : std::filesystem::directory_iterator(argv[i])) {
+        if (entry.is_regular_file()) {
+          found.push_back(entry.path().string());
+        }
+      }
+      std::sort(found.begin(), found.end());
+      roms.insert(roms.end(), found.begin(), found.end());
+    } else {
+      roms.push_back(argv[i]);
+    }
+  }
+  if (roms.empty()) {
+    std::cerr << "Usage: " << argv[0] << " <rom or directory>...\n";
+    return 1;
+  }
+
+  int failed = 0;
+  for (const std::string& rom : roms) {
+    if (!runRom(rom)) {
+      failed++;
+    }
+  }
+  return failed == 0 ? 0 : 1;
+}
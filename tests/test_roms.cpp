@@ -0,0 +1,74 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Writes the hand-made ROMs the tests run next to the bundled games. They are
+// kept here as words rather than checked in as binaries so they can be read
+// and changed, and are written out at build time so chip8_aot can compile
+// them like any other ROM.
+//
+// Usage: chip8_test_roms <output directory>
+
+namespace {
+
+struct TestRom {
+  const char* name;
+  std::vector<unsigned short> words;
+};
+
+const TestRom ROMS[] = {
+  // Runs the block at 0x20C (VA = 0x11) once, then comes back through the
+  // skip to FX55, which turns its first instruction into 6A77. VA must end up
+  // 0x77 however the block at 0x20C was run the first time.
+  { "smc_block", {
+    0xA20C, 0x606A, 0x6177, 0x3B01, // I = 20C; V0 = 6A; V1 = 77; skip once VB = 1
+    0x120C, 0xF155,                 // first time round: go to 20C; then write 6A77 there
+    0x6A11, 0x7B01, 0x1206,         // 20C: VA = 11; VB += 1; back to the skip
+  } },
+  // FX55 right before the code it writes, so the write happens wherever the
+  // instructions in front of it ran.
+  { "smc_next", {
+    0xA208, 0x606A, 0x6177, 0xF155, // I = 208; V0 = 6A; V1 = 77; write 6A77 at 208
+    0x6A11, 0x120A,                 // 208: VA = 11, now 77; park
+  } },
+  // FX33 over the next instruction. BCD digits never form a valid opcode, so
+  // the machine must stop there with an illegal opcode instead of running the
+  // 6A11 it replaced.
+  { "smc_bcd", {
+    0x6040, 0xA208, 0xF033, 0x1208, // V0 = 40; I = 208; write 00 06 04 at 208; go there
+    0x6A11, 0x120A,
+  } },
+  // Walks I past 0xFFF with FX1E, then stores and loads through it. Accesses
+  // wrap at 4K, so the stores land all over memory, this code included.
+  { "i_wrap", {
+    0xAFF0, 0x60FF, 0x6106,                 // I = FF0; V0 = FF; V1 = 06
+    0xF01E, 0xF01E, 0xF01E, 0xF01E, 0xF01E, // I += FF, five times
+    0xF11E, 0xF155, 0xF165, 0xF033,         // I += 6; store, load, BCD through it
+    0x7001, 0x1206,                         // V0 += 1; again from the first FX1E
+  } },
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " <output directory>\n";
+    return 1;
+  }
+
+  for (const TestRom& rom : ROMS) {
+    const std::string path = std::string(argv[1]) + "/" + rom.name + ".ch8";
+    std::ofstream out{ path, std::ios::binary | std::ios::trunc };
+    for (unsigned short word : rom.words) {
+      out.put(static_cast<char>(word >> 8));
+      out.put(static_cast<char>(word & 0xFF));
+    }
+    if (!out) {
+      std::cerr << "Could not write " << path << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}